@@ -73,6 +73,20 @@
 struct task_struct;
 struct pt_regs;
 
+/*
+ * Kernel-mode Vector state of a task, in thread.riscv_v_flags:
+ *  - RISCV_KERNEL_MODE_V: a non-preemptible section is active, with
+ *    bottom halves and preemption disabled.
+ *  - RISCV_PREEMPT_V: a preemptible section is active.  Its registers
+ *    go to thread.kernel_vstate when the task is switched out.
+ *  - RISCV_PREEMPT_V_NESTED: a non-preemptible section nested in the
+ *    preemptible one keeps its registers in thread.kernel_vstate until
+ *    it ends.
+ */
+#define RISCV_KERNEL_MODE_V		0x1
+#define RISCV_PREEMPT_V			0x2
+#define RISCV_PREEMPT_V_NESTED		0x4
+
 /* CPU-specific state of a task */
 struct thread_struct {
 	/* Callee-saved registers */
@@ -84,6 +98,8 @@ struct thread_struct {
 	unsigned long vstate_ctrl;
 	struct __riscv_v_ext_state vstate;
 	unsigned long align_ctl;
+	u32 riscv_v_flags;
+	struct __riscv_v_ext_state kernel_vstate;
 };
 
 /* Whitelist the fstate from the task_struct for hardened usercopy */
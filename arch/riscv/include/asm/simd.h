@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (C) 2017 Linaro Ltd. <ard.biesheuvel@linaro.org>
+ * Copyright (C) 2023 SiFive
+ */
+
+#ifndef __ASM_SIMD_H
+#define __ASM_SIMD_H
+
+#include <linux/compiler.h>
+#include <linux/irqflags.h>
+#include <linux/preempt.h>
+#include <linux/types.h>
+
+#include <asm/vector.h>
+
+#ifdef CONFIG_RISCV_ISA_V
+
+/*
+ * may_use_simd - whether it is allowable at this time to issue vector
+ *                instructions or access the vector register file
+ *
+ * Kernel-mode Vector is only available in task context, also on top of a
+ * preemptible section of the same task.  Signal delivery, ptrace and the
+ * first-use trap change the user vector state without claiming the unit,
+ * so a softirq using it could interrupt them half-way.  A non-preemptible
+ * section must not nest.
+ */
+static __must_check inline bool may_use_simd(void)
+{
+	/*
+	 * local_bh_enable() at the end of a non-preemptible section
+	 * complains when called with interrupts disabled.
+	 */
+	return has_vector() && in_task() && !irqs_disabled() &&
+	       !(riscv_v_flags() & RISCV_KERNEL_MODE_V);
+}
+
+#else /* ! CONFIG_RISCV_ISA_V */
+
+static __must_check inline bool may_use_simd(void)
+{
+	return false;
+}
+
+#endif /* ! CONFIG_RISCV_ISA_V */
+#endif
@@ -279,19 +279,72 @@ static inline void riscv_v_vstate_restore(struct task_struct *task,
 	}
 }
 
+/*
+ * The user Vector state saved for kernel-mode Vector is only loaded back
+ * on the way out to user space, see arch_exit_to_user_mode_prepare().
+ */
+static inline void riscv_v_vstate_set_restore(struct task_struct *task,
+					      struct pt_regs *regs)
+{
+	unsigned long sr_vs;
+
+	ALT_SR_VS(sr_vs, SR_VS);
+
+	if ((regs->status & sr_vs) != SR_VS_OFF)
+		set_tsk_thread_flag(task, TIF_RISCV_V_DEFER_RESTORE);
+}
+
+static inline u32 riscv_v_flags(void)
+{
+	return READ_ONCE(current->thread.riscv_v_flags);
+}
+
+static inline bool riscv_preempt_v_started(struct task_struct *task)
+{
+	return !!(READ_ONCE(task->thread.riscv_v_flags) & RISCV_PREEMPT_V);
+}
+
 static inline void __switch_to_vector(struct task_struct *prev,
 				      struct task_struct *next)
 {
+	struct __riscv_v_ext_state *kvstate;
 	struct pt_regs *regs;
 
-	regs = task_pt_regs(prev);
-	riscv_v_vstate_save(prev, regs);
-	riscv_v_vstate_restore(next, task_pt_regs(next));
+	if (riscv_preempt_v_started(prev)) {
+		kvstate = &prev->thread.kernel_vstate;
+		__riscv_v_vstate_save(kvstate, kvstate->datap);
+	} else {
+		regs = task_pt_regs(prev);
+		riscv_v_vstate_save(prev, regs);
+	}
+
+	if (riscv_preempt_v_started(next)) {
+		kvstate = &next->thread.kernel_vstate;
+		__riscv_v_vstate_restore(kvstate, kvstate->datap);
+		/* Resume the section with the unit on */
+		riscv_v_enable();
+	} else {
+		riscv_v_vstate_restore(next, task_pt_regs(next));
+	}
 }
 
 void riscv_v_vstate_ctrl_init(struct task_struct *tsk);
 bool riscv_v_vstate_ctrl_user_allowed(void);
 
+/*
+ * Code touching the user Vector state of current outside of a context
+ * switch must run between these, so that the registers cannot be saved
+ * behind its back halfway through.
+ */
+void get_cpu_vector_context(void);
+void put_cpu_vector_context(void);
+
+void kernel_vector_begin(void);
+void kernel_vector_end(void);
+
+void riscv_v_kernel_vstate_init(struct task_struct *tsk);
+void riscv_v_kernel_vstate_free(struct task_struct *tsk);
+
 #else /* ! CONFIG_RISCV_ISA_V  */
 
 struct pt_regs;
@@ -305,6 +358,9 @@ static inline bool riscv_v_vstate_ctrl_user_allowed(void) { return false; }
 #define riscv_v_vstate_discard(regs)		do {} while (0)
 #define riscv_v_vstate_save(task, regs)		do {} while (0)
 #define riscv_v_vstate_restore(task, regs)	do {} while (0)
+#define riscv_v_vstate_set_restore(task, regs)	do {} while (0)
+#define riscv_v_kernel_vstate_init(tsk)		do {} while (0)
+#define riscv_v_kernel_vstate_free(tsk)		do {} while (0)
 #define __switch_to_vector(__prev, __next)	do {} while (0)
 #define riscv_v_vstate_off(regs)		do {} while (0)
 #define riscv_v_vstate_on(regs)			do {} while (0)
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2012 ARM Ltd.
+ * Author: Catalin Marinas <catalin.marinas@arm.com>
+ * Copyright (C) 2017 Linaro Ltd. <ard.biesheuvel@linaro.org>
+ * Copyright (C) 2021 SiFive
+ */
+#include <linux/bottom_half.h>
+#include <linux/compiler.h>
+#include <linux/export.h>
+#include <linux/init.h>
+#include <linux/preempt.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include <asm/vector.h>
+#include <asm/simd.h>
+
+/* Save areas of preemptible sections, riscv_v_vsize bytes, one per task */
+static struct kmem_cache *riscv_v_kernel_cachep __ro_after_init;
+
+/*
+ * Claim the vector unit of this CPU.  With bottom halves disabled the task
+ * cannot be switched out and no softirq can start using the unit, so the
+ * vector state cannot be saved or restored behind our back.
+ */
+void get_cpu_vector_context(void)
+{
+	if (!IS_ENABLED(CONFIG_PREEMPT_RT))
+		local_bh_disable();
+	else
+		preempt_disable();
+}
+EXPORT_SYMBOL_GPL(get_cpu_vector_context);
+
+void put_cpu_vector_context(void)
+{
+	if (!IS_ENABLED(CONFIG_PREEMPT_RT))
+		local_bh_enable();
+	else
+		preempt_enable();
+}
+EXPORT_SYMBOL_GPL(put_cpu_vector_context);
+
+static void riscv_v_flags_set(u32 flags)
+{
+	WRITE_ONCE(current->thread.riscv_v_flags,
+		   current->thread.riscv_v_flags | flags);
+}
+
+static void riscv_v_flags_clear(u32 flags)
+{
+	WRITE_ONCE(current->thread.riscv_v_flags,
+		   current->thread.riscv_v_flags & ~flags);
+}
+
+/*
+ * Hand the vector unit over from user space to the kernel.  The user state
+ * is only saved if it is live in the registers and dirty, and it is loaded
+ * back on the way out to user space rather than at the end of the section,
+ * so back-to-back sections in one system call pay for it once.
+ */
+static void riscv_v_save_user(void)
+{
+	struct pt_regs *regs = task_pt_regs(current);
+
+	riscv_v_vstate_save(current, regs);
+	riscv_v_vstate_set_restore(current, regs);
+}
+
+/*
+ * Start a preemptible section when called from preemptible context.  The
+ * registers are kept in a save area of the task while it is switched out.
+ * The area is allocated by the first preemptible section of the task and
+ * kept until the task is freed, see riscv_v_kernel_vstate_free().
+ */
+static bool riscv_v_start_preemptible(void)
+{
+	struct __riscv_v_ext_state *kvstate = &current->thread.kernel_vstate;
+
+	if (!preemptible() || !riscv_v_kernel_cachep ||
+	    riscv_preempt_v_started(current))
+		return false;
+
+	if (unlikely(!kvstate->datap)) {
+		/* Preemptible, but not allowed to sleep */
+		if (rcu_preempt_depth())
+			return false;
+
+		kvstate->datap = kmem_cache_alloc(riscv_v_kernel_cachep,
+						  GFP_KERNEL);
+		if (!kvstate->datap)
+			return false;
+	}
+
+	get_cpu_vector_context();
+	riscv_v_save_user();
+	riscv_v_flags_set(RISCV_PREEMPT_V);
+	riscv_v_enable();
+	put_cpu_vector_context();
+
+	return true;
+}
+
+static void riscv_v_stop_preemptible(void)
+{
+	get_cpu_vector_context();
+	riscv_v_disable();
+	riscv_v_flags_clear(RISCV_PREEMPT_V);
+	put_cpu_vector_context();
+}
+
+/*
+ * A new task starts without a save area, it must not share the one of the
+ * task it was copied from.  Called from arch_dup_task_struct().
+ */
+void riscv_v_kernel_vstate_init(struct task_struct *tsk)
+{
+	memset(&tsk->thread.kernel_vstate, 0, sizeof(tsk->thread.kernel_vstate));
+	tsk->thread.riscv_v_flags = 0;
+}
+
+/* Called from arch_release_task_struct() */
+void riscv_v_kernel_vstate_free(struct task_struct *tsk)
+{
+	if (tsk->thread.kernel_vstate.datap)
+		kmem_cache_free(riscv_v_kernel_cachep,
+				tsk->thread.kernel_vstate.datap);
+}
+
+/*
+ * kernel_vector_begin(): obtain the CPU vector registers for use by the calling
+ * context
+ *
+ * Must not be called unless may_use_simd() returns true.
+ * Task context in the vector registers is saved back to memory as necessary.
+ *
+ * A matching call to kernel_vector_end() must be made before returning from the
+ * calling context.
+ *
+ * Called from preemptible context, the section stays preemptible and may
+ * sleep.  Otherwise, or when nested in such a section, it runs with bottom
+ * halves and preemption disabled.
+ *
+ * The caller may freely manipulate the vector registers until
+ * kernel_vector_end() is called.
+ */
+void kernel_vector_begin(void)
+{
+	struct __riscv_v_ext_state *kvstate = &current->thread.kernel_vstate;
+
+	if (WARN_ON(!has_vector()))
+		return;
+
+	BUG_ON(!may_use_simd());
+
+	if (riscv_v_start_preemptible())
+		return;
+
+	get_cpu_vector_context();
+
+	if (riscv_preempt_v_started(current)) {
+		/*
+		 * Nested in a preemptible section of this task.  Its
+		 * registers are live, keep them aside until we are done.
+		 */
+		__riscv_v_vstate_save(kvstate, kvstate->datap);
+		riscv_v_flags_set(RISCV_PREEMPT_V_NESTED);
+	} else {
+		riscv_v_save_user();
+	}
+
+	riscv_v_flags_set(RISCV_KERNEL_MODE_V);
+	riscv_v_enable();
+}
+EXPORT_SYMBOL_GPL(kernel_vector_begin);
+
+/*
+ * kernel_vector_end(): give the CPU vector registers back to the current task
+ *
+ * Must be called from a context in which kernel_vector_begin() was previously
+ * called, with no call to kernel_vector_end() in the meantime.
+ *
+ * The caller must not use the vector registers after this function is called,
+ * unless kernel_vector_begin() is called again in the meantime.
+ */
+void kernel_vector_end(void)
+{
+	struct __riscv_v_ext_state *kvstate = &current->thread.kernel_vstate;
+	u32 flags = riscv_v_flags();
+
+	if (WARN_ON(!has_vector()))
+		return;
+
+	if (!(flags & RISCV_KERNEL_MODE_V)) {
+		riscv_v_stop_preemptible();
+		return;
+	}
+
+	riscv_v_flags_clear(RISCV_KERNEL_MODE_V);
+
+	if (flags & RISCV_PREEMPT_V_NESTED) {
+		__riscv_v_vstate_restore(kvstate, kvstate->datap);
+		riscv_v_flags_clear(RISCV_PREEMPT_V_NESTED);
+		/* The outer section carries on with the unit on */
+		riscv_v_enable();
+	} else {
+		riscv_v_disable();
+	}
+
+	put_cpu_vector_context();
+}
+EXPORT_SYMBOL_GPL(kernel_vector_end);
+
+static int __init riscv_v_kernel_mode_init(void)
+{
+	if (!has_vector())
+		return 0;
+
+	riscv_v_kernel_cachep = kmem_cache_create("riscv_vector_kctx",
+						  riscv_v_vsize, 16,
+						  SLAB_PANIC, NULL);
+	return 0;
+}
+core_initcall(riscv_v_kernel_mode_init);
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for kernel-mode Vector: the vector state of user space and of
+ * an outer kernel section must come out of nested use of the unit intact.
+ *
+ * The registers are filled and read back with __riscv_v_vstate_restore()
+ * and __riscv_v_vstate_save(), so the standard V and the XTheadVector
+ * encodings are both covered.
+ */
+
+#include <linux/hrtimer.h>
+#include <linux/jiffies.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <kunit/test.h>
+
+#include <asm/simd.h>
+#include <asm/vector.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Test kernel-mode Vector");
+
+/* Checks run with the unit claimed, so nothing may be allocated there */
+struct kmv_state {
+	struct __riscv_v_ext_state csr;
+	u8 *data;
+	u8 *expected;
+};
+
+static void kmv_state_init(struct kunit *test, struct kmv_state *st)
+{
+	st->data = kunit_kzalloc(test, riscv_v_vsize, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, st->data);
+	st->expected = kunit_kzalloc(test, riscv_v_vsize, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, st->expected);
+}
+
+static void kmv_pattern(u8 *data, u8 seed)
+{
+	unsigned long i;
+
+	for (i = 0; i < riscv_v_vsize; i++)
+		data[i] = seed + i * 7;
+}
+
+/* Load v0-v31 with a pattern derived from @seed */
+static void kmv_load(struct kmv_state *st, u8 seed)
+{
+	/* Start from the current control state, which is known valid */
+	__riscv_v_vstate_save(&st->csr, st->data);
+	kmv_pattern(st->data, seed);
+	__riscv_v_vstate_restore(&st->csr, st->data);
+}
+
+/* Check that v0-v31 still hold the pattern derived from @seed */
+static void kmv_check(struct kunit *test, struct kmv_state *st, u8 seed)
+{
+	__riscv_v_vstate_save(&st->csr, st->data);
+	kmv_pattern(st->expected, seed);
+	KUNIT_EXPECT_MEMEQ(test, st->data, st->expected, riscv_v_vsize);
+}
+
+static void kmv_may_use_simd(struct kunit *test)
+{
+	KUNIT_EXPECT_TRUE(test, may_use_simd());
+
+	local_irq_disable();
+	KUNIT_EXPECT_FALSE(test, may_use_simd());
+	local_irq_enable();
+
+	/* Non-preemptible sections do not nest */
+	preempt_disable();
+	kernel_vector_begin();
+	KUNIT_EXPECT_FALSE(test, may_use_simd());
+	kernel_vector_end();
+	preempt_enable();
+
+	/* Preemptible ones do */
+	kernel_vector_begin();
+	KUNIT_EXPECT_TRUE(test, may_use_simd());
+	kernel_vector_end();
+}
+
+static void kmv_nested(struct kunit *test)
+{
+	struct kmv_state outer, inner;
+
+	kmv_state_init(test, &outer);
+	kmv_state_init(test, &inner);
+
+	kernel_vector_begin();
+	kmv_load(&outer, 0x11);
+
+	kernel_vector_begin();
+	kmv_load(&inner, 0x22);
+	kmv_check(test, &inner, 0x22);
+	kernel_vector_end();
+
+	kmv_check(test, &outer, 0x11);
+	kernel_vector_end();
+}
+
+static void kmv_preempt(struct kunit *test)
+{
+	struct kmv_state st;
+
+	kmv_state_init(test, &st);
+
+	kernel_vector_begin();
+	kmv_load(&st, 0x33);
+	/* Let other tasks, possibly using the unit, run on this CPU */
+	schedule_timeout_uninterruptible(2);
+	kmv_check(test, &st, 0x33);
+	kernel_vector_end();
+}
+
+/* Preemptible sections allocate a save area once, and keep it */
+static void kmv_save_area(struct kunit *test)
+{
+	void *datap;
+
+	kernel_vector_begin();
+	kernel_vector_end();
+
+	datap = current->thread.kernel_vstate.datap;
+	KUNIT_ASSERT_NOT_NULL(test, datap);
+
+	kernel_vector_begin();
+	KUNIT_EXPECT_TRUE(test, riscv_preempt_v_started(current));
+	kernel_vector_end();
+
+	KUNIT_EXPECT_PTR_EQ(test, current->thread.kernel_vstate.datap, datap);
+}
+
+/* Softirqs stay off the unit, even on top of a preemptible section */
+struct kmv_softirq {
+	struct hrtimer timer;
+	bool may_use_simd;
+	bool done;
+};
+
+static enum hrtimer_restart kmv_softirq_fn(struct hrtimer *timer)
+{
+	struct kmv_softirq *s = container_of(timer, struct kmv_softirq, timer);
+
+	s->may_use_simd = may_use_simd();
+	WRITE_ONCE(s->done, true);
+	return HRTIMER_NORESTART;
+}
+
+static void kmv_softirq(struct kunit *test)
+{
+	unsigned long timeout = jiffies + HZ;
+	struct kmv_softirq s = {};
+	struct kmv_state st;
+
+	kmv_state_init(test, &st);
+
+	hrtimer_init(&s.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED_SOFT);
+	s.timer.function = kmv_softirq_fn;
+
+	kernel_vector_begin();
+	kmv_load(&st, 0x44);
+
+	/* Busy wait so that the softirq comes in on top of the section */
+	hrtimer_start(&s.timer, ns_to_ktime(NSEC_PER_USEC),
+		      HRTIMER_MODE_REL_PINNED_SOFT);
+	while (!READ_ONCE(s.done) && time_before(jiffies, timeout))
+		cpu_relax();
+	hrtimer_cancel(&s.timer);
+
+	kmv_check(test, &st, 0x44);
+	kernel_vector_end();
+
+	KUNIT_EXPECT_TRUE(test, s.done);
+	KUNIT_EXPECT_FALSE(test, s.may_use_simd);
+}
+
+/*
+ * Pretend the test thread has dirty user Vector state in the registers,
+ * then use the unit in nested sections.  The user state must have been
+ * saved and its restore deferred to the return to user space.  The test
+ * claims the unit while it changes thread.vstate, so that the state cannot
+ * be saved half-way.
+ */
+static void kmv_user_state(struct kunit *test)
+{
+	struct __riscv_v_ext_state saved = current->thread.vstate;
+	struct pt_regs *regs = task_pt_regs(current);
+	unsigned long status = regs->status;
+	struct kmv_state user, st;
+	u8 *expected;
+
+	kmv_state_init(test, &user);
+	kmv_state_init(test, &st);
+	expected = kunit_kzalloc(test, riscv_v_vsize, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, expected);
+	kmv_pattern(expected, 0x66);
+
+	get_cpu_vector_context();
+	current->thread.vstate.datap = kunit_kzalloc(test, riscv_v_vsize,
+						     GFP_ATOMIC);
+	if (!current->thread.vstate.datap) {
+		current->thread.vstate = saved;
+		put_cpu_vector_context();
+		KUNIT_FAIL(test, "out of memory");
+		return;
+	}
+	kmv_load(&user, 0x66);
+	__riscv_v_vstate_dirty(regs);
+	clear_thread_flag(TIF_RISCV_V_DEFER_RESTORE);
+	put_cpu_vector_context();
+
+	kernel_vector_begin();
+	kmv_load(&st, 0x77);
+	kernel_vector_begin();
+	kmv_load(&st, 0x88);
+	kernel_vector_end();
+	kmv_check(test, &st, 0x77);
+	kernel_vector_end();
+
+	KUNIT_EXPECT_TRUE(test, test_thread_flag(TIF_RISCV_V_DEFER_RESTORE));
+	KUNIT_EXPECT_MEMEQ(test, current->thread.vstate.datap, expected,
+			   riscv_v_vsize);
+
+	/* What arch_exit_to_user_mode_prepare() would do */
+	get_cpu_vector_context();
+	clear_thread_flag(TIF_RISCV_V_DEFER_RESTORE);
+	riscv_v_vstate_restore(current, regs);
+	kmv_check(test, &user, 0x66);
+	put_cpu_vector_context();
+
+	get_cpu_vector_context();
+	regs->status = status;
+	current->thread.vstate = saved;
+	put_cpu_vector_context();
+}
+
+static int kmv_init(struct kunit *test)
+{
+	if (!has_vector())
+		kunit_skip(test, "no vector unit");
+	/* Without it kernel_vector_begin() never starts a preemptible section */
+	if (!IS_ENABLED(CONFIG_PREEMPT_COUNT))
+		kunit_skip(test, "needs CONFIG_PREEMPT_COUNT");
+
+	return 0;
+}
+
+static struct kunit_case riscv_kernel_mode_vector_test_cases[] = {
+	KUNIT_CASE(kmv_may_use_simd),
+	KUNIT_CASE(kmv_nested),
+	KUNIT_CASE(kmv_preempt),
+	KUNIT_CASE(kmv_save_area),
+	KUNIT_CASE(kmv_softirq),
+	KUNIT_CASE(kmv_user_state),
+	{}
+};
+
+static struct kunit_suite riscv_kernel_mode_vector_test_suite = {
+	.name = "riscv_kernel_mode_vector",
+	.init = kmv_init,
+	.test_cases = riscv_kernel_mode_vector_test_cases,
+};
+
+kunit_test_suites(&riscv_kernel_mode_vector_test_suite);
@@ -72,6 +72,9 @@ struct erofs_mount_opts {
 
 	/* threshold for decompression synchronously */
 	unsigned int max_sync_decompress_pages;
+
+	/* spread pclusters of large async requests across CPUs */
+	bool parallel_decompress;
 #endif
 	unsigned int mount_opt;
 };
@@ -376,6 +376,7 @@ static void erofs_default_options(struct erofs_fs_context *ctx)
 	ctx->opt.cache_strategy = EROFS_ZIP_CACHE_READAROUND;
 	ctx->opt.max_sync_decompress_pages = 3;
 	ctx->opt.sync_decompress = EROFS_SYNC_DECOMPRESS_AUTO;
+	ctx->opt.parallel_decompress = true;
 #endif
 #ifdef CONFIG_EROFS_FS_XATTR
 	set_opt(&ctx->opt, XATTR_USER);
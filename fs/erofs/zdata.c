@@ -89,6 +89,9 @@ struct z_erofs_pcluster {
 	struct z_erofs_bvec compressed_bvecs[];
 };
 
+/* the minimum number of pclusters per segment for parallel decompression */
+#define Z_EROFS_PARALLEL_MIN_PCLUSTERS	4
+
 /* the end of a chain of pclusters */
 #define Z_EROFS_PCLUSTER_TAIL           ((void *) 0x700 + POISON_POINTER_DELTA)
 #define Z_EROFS_PCLUSTER_NIL            (NULL)
@@ -103,7 +106,7 @@ struct z_erofs_decompressqueue {
 		struct work_struct work;
 		struct kthread_work kthread_work;
 	} u;
-	bool eio, sync;
+	bool eio, sync, parallel;
 };
 
 static inline bool z_erofs_is_inline_pcluster(struct z_erofs_pcluster *pcl)
@@ -1360,6 +1363,66 @@ static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
 	}
 }
 
+static void z_erofs_decompressqueue_work(struct work_struct *work);
+
+/*
+ * Split a large background queue into several segments and hand all of them
+ * but the first one over to the unbound workqueue, so that independent
+ * pclusters of a single readahead request can be decompressed on other CPUs.
+ *
+ * The chain is in ascending file order, so the page which may be shared at a
+ * cut is the first output page of the following pcluster.  Only cut in front
+ * of a pcluster whose output starts at a page boundary, so the pclusters
+ * sharing a partial file page are still handled in order by the same worker.
+ */
+static void z_erofs_split_decompressqueue(struct z_erofs_decompressqueue *io)
+{
+	struct z_erofs_decompressqueue *seg = io, *q;
+	z_erofs_next_pcluster_t owned = io->head;
+	struct z_erofs_pcluster *pcl;
+	unsigned int nr = 0, nrsegs, seglen, i = 0;
+
+	if (!EROFS_SB(io->sb)->opt.parallel_decompress)
+		return;
+
+	while (owned != Z_EROFS_PCLUSTER_TAIL) {
+		pcl = container_of(owned, struct z_erofs_pcluster, next);
+		owned = READ_ONCE(pcl->next);
+		++nr;
+	}
+	nrsegs = min(num_online_cpus(), nr / Z_EROFS_PARALLEL_MIN_PCLUSTERS);
+	if (nrsegs <= 1)
+		return;
+	seglen = DIV_ROUND_UP(nr, nrsegs);
+
+	owned = io->head;
+	while (owned != Z_EROFS_PCLUSTER_TAIL) {
+		pcl = container_of(owned, struct z_erofs_pcluster, next);
+		owned = READ_ONCE(pcl->next);
+		if (++i < seglen || owned == Z_EROFS_PCLUSTER_TAIL ||
+		    container_of(owned, struct z_erofs_pcluster,
+				 next)->pageofs_out)
+			continue;
+
+		q = kvzalloc(sizeof(*q), GFP_NOIO | __GFP_NOWARN);
+		if (!q)
+			break;
+		q->sb = io->sb;
+		q->eio = io->eio;
+		q->head = owned;
+		INIT_WORK(&q->u.work, z_erofs_decompressqueue_work);
+
+		/* the previous segment is complete, so it can be kicked off */
+		WRITE_ONCE(pcl->next, Z_EROFS_PCLUSTER_TAIL);
+		if (seg != io)
+			queue_work(z_erofs_workqueue, &seg->u.work);
+		seg = q;
+		i = 0;
+	}
+	if (seg != io)
+		queue_work(z_erofs_workqueue, &seg->u.work);
+}
+
 static void z_erofs_decompressqueue_work(struct work_struct *work)
 {
 	struct z_erofs_decompressqueue *bgq =
@@ -1367,6 +1430,8 @@ static void z_erofs_decompressqueue_work(struct work_struct *work)
 	struct page *pagepool = NULL;
 
 	DBG_BUGON(bgq->head == Z_EROFS_PCLUSTER_TAIL);
+	if (bgq->parallel)
+		z_erofs_split_decompressqueue(bgq);
 	z_erofs_decompress_queue(bgq, &pagepool);
 	erofs_release_pages(&pagepool);
 	kvfree(bgq);
@@ -1547,6 +1612,7 @@ static struct z_erofs_decompressqueue *jobqueue_init(struct super_block *sb,
 #else
 		INIT_WORK(&q->u.work, z_erofs_decompressqueue_work);
 #endif
+		q->parallel = true;
 	} else {
 fg_out:
 		q = fgq;
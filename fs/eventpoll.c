@@ -227,6 +227,8 @@ struct eventpoll {
 #ifdef CONFIG_NET_RX_BUSY_POLL
 	/* used to track busy poll napi_id */
 	unsigned int napi_id;
+	/* the sockets of napi_id prefer busy polling, see SO_PREFER_BUSY_POLL */
+	bool prefer_busy_poll;
 #endif
 
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
@@ -403,23 +405,47 @@ static bool ep_busy_loop_end(void *p, unsigned long start_time)
 static bool ep_busy_loop(struct eventpoll *ep, int nonblock)
 {
 	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	bool prefer_busy_poll = READ_ONCE(ep->prefer_busy_poll);
 
 	if ((napi_id >= MIN_NAPI_ID) && net_busy_loop_on()) {
-		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep, false,
-			       BUSY_POLL_BUDGET);
+		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep,
+			       prefer_busy_poll, BUSY_POLL_BUDGET);
 		if (ep_events_available(ep))
 			return true;
 		/*
 		 * Busy poll timed out.  Drop NAPI ID for now, we can add
 		 * it back in when we have moved a socket with a valid NAPI
-		 * ID onto the ready list.
+		 * ID onto the ready list.  We are about to sleep, so let
+		 * the device interrupt us again.
 		 */
+		if (prefer_busy_poll)
+			napi_resume_irqs(napi_id);
 		ep->napi_id = 0;
 		return false;
 	}
 	return false;
 }
 
+/*
+ * Events were found while busy polling with preference, keep the device
+ * IRQs masked while userspace consumes them and comes back for more.
+ */
+static void ep_suspend_napi_irqs(struct eventpoll *ep)
+{
+	unsigned int napi_id = READ_ONCE(ep->napi_id);
+
+	if (napi_id >= MIN_NAPI_ID && READ_ONCE(ep->prefer_busy_poll))
+		napi_suspend_irqs(napi_id);
+}
+
+static void ep_resume_napi_irqs(struct eventpoll *ep)
+{
+	unsigned int napi_id = READ_ONCE(ep->napi_id);
+
+	if (napi_id >= MIN_NAPI_ID && READ_ONCE(ep->prefer_busy_poll))
+		napi_resume_irqs(napi_id);
+}
+
 /*
  * Set epoll busy poll NAPI ID from sk.
  */
@@ -453,6 +479,7 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 
 	/* record NAPI ID for use in next busy poll */
 	ep->napi_id = napi_id;
+	WRITE_ONCE(ep->prefer_busy_poll, READ_ONCE(sk->sk_prefer_busy_poll));
 }
 
 #else
@@ -466,6 +493,14 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 {
 }
 
+static inline void ep_suspend_napi_irqs(struct eventpoll *ep)
+{
+}
+
+static inline void ep_resume_napi_irqs(struct eventpoll *ep)
+{
+}
+
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
 /*
@@ -791,6 +826,9 @@ static void ep_clear_and_put(struct eventpoll *ep)
 	if (waitqueue_active(&ep->poll_wait))
 		ep_poll_safewake(ep, NULL, 0);
 
+	/* nobody is going to busy poll the NAPI for us anymore */
+	ep_resume_napi_irqs(ep);
+
 	mutex_lock(&ep->mtx);
 
 	/*
@@ -1861,8 +1899,11 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 			 * trying again in search of more luck.
 			 */
 			res = ep_send_events(ep, events, maxevents);
-			if (res)
+			if (res) {
+				if (res > 0)
+					ep_suspend_napi_irqs(ep);
 				return res;
+			}
 		}
 
 		if (timed_out)
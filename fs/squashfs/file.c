@@ -25,6 +25,13 @@
  * Larger files use multiple slots, with 1.75 TiB files using all 8 slots.
  * The index cache is designed to be memory efficient, and by default uses
  * 16 KiB.
+ *
+ * Because the index cache is shared by all files and only maps every skip'th
+ * block, random access to several large files still re-reads large parts
+ * of their block lists.  To avoid this, the whole block list of files with
+ * more than SQUASHFS_BLOCK_INDEX_MIN blocks is read into a per-inode block
+ * index on first access, which then maps any block without further metadata
+ * reads.  The index cache is only used if the block index can't be built.
  */
 
 #include <linux/fs.h>
@@ -320,17 +327,142 @@ static int fill_meta_index(struct inode *inode, int index,
 }
 
 
+/*
+ * Per-inode copy of the block list.  start[] holds the on-disk location of
+ * every (1 << SQUASHFS_BLOCK_INDEX_SHIFT)'th datablock, the location of the
+ * blocks in between is computed by adding up the preceding block sizes.
+ */
+struct squashfs_block_index {
+	unsigned int	blocks;
+	__le32		*size;
+	u64		start[];
+};
+
+
+/*
+ * Number of datablocks in the block list, the tail-end of the file has a
+ * block list entry only if it isn't packed into a fragment.
+ */
+static unsigned int block_list_entries(struct inode *inode)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	loff_t size = i_size_read(inode);
+	unsigned int blocks = size >> msblk->block_log;
+
+	if ((size & (msblk->block_size - 1)) &&
+			squashfs_i(inode)->fragment_block == SQUASHFS_INVALID_BLK)
+		blocks++;
+	return blocks;
+}
+
+
+static struct squashfs_block_index *read_block_index(struct inode *inode,
+				unsigned int blocks)
+{
+	u64 index_block = squashfs_i(inode)->block_list_start;
+	int offset = squashfs_i(inode)->offset;
+	u64 data_block = squashfs_i(inode)->start;
+	unsigned int nr_starts = (blocks >> SQUASHFS_BLOCK_INDEX_SHIFT) + 1;
+	unsigned int mask = (1 << SQUASHFS_BLOCK_INDEX_SHIFT) - 1;
+	struct squashfs_block_index *bi;
+	int err, i;
+
+	bi = kvmalloc(struct_size(bi, start, nr_starts) +
+			blocks * sizeof(__le32), GFP_KERNEL | __GFP_NOWARN);
+	if (bi == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	bi->blocks = blocks;
+	bi->size = (__le32 *) (bi->start + nr_starts);
+
+	err = squashfs_read_metadata(inode->i_sb, bi->size, &index_block,
+			&offset, blocks << 2);
+	if (err < 0)
+		goto failed;
+
+	for (i = 0; i < blocks; i++) {
+		int size = squashfs_block_size(bi->size[i]);
+
+		if (size < 0) {
+			err = size;
+			goto failed;
+		}
+		if ((i & mask) == 0)
+			bi->start[i >> SQUASHFS_BLOCK_INDEX_SHIFT] = data_block;
+		data_block += SQUASHFS_COMPRESSED_SIZE_BLOCK(size);
+	}
+
+	return bi;
+
+failed:
+	kvfree(bi);
+	return ERR_PTR(err);
+}
+
+
+/*
+ * Return the block index of the inode, building it on first use.  NULL
+ * is returned for small files, or if it can't be built, in which case the
+ * caller falls back to the index cache.  A corrupted or unreadable block
+ * list is remembered in the inode, so it isn't read again on every
+ * subsequent access.  Other failures, such as running out of memory, are
+ * retried on the next access.
+ */
+static struct squashfs_block_index *get_block_index(struct inode *inode)
+{
+	struct squashfs_inode_info *info = squashfs_i(inode);
+	struct squashfs_block_index *bi = smp_load_acquire(&info->block_index);
+	unsigned int blocks;
+
+	if (bi)
+		return IS_ERR(bi) ? NULL : bi;
+
+	blocks = block_list_entries(inode);
+	if (blocks <= SQUASHFS_BLOCK_INDEX_MIN ||
+			blocks > SQUASHFS_BLOCK_INDEX_MAX)
+		return NULL;
+
+	bi = read_block_index(inode, blocks);
+	if (IS_ERR(bi) && PTR_ERR(bi) != -EIO && PTR_ERR(bi) != -EINVAL)
+		return NULL;
+
+	/* Somebody else may have built the block index concurrently */
+	if (cmpxchg_release(&info->block_index, NULL, bi) != NULL) {
+		if (!IS_ERR(bi))
+			kvfree(bi);
+		bi = smp_load_acquire(&info->block_index);
+	}
+
+	return IS_ERR(bi) ? NULL : bi;
+}
+
+
 /*
  * Get the on-disk location and compressed size of the datablock
- * specified by index.  Fill_meta_index() does most of the work.
+ * specified by index.  Use the per-inode block index if present,
+ * otherwise fill_meta_index() does most of the work.
  */
 static int read_blocklist(struct inode *inode, int index, u64 *block)
 {
+	struct squashfs_block_index *bi = get_block_index(inode);
 	u64 start;
 	long long blks;
 	int offset;
 	__le32 size;
-	int res = fill_meta_index(inode, index, &start, &offset, block);
+	int res;
+
+	if (bi && index < bi->blocks) {
+		int i = index & ~((1 << SQUASHFS_BLOCK_INDEX_SHIFT) - 1);
+
+		start = bi->start[index >> SQUASHFS_BLOCK_INDEX_SHIFT];
+		for (; i < index; i++)
+			start += SQUASHFS_COMPRESSED_SIZE_BLOCK(
+					squashfs_block_size(bi->size[i]));
+		*block = start;
+		return squashfs_block_size(bi->size[index]);
+	}
+
+	res = fill_meta_index(inode, index, &start, &offset, block);
 
 	TRACE("read_blocklist: res %d, index %d, start 0x%llx, offset"
 		       " 0x%x, block 0x%llx\n", res, index, start, offset,
@@ -533,6 +665,121 @@ static int squashfs_readahead_fragment(struct page **page,
 	return error;
 }
 
+/*
+ * Decompress datablock <block, bsize> directly into the readahead pages,
+ * and unlock and release them.
+ */
+static void squashfs_readahead_block(struct inode *inode, struct page **pages,
+	unsigned int nr_pages, pgoff_t index, unsigned int expected, u64 block,
+	int bsize)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	loff_t file_end = i_size_read(inode) >> msblk->block_log;
+	struct squashfs_page_actor *actor;
+	struct page *last_page;
+	int i, res;
+
+	actor = squashfs_page_actor_init_special(msblk, pages, nr_pages,
+						 expected);
+	if (!actor)
+		goto out;
+
+	res = squashfs_read_data(inode->i_sb, block, bsize, NULL, actor);
+
+	last_page = squashfs_page_actor_free(actor);
+
+	if (res == expected) {
+		int bytes;
+
+		/* Last page (if present) may have trailing bytes not filled */
+		bytes = res % PAGE_SIZE;
+		if (index == file_end && bytes && last_page)
+			memzero_page(last_page, bytes,
+				     PAGE_SIZE - bytes);
+
+		for (i = 0; i < nr_pages; i++) {
+			flush_dcache_page(pages[i]);
+			SetPageUptodate(pages[i]);
+		}
+	}
+
+out:
+	for (i = 0; i < nr_pages; i++) {
+		unlock_page(pages[i]);
+		put_page(pages[i]);
+	}
+}
+
+/*
+ * If the decompressor can run several streams in parallel, all but the
+ * last datablock of a readahead window are read and decompressed
+ * asynchronously on squashfs_read_wq.  The pages of each datablock are
+ * unlocked as soon as it completes, rather than after the whole window.
+ */
+static struct workqueue_struct *squashfs_read_wq;
+
+struct squashfs_readahead_work {
+	struct work_struct	work;
+	struct inode		*inode;
+	u64			block;
+	int			bsize;
+	unsigned int		expected;
+	pgoff_t			index;
+	unsigned int		nr_pages;
+	struct page		*pages[];
+};
+
+static void squashfs_readahead_workfn(struct work_struct *work)
+{
+	struct squashfs_readahead_work *ra = container_of(work,
+				struct squashfs_readahead_work, work);
+
+	squashfs_readahead_block(ra->inode, ra->pages, ra->nr_pages, ra->index,
+				 ra->expected, ra->block, ra->bsize);
+	kfree(ra);
+}
+
+/*
+ * Queue datablock <block, bsize> for asynchronous decompression.  The
+ * locked pages pin the inode until the work has completed.  Returns false
+ * if the block has to be read synchronously instead.
+ */
+static bool squashfs_readahead_queue(struct inode *inode, struct page **pages,
+	unsigned int nr_pages, pgoff_t index, unsigned int expected, u64 block,
+	int bsize)
+{
+	struct squashfs_readahead_work *ra;
+
+	ra = kmalloc(struct_size(ra, pages, nr_pages),
+		     GFP_KERNEL | __GFP_NOWARN);
+	if (!ra)
+		return false;
+
+	INIT_WORK(&ra->work, squashfs_readahead_workfn);
+	ra->inode = inode;
+	ra->block = block;
+	ra->bsize = bsize;
+	ra->expected = expected;
+	ra->index = index;
+	ra->nr_pages = nr_pages;
+	memcpy(ra->pages, pages, nr_pages * sizeof(struct page *));
+	queue_work(squashfs_read_wq, &ra->work);
+	return true;
+}
+
+int __init squashfs_init_readahead(void)
+{
+	squashfs_read_wq = alloc_workqueue("squashfs_read",
+			WQ_UNBOUND | WQ_MEM_RECLAIM, num_possible_cpus());
+
+	return squashfs_read_wq ? 0 : -ENOMEM;
+}
+
+void squashfs_destroy_readahead(void)
+{
+	destroy_workqueue(squashfs_read_wq);
+}
+
 static void squashfs_readahead(struct readahead_control *ractl)
 {
 	struct inode *inode = ractl->mapping->host;
@@ -541,7 +788,7 @@ static void squashfs_readahead(struct readahead_control *ractl)
 	unsigned short shift = msblk->block_log - PAGE_SHIFT;
 	loff_t start = readahead_pos(ractl) & ~mask;
 	size_t len = readahead_length(ractl) + readahead_pos(ractl) - start;
-	struct squashfs_page_actor *actor;
+	bool async = msblk->max_thread_num > 1;
 	unsigned int nr_pages = 0;
 	struct page **pages;
 	int i;
@@ -559,7 +806,6 @@ static void squashfs_readahead(struct readahead_control *ractl)
 		int res, bsize;
 		u64 block = 0;
 		unsigned int expected;
-		struct page *last_page;
 
 		expected = start >> msblk->block_log == file_end ?
 			   (i_size_read(inode) & (msblk->block_size - 1)) :
@@ -592,34 +838,14 @@ static void squashfs_readahead(struct readahead_control *ractl)
 		if (bsize == 0)
 			goto skip_pages;
 
-		actor = squashfs_page_actor_init_special(msblk, pages, nr_pages,
-							 expected);
-		if (!actor)
-			goto skip_pages;
-
-		res = squashfs_read_data(inode->i_sb, block, bsize, NULL, actor);
-
-		last_page = squashfs_page_actor_free(actor);
-
-		if (res == expected) {
-			int bytes;
-
-			/* Last page (if present) may have trailing bytes not filled */
-			bytes = res % PAGE_SIZE;
-			if (index == file_end && bytes && last_page)
-				memzero_page(last_page, bytes,
-					     PAGE_SIZE - bytes);
-
-			for (i = 0; i < nr_pages; i++) {
-				flush_dcache_page(pages[i]);
-				SetPageUptodate(pages[i]);
-			}
-		}
+		/* The last block is read in this context, no point queueing */
+		if (async && readahead_count(ractl) &&
+		    squashfs_readahead_queue(inode, pages, nr_pages, index,
+					     expected, block, bsize))
+			continue;
 
-		for (i = 0; i < nr_pages; i++) {
-			unlock_page(pages[i]);
-			put_page(pages[i]);
-		}
+		squashfs_readahead_block(inode, pages, nr_pages, index,
+					 expected, block, bsize);
 	}
 
 	kfree(pages);
@@ -209,6 +209,11 @@ static inline int squashfs_block_size(__le32 raw)
 #define SQUASHFS_META_ENTRIES	127
 #define SQUASHFS_META_SLOTS	8
 
+/* per-inode block index */
+#define SQUASHFS_BLOCK_INDEX_SHIFT	6
+#define SQUASHFS_BLOCK_INDEX_MIN	SQUASHFS_META_INDEXES
+#define SQUASHFS_BLOCK_INDEX_MAX	(1 << 20)
+
 struct meta_entry {
 	u64			data_block;
 	unsigned int		index_block;
@@ -10,6 +10,8 @@
  * squashfs_fs_i.h
  */
 
+struct squashfs_block_index;
+
 struct squashfs_inode_info {
 	u64		start;
 	int		offset;
@@ -30,6 +32,7 @@ struct squashfs_inode_info {
 			int		parent;
 		};
 	};
+	struct squashfs_block_index	*block_index;
 	struct inode	vfs_inode;
 };
 
@@ -640,8 +640,15 @@ static int __init init_squashfs_fs(void)
 	if (err)
 		return err;
 
+	err = squashfs_init_readahead();
+	if (err) {
+		destroy_inodecache();
+		return err;
+	}
+
 	err = register_filesystem(&squashfs_fs_type);
 	if (err) {
+		squashfs_destroy_readahead();
 		destroy_inodecache();
 		return err;
 	}
@@ -655,6 +662,7 @@ static int __init init_squashfs_fs(void)
 static void __exit exit_squashfs_fs(void)
 {
 	unregister_filesystem(&squashfs_fs_type);
+	squashfs_destroy_readahead();
 	destroy_inodecache();
 }
 
@@ -664,12 +672,18 @@ static struct inode *squashfs_alloc_inode(struct super_block *sb)
 	struct squashfs_inode_info *ei =
 		alloc_inode_sb(sb, squashfs_inode_cachep, GFP_KERNEL);
 
-	return ei ? &ei->vfs_inode : NULL;
+	if (!ei)
+		return NULL;
+
+	ei->block_index = NULL;
+	return &ei->vfs_inode;
 }
 
 
 static void squashfs_free_inode(struct inode *inode)
 {
+	if (!IS_ERR(squashfs_i(inode)->block_index))
+		kvfree(squashfs_i(inode)->block_index);
 	kmem_cache_free(squashfs_inode_cachep, squashfs_i(inode));
 }
 
@@ -87,6 +87,51 @@ extern struct kobj_attribute shmem_enabled_attr;
 #define thp_vma_allowable_order(vma, vm_flags, smaps, in_pf, enforce_sysfs, order) \
 	(!!thp_vma_allowable_orders(vma, vm_flags, smaps, in_pf, enforce_sysfs, BIT(order)))
 
+/*
+ * Per-order events of large folios, exported through
+ * /sys/kernel/mm/transparent_hugepage/hugepages-<size>kB/stats/.
+ */
+enum mthp_stat_item {
+	MTHP_STAT_ZSWPOUT,
+	MTHP_STAT_ZSWPIN,
+	MTHP_STAT_SWPOUT,
+	MTHP_STAT_SWPOUT_FALLBACK,
+	MTHP_STAT_SWPOUT_FRAG,
+	MTHP_STAT_SWPIN,
+	MTHP_STAT_COLLAPSE,
+	MTHP_STAT_COLLAPSE_FAIL,
+	MTHP_STAT_COLLAPSE_ALLOC_FAILED,
+	MTHP_STAT_COLLAPSE_TIME_US,
+	__MTHP_STAT_COUNT
+};
+
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS)
+struct mthp_stat {
+	unsigned long stats[ilog2(MAX_PTRS_PER_PTE) + 1][__MTHP_STAT_COUNT];
+};
+
+DECLARE_PER_CPU(struct mthp_stat, mthp_stats);
+
+static inline void mod_mthp_stat(int order, enum mthp_stat_item item,
+				 unsigned long delta)
+{
+	if (order <= 0 || order > PMD_ORDER)
+		return;
+
+	this_cpu_add(mthp_stats.stats[order][item], delta);
+}
+#else
+static inline void mod_mthp_stat(int order, enum mthp_stat_item item,
+				 unsigned long delta)
+{
+}
+#endif
+
+static inline void count_mthp_stat(int order, enum mthp_stat_item item)
+{
+	mod_mthp_stat(order, item, 1);
+}
+
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 #define HPAGE_PMD_SHIFT PMD_SHIFT
 #define HPAGE_PMD_SIZE	((1UL) << HPAGE_PMD_SHIFT)
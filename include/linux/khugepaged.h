@@ -14,6 +14,7 @@ extern void __khugepaged_enter(struct mm_struct *mm);
 extern void __khugepaged_exit(struct mm_struct *mm);
 extern void khugepaged_enter_vma(struct vm_area_struct *vma,
 				 unsigned long vm_flags);
+extern void __khugepaged_hint(struct mm_struct *mm, unsigned long address);
 extern void khugepaged_min_free_kbytes_update(void);
 extern bool current_is_khugepaged(void);
 #ifdef CONFIG_SHMEM
@@ -38,6 +39,17 @@ static inline void khugepaged_exit(struct mm_struct *mm)
 	if (test_bit(MMF_VM_HUGEPAGE, &mm->flags))
 		__khugepaged_exit(mm);
 }
+
+/*
+ * Ask khugepaged to look at the PMD range around @address soon, e.g. because
+ * a fault there had to settle for a smaller folio than it wanted.
+ */
+static inline void khugepaged_hint(struct vm_area_struct *vma,
+				   unsigned long address)
+{
+	if (test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags))
+		__khugepaged_hint(vma->vm_mm, address);
+}
 #else /* CONFIG_TRANSPARENT_HUGEPAGE */
 static inline void khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
@@ -49,6 +61,10 @@ static inline void khugepaged_enter_vma(struct vm_area_struct *vma,
 					unsigned long vm_flags)
 {
 }
+static inline void khugepaged_hint(struct vm_area_struct *vma,
+				   unsigned long address)
+{
+}
 static inline int collapse_pte_mapped_thp(struct mm_struct *mm,
 					  unsigned long addr, bool install_pmd)
 {
@@ -340,8 +340,8 @@ struct mem_cgroup {
 
 /*
  * size of first charge trial.
- * TODO: maybe necessary to use big numbers in big irons or dynamic based of the
- * workload.
+ * This is the default; the charge batch can be changed with the
+ * "cgroup.memory=batch=<pages>" boot option and shrinks near the limit.
  */
 #define MEMCG_CHARGE_BATCH 64U
 
@@ -695,7 +695,7 @@ int mem_cgroup_hugetlb_try_charge(struct mem_cgroup *memcg, gfp_t gfp,
 
 int mem_cgroup_swapin_charge_folio(struct folio *folio, struct mm_struct *mm,
 				  gfp_t gfp, swp_entry_t entry);
-void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry);
+void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry, unsigned int nr_pages);
 
 void __mem_cgroup_uncharge(struct folio *folio);
 
@@ -1286,7 +1286,8 @@ static inline int mem_cgroup_swapin_charge_folio(struct folio *folio,
 	return 0;
 }
 
-static inline void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry)
+static inline void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry,
+						   unsigned int nr_pages)
 {
 }
 
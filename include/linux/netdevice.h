@@ -346,6 +346,19 @@ struct gro_list {
  */
 #define GRO_HASH_BUCKETS	8
 
+/*
+ * Per NAPI settings which outlive the NAPI instances themselves, so that
+ * they survive drivers freeing and recreating their NAPIs on queue
+ * reconfiguration or reset. Indexed by the index passed to
+ * netif_napi_add_config().
+ */
+struct napi_config {
+	u64 gro_flush_timeout;
+	u64 irq_suspend_timeout;
+	u32 defer_hard_irqs;
+	unsigned int napi_id;
+};
+
 /*
  * Structure for NAPI scheduling similar to tasklet but with weighting
  */
@@ -361,6 +374,9 @@ struct napi_struct {
 	unsigned long		state;
 	int			weight;
 	int			defer_hard_irqs_count;
+	u32			defer_hard_irqs;
+	unsigned long		gro_flush_timeout;
+	unsigned long		irq_suspend_timeout;
 	unsigned long		gro_bitmask;
 	int			(*poll)(struct napi_struct *, int);
 #ifdef CONFIG_NETPOLL
@@ -381,6 +397,8 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct hlist_node	napi_hash_node;
 	int			irq;
+	int			index;
+	struct napi_config	*config;
 };
 
 enum {
@@ -394,6 +412,7 @@ enum {
 	NAPI_STATE_PREFER_BUSY_POLL,	/* prefer busy-polling over softirq processing*/
 	NAPI_STATE_THREADED,		/* The poll is performed inside its own thread*/
 	NAPI_STATE_SCHED_THREADED,	/* Napi is currently scheduled in threaded mode */
+	NAPI_STATE_IRQ_SUSPENDED,	/* Busy polling app keeps device IRQs masked */
 };
 
 enum {
@@ -407,6 +426,7 @@ enum {
 	NAPIF_STATE_PREFER_BUSY_POLL	= BIT(NAPI_STATE_PREFER_BUSY_POLL),
 	NAPIF_STATE_THREADED		= BIT(NAPI_STATE_THREADED),
 	NAPIF_STATE_SCHED_THREADED	= BIT(NAPI_STATE_SCHED_THREADED),
+	NAPIF_STATE_IRQ_SUSPENDED	= BIT(NAPI_STATE_IRQ_SUSPENDED),
 };
 
 enum gro_result {
@@ -2473,6 +2493,12 @@ struct net_device {
 	/** @page_pools: page pools created for this netdevice */
 	struct hlist_head	page_pools;
 #endif
+
+	/**
+	 * @napi_config: per NAPI settings kept across NAPI re-creation,
+	 * one entry per queue, see netif_napi_add_config()
+	 */
+	struct napi_config	*napi_config;
 };
 #define to_net_dev(d) container_of(d, struct net_device, dev)
 
@@ -2710,6 +2736,26 @@ netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	netif_napi_add_weight(dev, napi, poll, NAPI_POLL_WEIGHT);
 }
 
+/**
+ * netif_napi_add_config() - initialize a NAPI context with persistent config
+ * @dev:   network device
+ * @napi:  NAPI context
+ * @poll:  polling function
+ * @index: queue index the NAPI serves, below the number of rx or tx queues
+ *
+ * Like netif_napi_add(), but the NAPI ID and the settings configured for
+ * the NAPI are kept in slot @index of the device and restored when the
+ * driver later adds a NAPI for the same index again.
+ */
+static inline void
+netif_napi_add_config(struct net_device *dev, struct napi_struct *napi,
+		      int (*poll)(struct napi_struct *, int), int index)
+{
+	napi->index = index;
+	napi->config = &dev->napi_config[index];
+	netif_napi_add_weight(dev, napi, poll, NAPI_POLL_WEIGHT);
+}
+
 static inline void
 netif_napi_add_tx_weight(struct net_device *dev,
 			 struct napi_struct *napi,
@@ -3163,6 +3209,8 @@ u16 dev_pick_tx_cpu_id(struct net_device *dev, struct sk_buff *skb,
 
 int __dev_queue_xmit(struct sk_buff *skb, struct net_device *sb_dev);
 int __dev_direct_xmit(struct sk_buff *skb, u16 queue_id);
+int __dev_direct_xmit_batch(struct sk_buff **skbs, unsigned int n,
+			    u16 queue_id, unsigned int *sent);
 
 static inline int dev_queue_xmit(struct sk_buff *skb)
 {
@@ -155,6 +155,18 @@
 #define SLAB_SKIP_KFENCE	0
 #endif
 
+/*
+ * Cache free objects in per-cpu arrays ("sheaves") in front of the slabs,
+ * exchanged as a whole with a per-node "barn". Meant for caches with heavy
+ * alloc/free churn, including frees on other CPUs than the allocation.
+ * Ignored for caches with debugging enabled. Implies SLAB_NO_MERGE.
+ */
+#ifndef CONFIG_SLUB_TINY
+#define SLAB_PERCPU_SHEAVES	((slab_flags_t __force)0x00000200U)
+#else
+#define SLAB_PERCPU_SHEAVES	0
+#endif
+
 /* The following flags affect the page allocator grouping pages by mobility */
 /* Objects are reclaimable */
 #ifndef CONFIG_SLUB_TINY
@@ -53,6 +53,10 @@ struct udp_sock {
 
 	unsigned long	 udp_flags;
 
+	/* Connected IPv4 sockets are also hashed on their 4-tuple */
+	struct hlist_node udp_lrpa_node;
+	unsigned int	 udp_lrpa_hash;
+
 	int		 pending;	/* Any pending frames ? */
 	__u8		 encap_type;	/* Is this an Encapsulation socket? */
 
@@ -168,6 +172,9 @@ static inline void udp_allow_gso(struct sock *sk)
 #define udp_portaddr_for_each_entry_rcu(__sk, list) \
 	hlist_for_each_entry_rcu(__sk, list, __sk_common.skc_portaddr_node)
 
+#define udp_lrpa_for_each_entry_rcu(__up, list) \
+	hlist_for_each_entry_rcu(__up, list, udp_lrpa_node)
+
 #define IS_UDPLITE(__sk) (__sk->sk_protocol == IPPROTO_UDPLITE)
 
 #endif	/* _LINUX_UDP_H */
@@ -29,6 +29,7 @@ struct zswap_lruvec_state {
 
 bool zswap_store(struct folio *folio);
 bool zswap_load(struct folio *folio);
+int zswap_nr_present(swp_entry_t swp, int nr_pages);
 void zswap_invalidate(int type, pgoff_t offset);
 void zswap_swapon(int type);
 void zswap_swapoff(int type);
@@ -50,6 +51,11 @@ static inline bool zswap_load(struct folio *folio)
 	return false;
 }
 
+static inline int zswap_nr_present(swp_entry_t swp, int nr_pages)
+{
+	return 0;
+}
+
 static inline void zswap_invalidate(int type, pgoff_t offset) {}
 static inline void zswap_swapon(int type) {}
 static inline void zswap_swapoff(int type) {}
@@ -22,6 +22,7 @@
 #include <linux/percpu.h>
 #include <linux/notifier.h>
 #include <linux/refcount.h>
+#include <linux/jump_label.h>
 
 struct fib_config {
 	u8			fc_dst_len;
@@ -283,6 +284,12 @@ struct fib_table *fib_trie_unmerge(struct fib_table *main_tb);
 void fib_table_flush_external(struct fib_table *table);
 void fib_free_table(struct fib_table *tb);
 
+#ifdef CONFIG_IP_FIB_DXR
+DECLARE_STATIC_KEY_FALSE(fib_dxr_key);
+void fib_dxr_set_enabled(bool enable);
+void fib_dxr_flush(void);
+#endif
+
 #ifndef CONFIG_IP_MULTIPLE_TABLES
 
 #define TABLE_LOCAL_INDEX	(RT_TABLE_LOCAL & (FIB_TABLE_HASHSZ - 1))
@@ -130,9 +130,14 @@ struct neigh_statistics {
 
 	unsigned long unres_discards;	/* number of unresolved drops */
 	unsigned long table_fulls;      /* times even gc couldn't help */
+
+	unsigned long gc_time;		/* usecs spent in periodic/forced GC */
+	unsigned long lock_waits;	/* contended hash bucket locks */
 };
 
 #define NEIGH_CACHE_STAT_INC(tbl, field) this_cpu_inc((tbl)->stats->field)
+#define NEIGH_CACHE_STAT_ADD(tbl, field, val)	\
+	this_cpu_add((tbl)->stats->field, (val))
 
 struct neighbour {
 	struct neighbour __rcu	*next;
@@ -230,6 +235,10 @@ struct neigh_table {
 	struct list_head	gc_list;
 	struct list_head	managed_list;
 	rwlock_t		lock;
+	spinlock_t		gc_lock;
+	spinlock_t		*hash_locks;
+	unsigned int		hash_locks_mask;
+	unsigned int		gc_bucket;
 	unsigned long		last_rand;
 	struct neigh_statistics	__percpu *stats;
 	struct neigh_hash_table __rcu *nht;
@@ -56,6 +56,41 @@ DEFINE_EVENT(mm_filemap_op_page_cache, mm_filemap_add_to_page_cache,
 	TP_ARGS(folio)
 	);
 
+TRACE_EVENT(page_cache_ra_order,
+		TP_PROTO(struct inode *inode, pgoff_t index,
+			 struct file_ra_state *ra, unsigned int order),
+
+		TP_ARGS(inode, index, ra, order),
+
+		TP_STRUCT__entry(
+			__field(unsigned long, i_ino)
+			__field(dev_t, s_dev)
+			__field(pgoff_t, index)
+			__field(unsigned int, size)
+			__field(unsigned int, async_size)
+			__field(unsigned int, order)
+			__field(unsigned int, history)
+		),
+
+		TP_fast_assign(
+			__entry->i_ino = inode->i_ino;
+			if (inode->i_sb)
+				__entry->s_dev = inode->i_sb->s_dev;
+			else
+				__entry->s_dev = inode->i_rdev;
+			__entry->index = index;
+			__entry->size = ra->size;
+			__entry->async_size = ra->async_size;
+			__entry->order = order;
+			__entry->history = READ_ONCE(inode->i_mapping->ra_history);
+		),
+
+		TP_printk("dev=%d:%d ino=0x%lx index=0x%lx size=%u async_size=%u order=%u history=0x%x",
+			MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+			__entry->i_ino, __entry->index, __entry->size,
+			__entry->async_size, __entry->order, __entry->history)
+);
+
 TRACE_EVENT(filemap_set_wb_err,
 		TP_PROTO(struct address_space *mapping, errseq_t eseq),
 
@@ -435,6 +435,7 @@ enum {
 	TCA_HTB_CEIL64,
 	TCA_HTB_PAD,
 	TCA_HTB_OFFLOAD,
+	TCA_HTB_MQ,
 	__TCA_HTB_MAX,
 };
 
@@ -302,6 +302,8 @@ enum
 	LINUX_MIB_TCPAOKEYNOTFOUND,		/* TCPAOKeyNotFound */
 	LINUX_MIB_TCPAOGOOD,			/* TCPAOGood */
 	LINUX_MIB_TCPAODROPPEDICMPS,		/* TCPAODroppedIcmps */
+	LINUX_MIB_EPHEMPORTSCANNED,		/* EphemPortScanned */
+	LINUX_MIB_EPHEMPORTLOCKED,		/* EphemPortLocked */
 	__LINUX_MIB_MAX
 };
 
@@ -4158,7 +4158,8 @@ static int __init io_uring_init(void)
 	req_cachep = kmem_cache_create_usercopy("io_kiocb",
 				sizeof(struct io_kiocb), 0,
 				SLAB_HWCACHE_ALIGN | SLAB_PANIC |
-				SLAB_ACCOUNT | SLAB_TYPESAFE_BY_RCU,
+				SLAB_ACCOUNT | SLAB_TYPESAFE_BY_RCU |
+				SLAB_PERCPU_SHEAVES,
 				offsetof(struct io_kiocb, cmd.data),
 				sizeof_field(struct io_kiocb, cmd.data), NULL);
 	io_buf_cachep = kmem_cache_create("io_buffer", sizeof(struct io_buffer), 0,
@@ -748,7 +748,6 @@ static int __init crash_save_vmcoreinfo_init(void)
 	VMCOREINFO_SYMBOL_ARRAY(swapper_pg_dir);
 #endif
 	VMCOREINFO_SYMBOL(_stext);
-	VMCOREINFO_SYMBOL(vmap_area_list);
 
 #ifndef CONFIG_NUMA
 	VMCOREINFO_SYMBOL(mem_map);
@@ -157,6 +157,73 @@ static void test_kmalloc_redzone_access(struct kunit *test)
 	kmem_cache_destroy(s);
 }
 
+#ifndef CONFIG_SLUB_TINY
+static bool test_objects_distinct(void **p, unsigned int nr)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < nr; i++) {
+		if (!p[i])
+			return false;
+		for (j = 0; j < i; j++)
+			if (p[i] == p[j])
+				return false;
+	}
+	return true;
+}
+
+/*
+ * Allocate and free enough objects to run the sheaves dry and over, so that
+ * the sheaves are refilled from the slabs, exchanged with the barn and
+ * flushed, then check nothing was handed out twice.
+ */
+static void test_percpu_sheaves(struct kunit *test)
+{
+	struct kmem_cache *s = test_kmem_cache_create("TestSlub_sheaves", 64,
+							SLAB_PERCPU_SHEAVES);
+	unsigned int nr, i;
+	void **p;
+
+	if (!s->cpu_sheaves) {
+		kmem_cache_destroy(s);
+		kunit_skip(test, "sheaves not in use, debugging enabled?");
+	}
+
+	nr = 4 * s->sheaf_capacity + 1;
+	p = kunit_kcalloc(test, nr, sizeof(void *), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, p);
+
+	for (i = 0; i < nr; i++)
+		p[i] = kmem_cache_alloc(s, GFP_KERNEL);
+	KUNIT_EXPECT_TRUE(test, test_objects_distinct(p, nr));
+	for (i = 0; i < nr; i++)
+		kmem_cache_free(s, p[i]);
+
+	/* Allocation served from full sheaves in the spare and the barn */
+	for (i = 0; i < nr; i++)
+		p[i] = kmem_cache_alloc(s, GFP_KERNEL);
+	KUNIT_EXPECT_TRUE(test, test_objects_distinct(p, nr));
+
+	/* Bulk free and allocation go through the sheaves as well */
+	kmem_cache_free_bulk(s, nr / 2, p);
+	KUNIT_EXPECT_EQ(test, nr / 2, kmem_cache_alloc_bulk(s, GFP_KERNEL,
+							    nr / 2, p));
+	KUNIT_EXPECT_TRUE(test, test_objects_distinct(p, nr));
+	kmem_cache_free_bulk(s, nr, p);
+
+	/* Flush sheaves and barns back to the slabs and refill them again */
+	kmem_cache_shrink(s);
+	for (i = 0; i < nr; i++)
+		p[i] = kmem_cache_alloc(s, GFP_KERNEL);
+	KUNIT_EXPECT_TRUE(test, test_objects_distinct(p, nr));
+	kmem_cache_free_bulk(s, nr, p);
+
+	validate_slab_cache(s);
+	KUNIT_EXPECT_EQ(test, 0, slab_errors);
+	kmem_cache_destroy(s);
+}
+#endif
+
 static int test_init(struct kunit *test)
 {
 	slab_errors = 0;
@@ -177,6 +244,9 @@ static struct kunit_case test_cases[] = {
 
 	KUNIT_CASE(test_clobber_redzone_free),
 	KUNIT_CASE(test_kmalloc_redzone_access),
+#ifndef CONFIG_SLUB_TINY
+	KUNIT_CASE(test_percpu_sheaves),
+#endif
 	{}
 };
 
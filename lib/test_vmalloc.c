@@ -54,6 +54,7 @@ __param(int, run_test_mask, INT_MAX,
 		"\t\tid: 256,  name: kvfree_rcu_1_arg_vmalloc_test\n"
 		"\t\tid: 512,  name: kvfree_rcu_2_arg_vmalloc_test\n"
 		"\t\tid: 1024, name: vm_map_ram_test\n"
+		"\t\tid: 2048, name: random_window_alloc_test\n"
 		/* Add a new test case description here. */
 );
 
@@ -394,6 +395,44 @@ vm_map_ram_test(void)
 	return nr_allocated != map_nr_pages;
 }
 
+/*
+ * Keep a window of live allocations of random sizes and release
+ * them out of order, so that areas are spread over the KVA space
+ * and the busy as well as the lazy trees are kept populated while
+ * other workers allocate and free concurrently.
+ */
+#define RANDOM_WINDOW_SIZE 64
+
+static int random_window_alloc_test(void)
+{
+	void **ptr;
+	unsigned int n;
+	int i, rv = 0;
+
+	ptr = kcalloc(RANDOM_WINDOW_SIZE, sizeof(void *), GFP_KERNEL);
+	if (!ptr)
+		return -1;
+
+	for (i = 0; i < test_loop_count; i++) {
+		n = get_random_u32_below(RANDOM_WINDOW_SIZE);
+		vfree(ptr[n]);
+
+		ptr[n] = vmalloc(get_random_u32_inclusive(1, 16) * PAGE_SIZE);
+		if (!ptr[n]) {
+			rv = -1;
+			break;
+		}
+
+		*((__u8 *)ptr[n]) = 0;
+	}
+
+	for (i = 0; i < RANDOM_WINDOW_SIZE; i++)
+		vfree(ptr[i]);
+
+	kfree(ptr);
+	return rv;
+}
+
 struct test_case_desc {
 	const char *test_name;
 	int (*test_func)(void);
@@ -411,6 +450,7 @@ static struct test_case_desc test_case_array[] = {
 	{ "kvfree_rcu_1_arg_vmalloc_test", kvfree_rcu_1_arg_vmalloc_test },
 	{ "kvfree_rcu_2_arg_vmalloc_test", kvfree_rcu_2_arg_vmalloc_test },
 	{ "vm_map_ram_test", vm_map_ram_test },
+	{ "random_window_alloc_test", random_window_alloc_test },
 	/* Add a new test case here. */
 };
 
@@ -579,12 +619,14 @@ static void do_concurrent_test(void)
 				continue;
 
 			pr_info(
-				"Summary: %s passed: %d failed: %d repeat: %d loops: %d avg: %llu usec\n",
+				"Summary: %s passed: %d failed: %d repeat: %d loops: %d avg: %llu usec rate: %llu loops/sec\n",
 				test_case_array[j].test_name,
 				t->data[j].test_passed,
 				t->data[j].test_failed,
 				test_repeat_count, test_loop_count,
-				t->data[j].time);
+				t->data[j].time,
+				div64_u64((u64) test_loop_count * USEC_PER_SEC,
+					t->data[j].time ?: 1));
 		}
 
 		pr_info("All test took worker%d=%lu cycles\n",
@@ -21,6 +21,7 @@
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
 #include <linux/ksm.h>
+#include <linux/ktime.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -102,6 +103,14 @@ struct collapse_control {
 
 	/* nodemask for allocation fallback */
 	nodemask_t alloc_nmask;
+
+	/* Per-pte classification of a PMD range, for mTHP collapse */
+	DECLARE_BITMAP(mthp_bad, MAX_PTRS_PER_PTE);
+	DECLARE_BITMAP(mthp_none, MAX_PTRS_PER_PTE);
+	DECLARE_BITMAP(mthp_young, MAX_PTRS_PER_PTE);
+	DECLARE_BITMAP(mthp_writable, MAX_PTRS_PER_PTE);
+	DECLARE_BITMAP(mthp_contig, MAX_PTRS_PER_PTE);
+	DECLARE_BITMAP(mthp_done, MAX_PTRS_PER_PTE);
 };
 
 /**
@@ -130,6 +139,35 @@ static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/*
+ * PMD ranges that a page fault or madvise flagged as worth collapsing soon.
+ * They are scanned ahead of the round-robin cursor.  Hints are queued per
+ * cpu, so the fault path only touches cpu-local cache lines, in a small
+ * ring that overwrites its oldest entry when full: a lost hint only means
+ * the range waits for the regular scan.  khugepaged_hint_cpus tells the
+ * consumer which rings may hold hints.  The mm pointer is not pinned; it
+ * is revalidated against mm_slots_hash before use.
+ */
+#define KHUGEPAGED_NR_HINTS	8
+#define KHUGEPAGED_MADVISE_HINTS	8
+/* Hints served per khugepaged_scan_hints() call */
+#define KHUGEPAGED_HINTS_BUDGET	64
+
+struct khugepaged_hint_entry {
+	struct mm_struct *mm;
+	unsigned long address;
+};
+
+struct khugepaged_hints {
+	spinlock_t lock;
+	unsigned int head;
+	unsigned int nr;
+	struct khugepaged_hint_entry hint[KHUGEPAGED_NR_HINTS];
+};
+
+static DEFINE_PER_CPU(struct khugepaged_hints, khugepaged_hints);
+static struct cpumask khugepaged_hint_cpus;
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -368,6 +406,19 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		 * may not happen any time soon.
 		 */
 		khugepaged_enter_vma(vma, *vm_flags);
+		/*
+		 * Populated ranges can be collapsed right away rather than
+		 * when the scan cursor gets around to this mm.
+		 */
+		if (vma->anon_vma) {
+			unsigned long addr = round_up(vma->vm_start, HPAGE_PMD_SIZE);
+			int i;
+
+			for (i = 0; i < KHUGEPAGED_MADVISE_HINTS &&
+			     addr + HPAGE_PMD_SIZE <= vma->vm_end;
+			     i++, addr += HPAGE_PMD_SIZE)
+				khugepaged_hint(vma, addr);
+		}
 		break;
 	case MADV_NOHUGEPAGE:
 		*vm_flags &= ~VM_HUGEPAGE;
@@ -385,6 +436,11 @@ int hugepage_madvise(struct vm_area_struct *vma,
 
 int __init khugepaged_init(void)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(khugepaged_hints, cpu).lock);
+
 	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
 					  sizeof(struct khugepaged_mm_slot),
 					  __alignof__(struct khugepaged_mm_slot),
@@ -445,14 +501,69 @@ void __khugepaged_enter(struct mm_struct *mm)
 void khugepaged_enter_vma(struct vm_area_struct *vma,
 			  unsigned long vm_flags)
 {
+	unsigned long orders = vma_is_anonymous(vma) ? THP_ORDERS_ALL_ANON :
+						       BIT(PMD_ORDER);
+
 	if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
 	    hugepage_flags_enabled()) {
-		if (thp_vma_allowable_order(vma, vm_flags, false, false, true,
-					    PMD_ORDER))
+		if (thp_vma_allowable_orders(vma, vm_flags, false, false, true,
+					     orders))
 			__khugepaged_enter(vma->vm_mm);
 	}
 }
 
+void __khugepaged_hint(struct mm_struct *mm, unsigned long address)
+{
+	struct khugepaged_hints *hints;
+	unsigned int i, idx;
+	bool wakeup = false;
+
+	address &= HPAGE_PMD_MASK;
+
+	hints = get_cpu_ptr(&khugepaged_hints);
+	/* Called from the fault path: never wait for the consumer */
+	if (!spin_trylock(&hints->lock))
+		goto out;
+
+	for (i = 0; i < hints->nr; i++) {
+		idx = (hints->head + i) % KHUGEPAGED_NR_HINTS;
+		if (hints->hint[idx].mm == mm &&
+		    hints->hint[idx].address == address) {
+			spin_unlock(&hints->lock);
+			goto out;
+		}
+	}
+
+	idx = (hints->head + hints->nr) % KHUGEPAGED_NR_HINTS;
+	if (hints->nr == KHUGEPAGED_NR_HINTS)
+		hints->head = (hints->head + 1) % KHUGEPAGED_NR_HINTS;
+	else
+		hints->nr++;
+	hints->hint[idx].mm = mm;
+	hints->hint[idx].address = address;
+	spin_unlock(&hints->lock);
+
+	/*
+	 * Only dirty the shared mask when this cpu's ring was not flagged
+	 * yet.  The consumer clears the flag before it empties the ring, so
+	 * a hint queued after that is seen with the flag clear.
+	 */
+	if (!cpumask_test_cpu(smp_processor_id(), &khugepaged_hint_cpus)) {
+		cpumask_set_cpu(smp_processor_id(), &khugepaged_hint_cpus);
+		wakeup = true;
+	}
+out:
+	put_cpu_ptr(&khugepaged_hints);
+
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+}
+
+static bool khugepaged_has_hints(void)
+{
+	return !cpumask_empty(&khugepaged_hint_cpus);
+}
+
 void __khugepaged_exit(struct mm_struct *mm)
 {
 	struct khugepaged_mm_slot *mm_slot;
@@ -532,11 +643,34 @@ static bool is_refcount_suitable(struct folio *folio)
 	return folio_ref_count(folio) == expected_refcount;
 }
 
+/*
+ * The max_ptes_* tunables are in units of a PMD range.  Scale max_ptes_none
+ * down for smaller orders, capped below half the range so that repeated
+ * collapses cannot creep a sparse area up to a large folio one order at a
+ * time.  mTHP collapse does not take shared pages at all.
+ */
+static unsigned int collapse_max_ptes_none(int order)
+{
+	unsigned int max_ptes_none = khugepaged_max_ptes_none;
+
+	if (order == HPAGE_PMD_ORDER)
+		return max_ptes_none;
+
+	max_ptes_none = min_t(unsigned int, max_ptes_none, HPAGE_PMD_NR / 2 - 1);
+	return max_ptes_none >> (HPAGE_PMD_ORDER - order);
+}
+
+static unsigned int collapse_max_ptes_shared(int order)
+{
+	return order == HPAGE_PMD_ORDER ? khugepaged_max_ptes_shared : 0;
+}
+
 static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 					unsigned long address,
 					pte_t *pte,
 					struct collapse_control *cc,
-					struct list_head *compound_pagelist)
+					struct list_head *compound_pagelist,
+					int order)
 {
 	struct page *page = NULL;
 	struct folio *folio = NULL;
@@ -544,7 +678,7 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 	int none_or_zero = 0, shared = 0, result = SCAN_FAIL, referenced = 0;
 	bool writable = false;
 
-	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	for (_pte = pte; _pte < pte + (1 << order);
 	     _pte++, address += PAGE_SIZE) {
 		pte_t pteval = ptep_get(_pte);
 		if (pte_none(pteval) || (pte_present(pteval) &&
@@ -552,7 +686,7 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 			++none_or_zero;
 			if (!userfaultfd_armed(vma) &&
 			    (!cc->is_khugepaged ||
-			     none_or_zero <= khugepaged_max_ptes_none)) {
+			     none_or_zero <= collapse_max_ptes_none(order))) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_NONE_PTE;
@@ -580,7 +714,7 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 		if (page_mapcount(page) > 1) {
 			++shared;
 			if (cc->is_khugepaged &&
-			    shared > khugepaged_max_ptes_shared) {
+			    shared > collapse_max_ptes_shared(order)) {
 				result = SCAN_EXCEED_SHARED_PTE;
 				count_vm_event(THP_SCAN_EXCEED_SHARED_PTE);
 				goto out;
@@ -681,7 +815,8 @@ static void __collapse_huge_page_copy_succeeded(pte_t *pte,
 						struct vm_area_struct *vma,
 						unsigned long address,
 						spinlock_t *ptl,
-						struct list_head *compound_pagelist)
+						struct list_head *compound_pagelist,
+						int order)
 {
 	struct folio *src_folio;
 	struct page *src_page;
@@ -689,7 +824,7 @@ static void __collapse_huge_page_copy_succeeded(pte_t *pte,
 	pte_t *_pte;
 	pte_t pteval;
 
-	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	for (_pte = pte; _pte < pte + (1 << order);
 	     _pte++, address += PAGE_SIZE) {
 		pteval = ptep_get(_pte);
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
@@ -736,7 +871,8 @@ static void __collapse_huge_page_copy_failed(pte_t *pte,
 					     pmd_t *pmd,
 					     pmd_t orig_pmd,
 					     struct vm_area_struct *vma,
-					     struct list_head *compound_pagelist)
+					     struct list_head *compound_pagelist,
+					     int order)
 {
 	spinlock_t *pmd_ptl;
 
@@ -753,7 +889,7 @@ static void __collapse_huge_page_copy_failed(pte_t *pte,
 	 * Release both raw and compound pages isolated
 	 * in __collapse_huge_page_isolate.
 	 */
-	release_pte_pages(pte, pte + HPAGE_PMD_NR, compound_pagelist);
+	release_pte_pages(pte, pte + (1 << order), compound_pagelist);
 }
 
 /*
@@ -770,6 +906,7 @@ static void __collapse_huge_page_copy_failed(pte_t *pte,
  * @address: starting address to copy
  * @ptl: lock on raw pages' PTEs
  * @compound_pagelist: list that stores compound pages
+ * @order: order of the new hugepage
  */
 static int __collapse_huge_page_copy(pte_t *pte,
 				     struct page *page,
@@ -778,7 +915,8 @@ static int __collapse_huge_page_copy(pte_t *pte,
 				     struct vm_area_struct *vma,
 				     unsigned long address,
 				     spinlock_t *ptl,
-				     struct list_head *compound_pagelist)
+				     struct list_head *compound_pagelist,
+				     int order)
 {
 	struct page *src_page;
 	pte_t *_pte;
@@ -789,7 +927,7 @@ static int __collapse_huge_page_copy(pte_t *pte,
 	/*
 	 * Copying pages' contents is subject to memory poison at any iteration.
 	 */
-	for (_pte = pte, _address = address; _pte < pte + HPAGE_PMD_NR;
+	for (_pte = pte, _address = address; _pte < pte + (1 << order);
 	     _pte++, page++, _address += PAGE_SIZE) {
 		pteval = ptep_get(_pte);
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
@@ -805,10 +943,10 @@ static int __collapse_huge_page_copy(pte_t *pte,
 
 	if (likely(result == SCAN_SUCCEED))
 		__collapse_huge_page_copy_succeeded(pte, vma, address, ptl,
-						    compound_pagelist);
+						    compound_pagelist, order);
 	else
 		__collapse_huge_page_copy_failed(pte, pmd, orig_pmd, vma,
-						 compound_pagelist);
+						 compound_pagelist, order);
 
 	return result;
 }
@@ -888,16 +1026,18 @@ static int hpage_collapse_find_target_node(struct collapse_control *cc)
 #endif
 
 static bool hpage_collapse_alloc_folio(struct folio **folio, gfp_t gfp, int node,
-				      nodemask_t *nmask)
+				      nodemask_t *nmask, int order)
 {
-	*folio = __folio_alloc(gfp, HPAGE_PMD_ORDER, node, nmask);
+	*folio = __folio_alloc(gfp, order, node, nmask);
 
 	if (unlikely(!*folio)) {
-		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		if (order == HPAGE_PMD_ORDER)
+			count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
 		return false;
 	}
 
-	count_vm_event(THP_COLLAPSE_ALLOC);
+	if (order == HPAGE_PMD_ORDER)
+		count_vm_event(THP_COLLAPSE_ALLOC);
 	return true;
 }
 
@@ -910,7 +1050,7 @@ static bool hpage_collapse_alloc_folio(struct folio **folio, gfp_t gfp, int node
 static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 				   bool expect_anon,
 				   struct vm_area_struct **vmap,
-				   struct collapse_control *cc)
+				   struct collapse_control *cc, int order)
 {
 	struct vm_area_struct *vma;
 
@@ -921,10 +1061,10 @@ static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 	if (!vma)
 		return SCAN_VMA_NULL;
 
-	if (!thp_vma_suitable_order(vma, address, PMD_ORDER))
+	if (!thp_vma_suitable_order(vma, address, order))
 		return SCAN_ADDRESS_RANGE;
 	if (!thp_vma_allowable_order(vma, vma->vm_flags, false, false,
-				     cc->is_khugepaged, PMD_ORDER))
+				     cc->is_khugepaged, order))
 		return SCAN_VMA_CHECK;
 	/*
 	 * Anon VMA expected, the address may be unmapped then
@@ -1056,14 +1196,15 @@ static int __collapse_huge_page_swapin(struct mm_struct *mm,
 }
 
 static int alloc_charge_hpage(struct page **hpage, struct mm_struct *mm,
-			      struct collapse_control *cc)
+			      struct collapse_control *cc, int order)
 {
 	gfp_t gfp = (cc->is_khugepaged ? alloc_hugepage_khugepaged_gfpmask() :
 		     GFP_TRANSHUGE);
 	int node = hpage_collapse_find_target_node(cc);
 	struct folio *folio;
 
-	if (!hpage_collapse_alloc_folio(&folio, gfp, node, &cc->alloc_nmask)) {
+	if (!hpage_collapse_alloc_folio(&folio, gfp, node, &cc->alloc_nmask,
+					order)) {
 		*hpage = NULL;
 		return SCAN_ALLOC_HUGE_PAGE_FAIL;
 	}
@@ -1074,17 +1215,26 @@ static int alloc_charge_hpage(struct page **hpage, struct mm_struct *mm,
 		return SCAN_CGROUP_CHARGE_FAIL;
 	}
 
-	count_memcg_folio_events(folio, THP_COLLAPSE_ALLOC, 1);
+	if (order == HPAGE_PMD_ORDER)
+		count_memcg_folio_events(folio, THP_COLLAPSE_ALLOC, 1);
 
 	*hpage = folio_page(folio, 0);
 	return SCAN_SUCCEED;
 }
 
+/*
+ * Collapse the naturally aligned range of 1 << @order pages at @address into
+ * a new folio.  For orders below PMD the whole page table is still detached
+ * while the pages are copied, and is reinstalled with the new folio mapped
+ * by a contiguous run of ptes.
+ */
 static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 			      int referenced, int unmapped,
-			      struct collapse_control *cc)
+			      struct collapse_control *cc, int order)
 {
 	LIST_HEAD(compound_pagelist);
+	unsigned long pmd_address = address & HPAGE_PMD_MASK;
+	ktime_t start = ktime_get();
 	pmd_t *pmd, _pmd;
 	pte_t *pte;
 	pgtable_t pgtable;
@@ -1095,7 +1245,8 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 	struct vm_area_struct *vma;
 	struct mmu_notifier_range range;
 
-	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+	VM_BUG_ON(!IS_ALIGNED(address, PAGE_SIZE << order));
+	VM_BUG_ON(unmapped && order != HPAGE_PMD_ORDER);
 
 	/*
 	 * Before allocating the hugepage, release the mmap_lock read lock.
@@ -1105,12 +1256,12 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 	 */
 	mmap_read_unlock(mm);
 
-	result = alloc_charge_hpage(&hpage, mm, cc);
+	result = alloc_charge_hpage(&hpage, mm, cc, order);
 	if (result != SCAN_SUCCEED)
 		goto out_nolock;
 
 	mmap_read_lock(mm);
-	result = hugepage_vma_revalidate(mm, address, true, &vma, cc);
+	result = hugepage_vma_revalidate(mm, address, true, &vma, cc, order);
 	if (result != SCAN_SUCCEED) {
 		mmap_read_unlock(mm);
 		goto out_nolock;
@@ -1144,7 +1295,7 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 	 * mmap_lock.
 	 */
 	mmap_write_lock(mm);
-	result = hugepage_vma_revalidate(mm, address, true, &vma, cc);
+	result = hugepage_vma_revalidate(mm, address, true, &vma, cc, order);
 	if (result != SCAN_SUCCEED)
 		goto out_up_write;
 	/* check if the pmd is still valid */
@@ -1155,8 +1306,8 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 	vma_start_write(vma);
 	anon_vma_lock_write(vma->anon_vma);
 
-	mmu_notifier_range_init(&range, MMU_NOTIFY_CLEAR, 0, mm, address,
-				address + HPAGE_PMD_SIZE);
+	mmu_notifier_range_init(&range, MMU_NOTIFY_CLEAR, 0, mm, pmd_address,
+				pmd_address + HPAGE_PMD_SIZE);
 	mmu_notifier_invalidate_range_start(&range);
 
 	pmd_ptl = pmd_lock(mm, pmd); /* probably unnecessary */
@@ -1168,7 +1319,7 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 	 * Parallel fast GUP is fine since fast GUP will back off when
 	 * it detects PMD is changed.
 	 */
-	_pmd = pmdp_collapse_flush(vma, address, pmd);
+	_pmd = pmdp_collapse_flush(vma, pmd_address, pmd);
 	spin_unlock(pmd_ptl);
 	mmu_notifier_invalidate_range_end(&range);
 	tlb_remove_table_sync_one();
@@ -1176,7 +1327,7 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 	pte = pte_offset_map_lock(mm, &_pmd, address, &pte_ptl);
 	if (pte) {
 		result = __collapse_huge_page_isolate(vma, address, pte, cc,
-						      &compound_pagelist);
+						      &compound_pagelist, order);
 		spin_unlock(pte_ptl);
 	} else {
 		result = SCAN_PMD_NULL;
@@ -1206,31 +1357,59 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 
 	result = __collapse_huge_page_copy(pte, hpage, pmd, _pmd,
 					   vma, address, pte_ptl,
-					   &compound_pagelist);
-	pte_unmap(pte);
-	if (unlikely(result != SCAN_SUCCEED))
+					   &compound_pagelist, order);
+	if (unlikely(result != SCAN_SUCCEED)) {
+		pte_unmap(pte);
 		goto out_up_write;
+	}
 
 	folio = page_folio(hpage);
 	/*
 	 * The smp_wmb() inside __folio_mark_uptodate() ensures the
 	 * copy_huge_page writes become visible before the set_pmd_at()
-	 * write.
+	 * or set_ptes() write.
 	 */
 	__folio_mark_uptodate(folio);
-	pgtable = pmd_pgtable(_pmd);
-
-	_pmd = mk_huge_pmd(hpage, vma->vm_page_prot);
-	_pmd = maybe_pmd_mkwrite(pmd_mkdirty(_pmd), vma);
-
-	spin_lock(pmd_ptl);
-	BUG_ON(!pmd_none(*pmd));
-	folio_add_new_anon_rmap(folio, vma, address);
-	folio_add_lru_vma(folio, vma);
-	pgtable_trans_huge_deposit(mm, pmd, pgtable);
-	set_pmd_at(mm, address, pmd, _pmd);
-	update_mmu_cache_pmd(vma, address, pmd);
-	spin_unlock(pmd_ptl);
+
+	if (order == HPAGE_PMD_ORDER) {
+		pte_unmap(pte);
+		pgtable = pmd_pgtable(_pmd);
+
+		_pmd = mk_huge_pmd(hpage, vma->vm_page_prot);
+		_pmd = maybe_pmd_mkwrite(pmd_mkdirty(_pmd), vma);
+
+		spin_lock(pmd_ptl);
+		BUG_ON(!pmd_none(*pmd));
+		folio_add_new_anon_rmap(folio, vma, address);
+		folio_add_lru_vma(folio, vma);
+		pgtable_trans_huge_deposit(mm, pmd, pgtable);
+		set_pmd_at(mm, address, pmd, _pmd);
+		update_mmu_cache_pmd(vma, address, pmd);
+		spin_unlock(pmd_ptl);
+	} else {
+		int nr = 1 << order;
+		pte_t entry;
+
+		entry = mk_pte(hpage, vma->vm_page_prot);
+		entry = maybe_mkwrite(pte_mkdirty(entry), vma);
+
+		/*
+		 * The page table is still detached, so the ptes can be set
+		 * without pte_ptl; only reinstalling it needs pmd_ptl.
+		 */
+		folio_ref_add(folio, nr - 1);
+		folio_add_new_anon_rmap(folio, vma, address);
+		folio_add_lru_vma(folio, vma);
+		set_ptes(mm, address, pte, entry, nr);
+		update_mmu_cache_range(NULL, vma, address, pte, nr);
+		pte_unmap(pte);
+
+		spin_lock(pmd_ptl);
+		BUG_ON(!pmd_none(*pmd));
+		smp_wmb(); /* ptes must be visible before the pmd is */
+		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
+		spin_unlock(pmd_ptl);
+	}
 
 	hpage = NULL;
 
@@ -1240,6 +1419,15 @@ static int collapse_huge_page(struct mm_struct *mm, unsigned long address,
 out_nolock:
 	if (hpage)
 		put_page(hpage);
+	if (result == SCAN_SUCCEED) {
+		count_mthp_stat(order, MTHP_STAT_COLLAPSE);
+		mod_mthp_stat(order, MTHP_STAT_COLLAPSE_TIME_US,
+			      ktime_us_delta(ktime_get(), start));
+	} else if (result == SCAN_ALLOC_HUGE_PAGE_FAIL) {
+		count_mthp_stat(order, MTHP_STAT_COLLAPSE_ALLOC_FAILED);
+	} else {
+		count_mthp_stat(order, MTHP_STAT_COLLAPSE_FAIL);
+	}
 	trace_mm_collapse_huge_page(mm, result == SCAN_SUCCEED, result);
 	return result;
 }
@@ -1405,7 +1593,7 @@ static int hpage_collapse_scan_pmd(struct mm_struct *mm,
 	pte_unmap_unlock(pte, ptl);
 	if (result == SCAN_SUCCEED) {
 		result = collapse_huge_page(mm, address, referenced,
-					    unmapped, cc);
+					    unmapped, cc, HPAGE_PMD_ORDER);
 		/* collapse_huge_page will return with the mmap_lock released */
 		*mmap_locked = false;
 	}
@@ -1415,6 +1603,261 @@ static int hpage_collapse_scan_pmd(struct mm_struct *mm,
 	return result;
 }
 
+/*
+ * Whether the naturally aligned range of 1 << @order ptes at index @start is
+ * worth collapsing, going by the classification hpage_collapse_scan_mthp()
+ * recorded in @cc.
+ */
+static bool mthp_range_collapsible(struct collapse_control *cc,
+				   unsigned int start, int order)
+{
+	unsigned int end = start + (1U << order);
+	unsigned int max_ptes_none = collapse_max_ptes_none(order);
+	unsigned int bit = start, none = 0;
+
+	if (find_next_bit(cc->mthp_bad, end, start) < end ||
+	    find_next_bit(cc->mthp_done, end, start) < end)
+		return false;
+	if (find_next_bit(cc->mthp_young, end, start) >= end ||
+	    find_next_bit(cc->mthp_writable, end, start) >= end)
+		return false;
+	/* Already mapped by (part of) a single large folio */
+	if (find_next_zero_bit(cc->mthp_contig, end, start + 1) >= end)
+		return false;
+
+	for_each_set_bit_from(bit, cc->mthp_none, end) {
+		if (++none > max_ptes_none)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Failures that only concern the range collapse_huge_page() was asked to
+ * collapse; anything else means the vma or the mm changed under us.
+ */
+static bool mthp_collapse_range_failure(int result)
+{
+	switch (result) {
+	case SCAN_PAGE_LOCK:
+	case SCAN_PAGE_COUNT:
+	case SCAN_PAGE_LRU:
+	case SCAN_DEL_PAGE_LRU:
+	case SCAN_PAGE_NULL:
+	case SCAN_PTE_NON_PRESENT:
+	case SCAN_PTE_UFFD_WP:
+	case SCAN_EXCEED_NONE_PTE:
+	case SCAN_EXCEED_SHARED_PTE:
+	case SCAN_LACK_REFERENCED_PAGE:
+	case SCAN_PAGE_RO:
+	case SCAN_COPY_MC:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Try to collapse parts of the PMD range at @address into the anon mTHP
+ * @orders, highest order first.  The ptes are classified once under the
+ * page table lock; collapse_huge_page() rechecks everything it relies on.
+ *
+ * Called with mmap_lock held for read.  *@mmap_locked is cleared if the
+ * lock was dropped.
+ */
+static int hpage_collapse_scan_mthp(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address, unsigned long orders,
+				    bool *mmap_locked,
+				    struct collapse_control *cc)
+{
+	unsigned long _address, prev_pfn = 0;
+	struct folio *folio, *prev_folio = NULL;
+	int result, node, order, collapsed = 0;
+	bool uffd = userfaultfd_armed(vma);
+	pte_t *pte, *_pte;
+	spinlock_t *ptl;
+	pmd_t *pmd;
+	int i;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	result = find_pmd_or_thp_or_none(mm, address, &pmd);
+	if (result != SCAN_SUCCEED)
+		return result;
+
+	memset(cc->node_load, 0, sizeof(cc->node_load));
+	nodes_clear(cc->alloc_nmask);
+	bitmap_zero(cc->mthp_bad, HPAGE_PMD_NR);
+	bitmap_zero(cc->mthp_none, HPAGE_PMD_NR);
+	bitmap_zero(cc->mthp_young, HPAGE_PMD_NR);
+	bitmap_zero(cc->mthp_writable, HPAGE_PMD_NR);
+	bitmap_zero(cc->mthp_contig, HPAGE_PMD_NR);
+	bitmap_zero(cc->mthp_done, HPAGE_PMD_NR);
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte)
+		return SCAN_PMD_NULL;
+
+	for (i = 0, _address = address, _pte = pte; i < HPAGE_PMD_NR;
+	     i++, _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = ptep_get(_pte);
+		struct page *page;
+
+		folio = NULL;
+		if (pte_none(pteval) || (pte_present(pteval) &&
+					 is_zero_pfn(pte_pfn(pteval)))) {
+			__set_bit(i, uffd ? cc->mthp_bad : cc->mthp_none);
+			goto next;
+		}
+		/* Swapin is left to PMD collapse */
+		if (!pte_present(pteval) || pte_uffd_wp(pteval)) {
+			__set_bit(i, cc->mthp_bad);
+			goto next;
+		}
+
+		page = vm_normal_page(vma, _address, pteval);
+		if (unlikely(!page) || unlikely(is_zone_device_page(page)) ||
+		    page_mapcount(page) > 1) {
+			__set_bit(i, cc->mthp_bad);
+			goto next;
+		}
+
+		folio = page_folio(page);
+		if (!folio_test_lru(folio) || folio_test_locked(folio) ||
+		    !folio_test_anon(folio) || !is_refcount_suitable(folio)) {
+			__set_bit(i, cc->mthp_bad);
+			folio = NULL;
+			goto next;
+		}
+
+		node = folio_nid(folio);
+		if (hpage_collapse_scan_abort(node, cc)) {
+			result = SCAN_SCAN_ABORT;
+			pte_unmap_unlock(pte, ptl);
+			goto out;
+		}
+		cc->node_load[node]++;
+
+		if (pte_write(pteval))
+			__set_bit(i, cc->mthp_writable);
+		if (pte_young(pteval) || folio_test_young(folio) ||
+		    folio_test_referenced(folio) ||
+		    mmu_notifier_test_young(mm, _address))
+			__set_bit(i, cc->mthp_young);
+		if (folio == prev_folio && pte_pfn(pteval) == prev_pfn + 1)
+			__set_bit(i, cc->mthp_contig);
+		prev_pfn = pte_pfn(pteval);
+next:
+		prev_folio = folio;
+	}
+	pte_unmap_unlock(pte, ptl);
+
+	result = SCAN_FAIL;
+	for (order = highest_order(orders); orders;
+	     order = next_order(&orders, order)) {
+		int nr = 1 << order;
+
+		for (i = 0; i < HPAGE_PMD_NR; i += nr) {
+			if (!mthp_range_collapsible(cc, i, order))
+				continue;
+
+			if (!*mmap_locked) {
+				mmap_read_lock(mm);
+				*mmap_locked = true;
+			}
+			result = collapse_huge_page(mm, address + i * PAGE_SIZE,
+						    0, 0, cc, order);
+			/* collapse_huge_page will return with the mmap_lock released */
+			*mmap_locked = false;
+
+			if (result == SCAN_SUCCEED) {
+				bitmap_set(cc->mthp_done, i, nr);
+				collapsed++;
+				continue;
+			}
+			/* Fragmented at this order: try the next one down */
+			if (result == SCAN_ALLOC_HUGE_PAGE_FAIL)
+				break;
+			if (!mthp_collapse_range_failure(result))
+				goto out;
+		}
+	}
+out:
+	if (collapsed)
+		result = SCAN_SUCCEED;
+	return result;
+}
+
+/*
+ * Scan the PMD range at @address of an anon vma: collapse it to a PMD-sized
+ * folio if that order is enabled and the range qualifies, and fall back to
+ * the smaller enabled orders otherwise.
+ */
+static int hpage_collapse_scan_anon(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address, bool *mmap_locked,
+				    struct collapse_control *cc)
+{
+	unsigned long orders;
+	int result = SCAN_VMA_CHECK;
+
+	if (!vma_is_anonymous(vma))
+		return hpage_collapse_scan_pmd(mm, vma, address, mmap_locked,
+					       cc);
+
+	orders = thp_vma_allowable_orders(vma, vma->vm_flags, false, false,
+					  cc->is_khugepaged,
+					  THP_ORDERS_ALL_ANON);
+	if (orders & BIT(PMD_ORDER)) {
+		result = hpage_collapse_scan_pmd(mm, vma, address, mmap_locked,
+						 cc);
+		switch (result) {
+		case SCAN_SUCCEED:
+		case SCAN_PMD_NULL:
+		case SCAN_PMD_NONE:
+		case SCAN_PMD_MAPPED:
+		case SCAN_SCAN_ABORT:
+			return result;
+		}
+		if (!*mmap_locked && result != SCAN_ALLOC_HUGE_PAGE_FAIL)
+			return result;
+	}
+
+	orders &= ~BIT(PMD_ORDER);
+	if (!orders)
+		return result;
+
+	if (!*mmap_locked) {
+		/*
+		 * No PMD-sized folio to be had: settle for smaller ones.  The
+		 * caller already treats the lock as dropped, so return with
+		 * it dropped whatever happens.
+		 */
+		mmap_read_lock(mm);
+		*mmap_locked = true;
+		vma = vma_lookup(mm, address);
+		if (!hpage_collapse_test_exit(mm) && vma &&
+		    vma_is_anonymous(vma) && vma->anon_vma &&
+		    range_in_vma(vma, address, address + HPAGE_PMD_SIZE)) {
+			orders &= thp_vma_allowable_orders(vma, vma->vm_flags,
+					false, false, cc->is_khugepaged,
+					THP_ORDERS_ALL_ANON);
+			if (orders)
+				result = hpage_collapse_scan_mthp(mm, vma,
+						address, orders, mmap_locked, cc);
+		}
+		if (*mmap_locked) {
+			mmap_read_unlock(mm);
+			*mmap_locked = false;
+		}
+		return result;
+	}
+
+	return hpage_collapse_scan_mthp(mm, vma, address, orders, mmap_locked,
+					cc);
+}
+
 static void collect_mm_slot(struct khugepaged_mm_slot *mm_slot)
 {
 	struct mm_slot *slot = &mm_slot->slot;
@@ -1807,7 +2250,7 @@ static int collapse_file(struct mm_struct *mm, unsigned long addr,
 	VM_BUG_ON(!IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) && !is_shmem);
 	VM_BUG_ON(start & (HPAGE_PMD_NR - 1));
 
-	result = alloc_charge_hpage(&hpage, mm, cc);
+	result = alloc_charge_hpage(&hpage, mm, cc, HPAGE_PMD_ORDER);
 	if (result != SCAN_SUCCEED)
 		goto out;
 
@@ -2366,14 +2809,16 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages, int *result,
 	vma_iter_init(&vmi, mm, khugepaged_scan.address);
 	for_each_vma(vmi, vma) {
 		unsigned long hstart, hend;
+		unsigned long orders = vma_is_anonymous(vma) ?
+				THP_ORDERS_ALL_ANON : BIT(PMD_ORDER);
 
 		cond_resched();
 		if (unlikely(hpage_collapse_test_exit(mm))) {
 			progress++;
 			break;
 		}
-		if (!thp_vma_allowable_order(vma, vma->vm_flags, false, false,
-					     true, PMD_ORDER)) {
+		if (!thp_vma_allowable_orders(vma, vma->vm_flags, false, false,
+					      true, orders)) {
 skip:
 			progress++;
 			continue;
@@ -2417,7 +2862,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages, int *result,
 					mmap_read_unlock(mm);
 				}
 			} else {
-				*result = hpage_collapse_scan_pmd(mm, vma,
+				*result = hpage_collapse_scan_anon(mm, vma,
 					khugepaged_scan.address, &mmap_locked, cc);
 			}
 
@@ -2473,6 +2918,87 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages, int *result,
 	return progress;
 }
 
+/* Scan one hinted PMD range, if its mm and vma still qualify */
+static void khugepaged_scan_hint(struct mm_struct *mm, unsigned long address,
+				 struct collapse_control *cc)
+{
+	struct vm_area_struct *vma;
+	bool mmap_locked = true;
+
+	/*
+	 * Unlike the round-robin scan, wait for the lock: hints are queued by
+	 * faults and madvise, which are likely still holding it.
+	 */
+	mmap_read_lock(mm);
+	if (unlikely(hpage_collapse_test_exit(mm)))
+		goto out_unlock;
+
+	vma = vma_lookup(mm, address);
+	if (!vma || !vma_is_anonymous(vma) || !vma->anon_vma ||
+	    !range_in_vma(vma, address, address + HPAGE_PMD_SIZE))
+		goto out_unlock;
+
+	if (hpage_collapse_scan_anon(mm, vma, address, &mmap_locked, cc) ==
+	    SCAN_SUCCEED)
+		++khugepaged_pages_collapsed;
+out_unlock:
+	if (mmap_locked)
+		mmap_read_unlock(mm);
+}
+
+/* Take all hints queued on @cpu, returns their number */
+static unsigned int khugepaged_take_hints(int cpu,
+		struct khugepaged_hint_entry *hint)
+{
+	struct khugepaged_hints *hints = per_cpu_ptr(&khugepaged_hints, cpu);
+	unsigned int i, nr;
+
+	spin_lock(&hints->lock);
+	nr = hints->nr;
+	for (i = 0; i < nr; i++)
+		hint[i] = hints->hint[(hints->head + i) % KHUGEPAGED_NR_HINTS];
+	hints->head = 0;
+	hints->nr = 0;
+	spin_unlock(&hints->lock);
+
+	return nr;
+}
+
+static void khugepaged_scan_hints(struct collapse_control *cc)
+{
+	struct khugepaged_hint_entry hint[KHUGEPAGED_NR_HINTS];
+	int budget = KHUGEPAGED_HINTS_BUDGET;
+	unsigned int i, nr;
+	struct mm_struct *mm;
+	int cpu;
+
+	for_each_cpu(cpu, &khugepaged_hint_cpus) {
+		if (budget <= 0 || kthread_should_stop())
+			break;
+		/* Fully ordered, pairs with the check in __khugepaged_hint() */
+		if (!cpumask_test_and_clear_cpu(cpu, &khugepaged_hint_cpus))
+			continue;
+
+		nr = khugepaged_take_hints(cpu, hint);
+		budget -= nr;
+		for (i = 0; i < nr; i++) {
+			/* A registered mm_slot holds an mmgrab() on its mm */
+			spin_lock(&khugepaged_mm_lock);
+			mm = NULL;
+			if (mm_slot_lookup(mm_slots_hash, hint[i].mm) &&
+			    mmget_not_zero(hint[i].mm))
+				mm = hint[i].mm;
+			spin_unlock(&khugepaged_mm_lock);
+			if (!mm)
+				continue;
+
+			khugepaged_scan_hint(mm, hint[i].address, cc);
+			mmput(mm);
+			cond_resched();
+		}
+	}
+}
+
 static int khugepaged_has_work(void)
 {
 	return !list_empty(&khugepaged_scan.mm_head) &&
@@ -2494,6 +3020,8 @@ static void khugepaged_do_scan(struct collapse_control *cc)
 
 	lru_add_drain_all();
 
+	khugepaged_scan_hints(cc);
+
 	while (true) {
 		cond_resched();
 
@@ -2533,7 +3061,7 @@ static bool khugepaged_should_wakeup(void)
 	       time_after_eq(jiffies, khugepaged_sleep_expire);
 }
 
-static void khugepaged_wait_work(void)
+static void khugepaged_wait_work(struct collapse_control *cc)
 {
 	if (khugepaged_has_work()) {
 		const unsigned long scan_sleep_jiffies =
@@ -2542,10 +3070,22 @@ static void khugepaged_wait_work(void)
 		if (!scan_sleep_jiffies)
 			return;
 
+		/*
+		 * Hints are served as they arrive; the round-robin scan
+		 * keeps its own pace.
+		 */
 		khugepaged_sleep_expire = jiffies + scan_sleep_jiffies;
-		wait_event_freezable_timeout(khugepaged_wait,
-					     khugepaged_should_wakeup(),
-					     scan_sleep_jiffies);
+		for (;;) {
+			long timeout = khugepaged_sleep_expire - jiffies;
+
+			if (timeout <= 0 || kthread_should_stop())
+				break;
+			wait_event_freezable_timeout(khugepaged_wait,
+						     khugepaged_should_wakeup() ||
+						     khugepaged_has_hints(),
+						     timeout);
+			khugepaged_scan_hints(cc);
+		}
 		return;
 	}
 
@@ -2562,7 +3102,7 @@ static int khugepaged(void *none)
 
 	while (!kthread_should_stop()) {
 		khugepaged_do_scan(&khugepaged_collapse_control);
-		khugepaged_wait_work();
+		khugepaged_wait_work(&khugepaged_collapse_control);
 	}
 
 	spin_lock(&khugepaged_mm_lock);
@@ -2733,7 +3273,7 @@ int madvise_collapse(struct vm_area_struct *vma, struct vm_area_struct **prev,
 			mmap_read_lock(mm);
 			mmap_locked = true;
 			result = hugepage_vma_revalidate(mm, addr, false, &vma,
-							 cc);
+							 cc, HPAGE_PMD_ORDER);
 			if (result  != SCAN_SUCCEED) {
 				last_fail = result;
 				goto out_nolock;
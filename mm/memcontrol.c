@@ -65,6 +65,7 @@
 #include <linux/seq_buf.h>
 #include <linux/sched/isolation.h>
 #include <linux/kmemleak.h>
+#include <linux/random.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/ip.h>
@@ -2252,10 +2253,22 @@ void folio_memcg_unlock(struct folio *folio)
 	__folio_memcg_unlock(folio_memcg(folio));
 }
 
+/*
+ * Number of memcgs a cpu keeps charge stocked for. With many cgroups sharing
+ * a cpu a single slot would be drained and refilled on nearly every charge.
+ */
+#define NR_MEMCG_STOCK 7
+
+/* Upper bound for the "cgroup.memory=batch=" boot option */
+#define MEMCG_STOCK_MAX_BATCH (4 * MEMCG_CHARGE_BATCH)
+
+static unsigned int memcg_charge_batch __read_mostly = MEMCG_CHARGE_BATCH;
+
 struct memcg_stock_pcp {
 	local_lock_t stock_lock;
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	/* these never are the root cgroup */
+	struct mem_cgroup *cached[NR_MEMCG_STOCK];
+	unsigned int nr_pages[NR_MEMCG_STOCK];
 
 #ifdef CONFIG_MEMCG_KMEM
 	struct obj_cgroup *cached_objcg;
@@ -2300,9 +2313,9 @@ static void memcg_account_kmem(struct mem_cgroup *memcg, int nr_pages)
  * @memcg: memcg to consume from.
  * @nr_pages: how many pages to charge.
  *
- * The charges will only happen if @memcg matches the current cpu's memcg
- * stock, and at least @nr_pages are available in that stock.  Failure to
- * service an allocation will refill the stock.
+ * The charges will only happen if @memcg has a slot in the current cpu's
+ * memcg stock, and at least @nr_pages are available in that slot.  Failure
+ * to service an allocation will refill the stock.
  *
  * returns true if successful, false otherwise.
  */
@@ -2311,42 +2324,61 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	struct memcg_stock_pcp *stock;
 	unsigned long flags;
 	bool ret = false;
+	int i;
 
-	if (nr_pages > MEMCG_CHARGE_BATCH)
+	if (nr_pages > READ_ONCE(memcg_charge_batch))
 		return ret;
 
 	local_lock_irqsave(&memcg_stock.stock_lock, flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (memcg == READ_ONCE(stock->cached) && stock->nr_pages >= nr_pages) {
-		stock->nr_pages -= nr_pages;
-		ret = true;
+	for (i = 0; i < NR_MEMCG_STOCK; i++) {
+		if (memcg != READ_ONCE(stock->cached[i]))
+			continue;
+		if (stock->nr_pages[i] >= nr_pages) {
+			stock->nr_pages[i] -= nr_pages;
+			ret = true;
+		}
+		break;
 	}
 
 	local_unlock_irqrestore(&memcg_stock.stock_lock, flags);
 
+	count_vm_event(ret ? MEMCG_STOCK_HIT : MEMCG_STOCK_MISS);
+
 	return ret;
 }
 
 /*
- * Returns stocks cached in percpu and reset cached information.
+ * Returns the stock cached in one percpu slot and resets the slot.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = READ_ONCE(stock->cached);
+	struct mem_cgroup *old = READ_ONCE(stock->cached[i]);
 
 	if (!old)
 		return;
 
-	if (stock->nr_pages) {
-		page_counter_uncharge(&old->memory, stock->nr_pages);
+	if (stock->nr_pages[i]) {
+		page_counter_uncharge(&old->memory, stock->nr_pages[i]);
 		if (do_memsw_account())
-			page_counter_uncharge(&old->memsw, stock->nr_pages);
-		stock->nr_pages = 0;
+			page_counter_uncharge(&old->memsw, stock->nr_pages[i]);
+		stock->nr_pages[i] = 0;
 	}
 
 	css_put(&old->css);
-	WRITE_ONCE(stock->cached, NULL);
+	WRITE_ONCE(stock->cached[i], NULL);
+}
+
+/*
+ * Returns stocks cached in percpu and reset cached information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < NR_MEMCG_STOCK; i++)
+		drain_stock_slot(stock, i);
 }
 
 static void drain_local_stock(struct work_struct *dummy)
@@ -2379,17 +2411,35 @@ static void drain_local_stock(struct work_struct *dummy)
 static void __refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
+	int i, slot = -1, empty = -1;
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (READ_ONCE(stock->cached) != memcg) { /* reset if necessary */
-		drain_stock(stock);
+	for (i = 0; i < NR_MEMCG_STOCK; i++) {
+		struct mem_cgroup *cached = READ_ONCE(stock->cached[i]);
+
+		if (cached == memcg) {
+			slot = i;
+			break;
+		}
+		if (!cached && empty < 0)
+			empty = i;
+	}
+
+	if (slot < 0) {
+		/* No slot for memcg yet: take a free one or evict a random one */
+		if (empty < 0) {
+			empty = get_random_u32_below(NR_MEMCG_STOCK);
+			drain_stock_slot(stock, empty);
+			count_vm_event(MEMCG_STOCK_EVICT);
+		}
+		slot = empty;
 		css_get(&memcg->css);
-		WRITE_ONCE(stock->cached, memcg);
+		WRITE_ONCE(stock->cached[slot], memcg);
 	}
-	stock->nr_pages += nr_pages;
+	stock->nr_pages[slot] += nr_pages;
 
-	if (stock->nr_pages > MEMCG_CHARGE_BATCH)
-		drain_stock(stock);
+	if (stock->nr_pages[slot] > READ_ONCE(memcg_charge_batch))
+		drain_stock_slot(stock, slot);
 }
 
 static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
@@ -2424,13 +2474,18 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
 		struct mem_cgroup *memcg;
 		bool flush = false;
+		int i;
 
 		rcu_read_lock();
-		memcg = READ_ONCE(stock->cached);
-		if (memcg && stock->nr_pages &&
-		    mem_cgroup_is_descendant(memcg, root_memcg))
-			flush = true;
-		else if (obj_stock_flush_required(stock, root_memcg))
+		for (i = 0; i < NR_MEMCG_STOCK; i++) {
+			memcg = READ_ONCE(stock->cached[i]);
+			if (memcg && READ_ONCE(stock->nr_pages[i]) &&
+			    mem_cgroup_is_descendant(memcg, root_memcg)) {
+				flush = true;
+				break;
+			}
+		}
+		if (!flush && obj_stock_flush_required(stock, root_memcg))
 			flush = true;
 		rcu_read_unlock();
 
@@ -2725,10 +2780,33 @@ void mem_cgroup_handle_over_high(gfp_t gfp_mask)
 	css_put(&memcg->css);
 }
 
+/*
+ * How many pages to charge at once and stock the surplus of. Close to the
+ * limit, a full batch stocked on every cpu could push the cgroup into reclaim
+ * or OOM while much of its charge sits unused in the stocks, so the batch is
+ * shrunk to a per-cpu share of what is left below memory.max.
+ */
+static unsigned int memcg_stock_batch(struct mem_cgroup *memcg)
+{
+	unsigned int batch = READ_ONCE(memcg_charge_batch);
+	unsigned long max = READ_ONCE(memcg->memory.max);
+	unsigned long usage;
+
+	if (max == PAGE_COUNTER_MAX)
+		return batch;
+
+	usage = page_counter_read(&memcg->memory);
+	if (usage >= max)
+		return 1;
+
+	return clamp_t(unsigned long, (max - usage) / num_online_cpus(),
+		       1, batch);
+}
+
 static int try_charge_memcg(struct mem_cgroup *memcg, gfp_t gfp_mask,
 			unsigned int nr_pages)
 {
-	unsigned int batch = max(MEMCG_CHARGE_BATCH, nr_pages);
+	unsigned int batch = max(memcg_stock_batch(memcg), nr_pages);
 	int nr_retries = MAX_RECLAIM_RETRIES;
 	struct mem_cgroup *mem_over_limit;
 	struct page_counter *counter;
@@ -7365,15 +7443,14 @@ int mem_cgroup_swapin_charge_folio(struct folio *folio, struct mm_struct *mm,
 }
 
 /*
- * mem_cgroup_swapin_uncharge_swap - uncharge swap slot
- * @entry: swap entry for which the page is charged
+ * mem_cgroup_swapin_uncharge_swap - uncharge swap slots
+ * @entry: first swap entry for which the folio is charged
+ * @nr_pages: number of pages, and swap slots, of the folio
  *
- * Call this function after successfully adding the charged page to swapcache.
- *
- * Note: This function assumes the page for which swap slot is being uncharged
- * is order 0 page.
+ * Call this function after successfully adding the charged folio to
+ * swapcache, or after pinning its swap slots for a direct swapin.
  */
-void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry)
+void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry, unsigned int nr_pages)
 {
 	/*
 	 * Cgroup1's unified memory+swap counter has been charged with the
@@ -7393,7 +7470,7 @@ void mem_cgroup_swapin_uncharge_swap(swp_entry_t entry)
 		 * let's not wait for it.  The page already received a
 		 * memory+swap charge, drop the swap entry duplicate.
 		 */
-		mem_cgroup_uncharge_swap(entry, 1);
+		mem_cgroup_uncharge_swap(entry, nr_pages);
 	}
 }
 
@@ -7720,6 +7797,13 @@ static int __init cgroup_memory(char *s)
 			cgroup_memory_nokmem = true;
 		if (!strcmp(token, "nobpf"))
 			cgroup_memory_nobpf = true;
+		if (!strncmp(token, "batch=", 6)) {
+			unsigned int batch;
+
+			if (!kstrtouint(token + 6, 0, &batch))
+				memcg_charge_batch = clamp(batch, 1U,
+							   MEMCG_STOCK_MAX_BATCH);
+		}
 	}
 	return 1;
 }
@@ -78,6 +78,8 @@
 #include <linux/ptrace.h>
 #include <linux/vmalloc.h>
 #include <linux/sched/sysctl.h>
+#include <linux/zswap.h>
+#include <linux/khugepaged.h>
 
 #include <trace/events/kmem.h>
 
@@ -3784,6 +3786,184 @@ static vm_fault_t handle_pte_marker(struct vm_fault *vmf)
 	return VM_FAULT_SIGBUS;
 }
 
+/*
+ * Return the swap pte @delta entries away from @pte on the same swap device,
+ * carrying over the swap pte bits of @pte.
+ */
+static inline pte_t pte_move_swp_offset(pte_t pte, long delta)
+{
+	swp_entry_t entry = pte_to_swp_entry(pte);
+	pte_t new = swp_entry_to_pte(swp_entry(swp_type(entry),
+					       swp_offset(entry) + delta));
+
+	if (pte_swp_soft_dirty(pte))
+		new = pte_swp_mksoft_dirty(new);
+	if (pte_swp_exclusive(pte))
+		new = pte_swp_mkexclusive(new);
+	if (pte_swp_uffd_wp(pte))
+		new = pte_swp_mkuffd_wp(new);
+
+	return new;
+}
+
+/*
+ * Check that the @nr_pages ptes at @ptep hold the swap entries following on
+ * from @pte, with identical swap pte bits.
+ */
+static bool swap_pte_range_same(pte_t *ptep, pte_t pte, int nr_pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (!pte_same(ptep_get(ptep + i), pte_move_swp_offset(pte, i)))
+			return false;
+	}
+
+	return true;
+}
+
+static struct folio *__alloc_swap_folio(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct folio *folio;
+	swp_entry_t entry;
+
+	folio = vma_alloc_folio(GFP_HIGHUSER_MOVABLE, 0, vma,
+				vmf->address, false);
+	if (!folio)
+		return NULL;
+
+	entry = pte_to_swp_entry(vmf->orig_pte);
+	if (mem_cgroup_swapin_charge_folio(folio, vma->vm_mm,
+					   GFP_KERNEL, entry)) {
+		folio_put(folio);
+		return NULL;
+	}
+
+	return folio;
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A large folio can only be swapped in as a whole if the naturally aligned
+ * range of @nr_pages ptes at @ptep still holds the contiguous swap entries
+ * it was written out to, none of them has a folio in the swapcache, and
+ * zswap holds either all or none of them.
+ */
+static bool can_swapin_thp(struct vm_fault *vmf, pte_t *ptep, int nr_pages)
+{
+	struct swap_info_struct *si;
+	unsigned long addr;
+	swp_entry_t entry;
+	pgoff_t offset;
+	int idx, i, nr_zswap;
+	pte_t pte;
+
+	addr = ALIGN_DOWN(vmf->address, nr_pages * PAGE_SIZE);
+	idx = (vmf->address - addr) / PAGE_SIZE;
+
+	/* Swap-out of a large folio always allocates aligned swap slots */
+	entry = pte_to_swp_entry(vmf->orig_pte);
+	if (swp_offset(entry) % nr_pages != idx)
+		return false;
+
+	pte = pte_move_swp_offset(vmf->orig_pte, -idx);
+	if (!swap_pte_range_same(ptep, pte, nr_pages))
+		return false;
+
+	entry = pte_to_swp_entry(pte);
+	offset = swp_offset(entry);
+	si = swp_swap_info(entry);
+	for (i = 0; i < nr_pages; i++) {
+		if (READ_ONCE(si->swap_map[offset + i]) & SWAP_HAS_CACHE)
+			return false;
+	}
+
+	nr_zswap = zswap_nr_present(entry, nr_pages);
+	return !nr_zswap || nr_zswap == nr_pages;
+}
+#endif
+
+/*
+ * Allocate and charge a folio for swapping in directly, bypassing the
+ * swapcache.  If the faulting pte was swapped out as part of a large folio,
+ * try to allocate a folio of that size, so that it comes back in one go.
+ */
+static struct folio *alloc_swap_folio(struct vm_fault *vmf)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	struct vm_area_struct *vma = vmf->vma;
+	unsigned long orders;
+	struct folio *folio;
+	unsigned long addr;
+	swp_entry_t entry;
+	spinlock_t *ptl;
+	pte_t *pte;
+	gfp_t gfp;
+	int order;
+
+	/* Without THP_SWAP, no large folio was ever written out as a whole. */
+	if (!IS_ENABLED(CONFIG_THP_SWAP) || !arch_thp_swp_supported())
+		goto fallback;
+
+	/*
+	 * If uffd is active for the vma we need per-page fault fidelity to
+	 * maintain the uffd semantics.
+	 */
+	if (unlikely(userfaultfd_armed(vma)))
+		goto fallback;
+
+	/*
+	 * Get a list of all the (large) orders below PMD_ORDER that are enabled
+	 * for this vma. Then filter out the orders that can't be allocated over
+	 * the faulting address and still be fully contained in the vma.
+	 */
+	orders = thp_vma_allowable_orders(vma, vma->vm_flags, false, true, true,
+					  BIT(PMD_ORDER) - 1);
+	orders = thp_vma_suitable_orders(vma, vmf->address, orders);
+
+	if (!orders)
+		goto fallback;
+
+	pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
+				  vmf->address & PMD_MASK, &ptl);
+	if (unlikely(!pte))
+		goto fallback;
+
+	/*
+	 * Find the highest order where the aligned range still holds the
+	 * swap entries of one large folio. Unlike in alloc_anon_folio(),
+	 * lower orders have to be checked again when falling back.
+	 */
+	order = highest_order(orders);
+	while (orders) {
+		addr = ALIGN_DOWN(vmf->address, PAGE_SIZE << order);
+		if (can_swapin_thp(vmf, pte + pte_index(addr), 1 << order))
+			break;
+		order = next_order(&orders, order);
+	}
+
+	pte_unmap_unlock(pte, ptl);
+
+	if (!orders)
+		goto fallback;
+
+	entry = pte_to_swp_entry(vmf->orig_pte);
+	gfp = vma_thp_gfp_mask(vma);
+	addr = ALIGN_DOWN(vmf->address, PAGE_SIZE << order);
+	folio = vma_alloc_folio(gfp, order, vma, addr, true);
+	if (folio) {
+		if (!mem_cgroup_swapin_charge_folio(folio, vma->vm_mm,
+						    gfp, entry))
+			return folio;
+		folio_put(folio);
+	}
+
+fallback:
+#endif
+	return __alloc_swap_folio(vmf);
+}
+
 /*
  * We enter with non-exclusive mmap_lock (to exclude vma changes,
  * but allow concurrent faults), and pte mapped but not yet locked.
@@ -3805,6 +3985,10 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	pte_t pte;
 	vm_fault_t ret = 0;
 	void *shadow = NULL;
+	int nr_pages = 1;
+	int page_idx = 0;
+	unsigned long address;
+	pte_t *ptep;
 
 	if (!pte_unmap_same(vmf))
 		goto out;
@@ -3868,35 +4052,49 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	if (!folio) {
 		if (data_race(si->flags & SWP_SYNCHRONOUS_IO) &&
 		    __swap_count(entry) == 1) {
-			/*
-			 * Prevent parallel swapin from proceeding with
-			 * the cache flag. Otherwise, another thread may
-			 * finish swapin first, free the entry, and swapout
-			 * reusing the same entry. It's undetectable as
-			 * pte_same() returns true due to entry reuse.
-			 */
-			if (swapcache_prepare(entry)) {
-				/* Relax a bit to prevent rapid repeated page faults */
-				schedule_timeout_uninterruptible(1);
-				goto out;
-			}
-			need_clear_cache = true;
-
 			/* skip swapcache */
-			folio = vma_alloc_folio(GFP_HIGHUSER_MOVABLE, 0,
-						vma, vmf->address, false);
-			page = &folio->page;
+			folio = alloc_swap_folio(vmf);
 			if (folio) {
 				__folio_set_locked(folio);
 				__folio_set_swapbacked(folio);
 
-				if (mem_cgroup_swapin_charge_folio(folio,
-							vma->vm_mm, GFP_KERNEL,
-							entry)) {
-					ret = VM_FAULT_OOM;
+				page = folio_file_page(folio, swp_offset(entry));
+				nr_pages = folio_nr_pages(folio);
+				if (folio_test_large(folio))
+					entry.val = ALIGN_DOWN(entry.val, nr_pages);
+				/*
+				 * Prevent parallel swapin from proceeding with
+				 * the cache flag. Otherwise, another thread
+				 * may finish swapin first, free the entry, and
+				 * swapout reusing the same entry. It's
+				 * undetectable as pte_same() returns true due
+				 * to entry reuse.
+				 */
+				if (swapcache_prepare(entry, nr_pages)) {
+					/*
+					 * Relax a bit to prevent rapid
+					 * repeated page faults.
+					 */
+					schedule_timeout_uninterruptible(1);
 					goto out_page;
 				}
-				mem_cgroup_swapin_uncharge_swap(entry);
+				need_clear_cache = true;
+
+				/*
+				 * zswap cannot assemble a large folio partly
+				 * from the swap device. If writeback raced
+				 * with alloc_swap_folio(), retry the fault,
+				 * which will fall back to a smaller order.
+				 */
+				if (folio_test_large(folio)) {
+					int nr_zswap = zswap_nr_present(entry,
+								nr_pages);
+
+					if (nr_zswap && nr_zswap != nr_pages)
+						goto out_page;
+				}
+
+				mem_cgroup_swapin_uncharge_swap(entry, nr_pages);
 
 				shadow = get_shadow_from_swap_cache(entry);
 				if (shadow)
@@ -3998,6 +4196,23 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	if (unlikely(!vmf->pte || !pte_same(ptep_get(vmf->pte), vmf->orig_pte)))
 		goto out_nomap;
 
+	address = vmf->address;
+	ptep = vmf->pte;
+	/* A large folio read in directly, bypassing the swapcache */
+	if (folio_test_large(folio) && !swapcache) {
+		unsigned long folio_start;
+
+		folio_start = ALIGN_DOWN(vmf->address, nr_pages * PAGE_SIZE);
+		page_idx = (vmf->address - folio_start) / PAGE_SIZE;
+		if (!swap_pte_range_same(vmf->pte - page_idx,
+				pte_move_swp_offset(vmf->orig_pte, -page_idx),
+				nr_pages))
+			goto out_nomap;
+
+		address = folio_start;
+		ptep = vmf->pte - page_idx;
+	}
+
 	if (unlikely(!folio_test_uptodate(folio))) {
 		ret = VM_FAULT_SIGBUS;
 		goto out_nomap;
@@ -4062,13 +4277,13 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	 * We're already holding a reference on the page but haven't mapped it
 	 * yet.
 	 */
-	swap_free(entry);
+	swap_free_nr(entry, nr_pages);
 	if (should_try_to_free_swap(folio, vma, vmf->flags))
 		folio_free_swap(folio);
 
-	inc_mm_counter(vma->vm_mm, MM_ANONPAGES);
-	dec_mm_counter(vma->vm_mm, MM_SWAPENTS);
-	pte = mk_pte(page, vma->vm_page_prot);
+	add_mm_counter(vma->vm_mm, MM_ANONPAGES, nr_pages);
+	add_mm_counter(vma->vm_mm, MM_SWAPENTS, -nr_pages);
+	pte = mk_pte(page - page_idx, vma->vm_page_prot);
 
 	/*
 	 * Same logic as in do_wp_page(); however, optimize for pages that are
@@ -4084,7 +4299,8 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 		}
 		rmap_flags |= RMAP_EXCLUSIVE;
 	}
-	flush_icache_page(vma, page);
+	folio_ref_add(folio, nr_pages - 1);
+	flush_icache_pages(vma, page - page_idx, nr_pages);
 	if (pte_swp_soft_dirty(vmf->orig_pte))
 		pte = pte_mksoft_dirty(pte);
 	if (pte_swp_uffd_wp(vmf->orig_pte))
@@ -4095,6 +4311,9 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	if (unlikely(folio != swapcache && swapcache)) {
 		folio_add_new_anon_rmap(folio, vma, vmf->address);
 		folio_add_lru_vma(folio, vma);
+	} else if (nr_pages > 1) {
+		/* a fresh large folio is exclusive as a whole */
+		folio_add_new_anon_rmap(folio, vma, address);
 	} else {
 		folio_add_anon_rmap_pte(folio, page, vma, vmf->address,
 					rmap_flags);
@@ -4102,8 +4321,11 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 
 	VM_BUG_ON(!folio_test_anon(folio) ||
 			(pte_write(pte) && !PageAnonExclusive(page)));
-	set_pte_at(vma->vm_mm, vmf->address, vmf->pte, pte);
-	arch_do_swap_page(vma->vm_mm, vma, vmf->address, pte, vmf->orig_pte);
+	set_ptes(vma->vm_mm, address, ptep, pte, nr_pages);
+	if (nr_pages > 1)
+		vmf->orig_pte = ptep_get(vmf->pte);
+	arch_do_swap_page(vma->vm_mm, vma, vmf->address, vmf->orig_pte,
+			  vmf->orig_pte);
 
 	folio_unlock(folio);
 	if (folio != swapcache && swapcache) {
@@ -4127,14 +4349,14 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	}
 
 	/* No need to invalidate - it was non-present before */
-	update_mmu_cache_range(vmf, vma, vmf->address, vmf->pte, 1);
+	update_mmu_cache_range(vmf, vma, address, ptep, nr_pages);
 unlock:
 	if (vmf->pte)
 		pte_unmap_unlock(vmf->pte, vmf->ptl);
 out:
 	/* Clear the swap cache pin for direct swapin after PTL unlock */
 	if (need_clear_cache)
-		swapcache_clear(si, entry);
+		swapcache_clear(si, entry, nr_pages);
 	if (si)
 		put_swap_device(si);
 	return ret;
@@ -4150,7 +4372,7 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 		folio_put(swapcache);
 	}
 	if (need_clear_cache)
-		swapcache_clear(si, entry);
+		swapcache_clear(si, entry, nr_pages);
 	if (si)
 		put_swap_device(si);
 	return ret;
@@ -4177,7 +4399,7 @@ static struct folio *alloc_anon_folio(struct vm_fault *vmf)
 	unsigned long addr;
 	pte_t *pte;
 	gfp_t gfp;
-	int order;
+	int order, wanted;
 
 	/*
 	 * If uffd is active for the vma we need per-page fault fidelity to
@@ -4202,6 +4424,8 @@ static struct folio *alloc_anon_folio(struct vm_fault *vmf)
 	if (!pte)
 		return ERR_PTR(-EAGAIN);
 
+	wanted = highest_order(orders);
+
 	/*
 	 * Find the highest order where the aligned range is completely
 	 * pte_none(). Note that all remaining orders will be completely
@@ -4224,10 +4448,14 @@ static struct folio *alloc_anon_folio(struct vm_fault *vmf)
 		folio = vma_alloc_folio(gfp, order, vma, addr, true);
 		if (folio) {
 			clear_huge_page(&folio->page, vmf->address, 1 << order);
+			/* Let khugepaged try to assemble the size we wanted */
+			if (order < wanted)
+				khugepaged_hint(vma, vmf->address);
 			return folio;
 		}
 		order = next_order(&orders, order);
 	}
+	khugepaged_hint(vma, vmf->address);
 
 fallback:
 #endif
@@ -128,6 +128,10 @@
 #include <linux/blk-cgroup.h>
 #include <linux/fadvise.h>
 #include <linux/sched/mm.h>
+#include <linux/sysctl.h>
+#include <linux/vmstat.h>
+
+#include <trace/events/filemap.h>
 
 #include "internal.h"
 
@@ -461,6 +465,105 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Readahead history.
+ *
+ * A struct file_ra_state starts out empty on every open, so each cold open
+ * of a file ramps the readahead window and the folio order up from small
+ * again, even if the file has always been streamed.  To avoid that, the
+ * window size and the folio order reached by sequential readahead are also
+ * remembered in the address_space, which lives as long as the inode stays
+ * cached, and a cold file_ra_state picks up from there.  A standalone random
+ * read forgets the history again.
+ *
+ * Both values are packed into one word, so that they can be read and
+ * updated without locking:
+ *
+ *	mapping->ra_history = size << RA_HISTORY_ORDER_BITS | order
+ *
+ * Zero means there is no history.
+ */
+#define RA_HISTORY_ORDER_BITS	5
+#define RA_HISTORY_ORDER_MASK	((1U << RA_HISTORY_ORDER_BITS) - 1)
+#define RA_HISTORY_SIZE_MAX	(UINT_MAX >> RA_HISTORY_ORDER_BITS)
+
+static int sysctl_readahead_history __read_mostly = 1;
+
+static void ra_history_save(struct address_space *mapping,
+			    struct file_ra_state *ra, unsigned int order)
+{
+	unsigned int history;
+
+	if (!READ_ONCE(sysctl_readahead_history))
+		return;
+
+	history = min_t(unsigned int, ra->size, RA_HISTORY_SIZE_MAX);
+	history = history << RA_HISTORY_ORDER_BITS | order;
+	/* Avoid dirtying the cacheline on every readahead */
+	if (READ_ONCE(mapping->ra_history) != history)
+		WRITE_ONCE(mapping->ra_history, history);
+}
+
+static void ra_history_forget(struct address_space *mapping)
+{
+	if (!READ_ONCE(mapping->ra_history))
+		return;
+
+	WRITE_ONCE(mapping->ra_history, 0);
+	count_vm_event(RA_HISTORY_RESET);
+}
+
+/*
+ * Widen the initial readahead window of a cold file_ra_state to the one
+ * remembered for @mapping, and return the folio order to start from.
+ */
+static unsigned int ra_history_seed(struct address_space *mapping,
+		struct file_ra_state *ra, unsigned long max_pages,
+		unsigned int order)
+{
+	unsigned int history;
+	unsigned long size;
+
+	if (!READ_ONCE(sysctl_readahead_history))
+		return order;
+
+	history = READ_ONCE(mapping->ra_history);
+	if (!history) {
+		count_vm_event(RA_HISTORY_MISS);
+		return order;
+	}
+
+	count_vm_event(RA_HISTORY_HIT);
+	size = min_t(unsigned long, history >> RA_HISTORY_ORDER_BITS,
+		     max_pages);
+	if (size > ra->size)
+		ra->size = size;
+
+	return max(order, history & RA_HISTORY_ORDER_MASK);
+}
+
+#ifdef CONFIG_SYSCTL
+static struct ctl_table readahead_sysctl_table[] = {
+	{
+		.procname	= "readahead_history",
+		.data		= &sysctl_readahead_history,
+		.maxlen		= sizeof(sysctl_readahead_history),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{}
+};
+
+static int __init readahead_sysctl_init(void)
+{
+	register_sysctl_init("vm", readahead_sysctl_table);
+	return 0;
+}
+subsys_initcall(readahead_sysctl_init);
+#endif
+
 static inline int ra_alloc_folio(struct readahead_control *ractl, pgoff_t index,
 		pgoff_t mark, unsigned int order, gfp_t gfp)
 {
@@ -483,6 +586,27 @@ static inline int ra_alloc_folio(struct readahead_control *ractl, pgoff_t index,
 	return 0;
 }
 
+/*
+ * The folio order page_cache_ra_order() allocates a readahead window of
+ * @ra with, ramped up from the order @order of the folio which triggered it.
+ */
+static unsigned int ra_folio_order(struct address_space *mapping,
+		struct file_ra_state *ra, unsigned int order)
+{
+	if (!mapping_large_folio_support(mapping) || ra->size < 4)
+		return 0;
+
+	if (order < MAX_PAGECACHE_ORDER) {
+		order += 2;
+		if (order > MAX_PAGECACHE_ORDER)
+			order = MAX_PAGECACHE_ORDER;
+		while ((1 << order) > ra->size)
+			order--;
+	}
+
+	return order;
+}
+
 void page_cache_ra_order(struct readahead_control *ractl,
 		struct file_ra_state *ra, unsigned int new_order)
 {
@@ -497,14 +621,9 @@ void page_cache_ra_order(struct readahead_control *ractl,
 		goto fallback;
 
 	limit = min(limit, index + ra->size - 1);
+	new_order = ra_folio_order(mapping, ra, new_order);
 
-	if (new_order < MAX_PAGECACHE_ORDER) {
-		new_order += 2;
-		if (new_order > MAX_PAGECACHE_ORDER)
-			new_order = MAX_PAGECACHE_ORDER;
-		while ((1 << new_order) > ra->size)
-			new_order--;
-	}
+	trace_page_cache_ra_order(mapping->host, index, ra, new_order);
 
 	filemap_invalidate_lock_shared(mapping);
 	while (index <= limit) {
@@ -557,6 +676,7 @@ static void ondemand_readahead(struct readahead_control *ractl,
 	pgoff_t index = readahead_index(ractl);
 	pgoff_t expected, prev_index;
 	unsigned int order = folio ? folio_order(folio) : 0;
+	bool cold;
 
 	/*
 	 * If the request exceeds the readahead window, allow the read to
@@ -636,12 +756,17 @@ static void ondemand_readahead(struct readahead_control *ractl,
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
+	ra_history_forget(ractl->mapping);
 	do_page_cache_ra(ractl, req_size, 0);
 	return;
 
 initial_readahead:
+	/* Nothing was read ahead through this file_ra_state yet */
+	cold = !ra->size;
 	ra->start = index;
 	ra->size = get_init_ra_size(req_size, max_pages);
+	if (cold)
+		order = ra_history_seed(ractl->mapping, ra, max_pages, order);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
 
 readit:
@@ -662,6 +787,9 @@ static void ondemand_readahead(struct readahead_control *ractl,
 		}
 	}
 
+	/* Remember the order the window is actually allocated with */
+	ra_history_save(ractl->mapping, ra,
+			ra_folio_order(ractl->mapping, ra, order));
 	ractl->_index = ra->start;
 	page_cache_ra_order(ractl, ra, order);
 }
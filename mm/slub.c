@@ -373,6 +373,16 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	ALLOC_PCS,		/* Allocation from percpu sheaf */
+	FREE_PCS,		/* Free to percpu sheaf */
+	SHEAF_FLUSH,		/* Objects flushed from a sheaf to slabs */
+	SHEAF_REFILL,		/* Objects refilled to a sheaf from slabs */
+	SHEAF_ALLOC,		/* Allocation of an empty sheaf */
+	SHEAF_FREE,		/* Freeing of an empty sheaf */
+	BARN_GET,		/* Sheaf taken from the barn */
+	BARN_GET_FAIL,		/* Barn had no sheaf of the wanted kind */
+	BARN_PUT,		/* Full sheaf handed over to the barn */
+	BARN_PUT_FAIL,		/* Barn had no room for a full sheaf */
 	NR_SLUB_STAT_ITEMS
 };
 
@@ -419,6 +429,43 @@ void stat_add(const struct kmem_cache *s, enum stat_item si, int v)
 #endif
 }
 
+#ifndef CONFIG_SLUB_TINY
+/*
+ * Percpu sheaves (SLAB_PERCPU_SHEAVES).
+ *
+ * A sheaf is an array of free objects of one cache. Each cpu has a main
+ * sheaf that allocations take objects from and frees put them back to,
+ * under a local lock only, and optionally a spare sheaf that is either
+ * empty or full. When both run empty (on alloc) or full (on free), whole
+ * sheaves are exchanged with the barn of the local node, which keeps a
+ * limited number of full and empty sheaves. Only when the barn cannot help
+ * are objects moved between a sheaf and the slabs, in bulk.
+ *
+ * Objects in sheaves are free as far as the alloc and free hooks (memcg,
+ * kasan, kmemleak, ...) are concerned. Frees only put objects from slabs
+ * of the local node into sheaves, everything else goes to the slabs.
+ */
+struct slab_sheaf {
+	struct list_head barn_list;
+	unsigned int size;
+	void *objects[];
+};
+
+struct slub_percpu_sheaves {
+	local_lock_t lock;
+	struct slab_sheaf *main;	/* never NULL when unlocked */
+	struct slab_sheaf *spare;	/* empty or full, may be NULL */
+};
+
+struct node_barn {
+	spinlock_t lock;
+	struct list_head sheaves_full;
+	struct list_head sheaves_empty;
+	unsigned int nr_full;
+	unsigned int nr_empty;
+};
+#endif /* CONFIG_SLUB_TINY */
+
 /*
  * The slab lists for all objects.
  */
@@ -431,6 +478,9 @@ struct kmem_cache_node {
 	atomic_long_t total_objects;
 	struct list_head full;
 #endif
+#ifndef CONFIG_SLUB_TINY
+	struct node_barn barn;
+#endif
 };
 
 static inline struct kmem_cache_node *get_node(struct kmem_cache *s, int node)
@@ -3030,12 +3080,511 @@ static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	}
 }
 
+static int __kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags,
+				   size_t size, void **p);
+static void __kmem_cache_free_bulk(struct kmem_cache *s, size_t size,
+				   void **p);
+
+/* Sheaves a barn keeps at most, beyond that they are flushed and freed */
+#define MAX_FULL_SHEAVES	10
+#define MAX_EMPTY_SHEAVES	10
+
+static inline bool slab_has_sheaves(struct kmem_cache *s)
+{
+	return s->cpu_sheaves;
+}
+
+static struct node_barn *get_barn(struct kmem_cache *s)
+{
+	struct kmem_cache_node *n = get_node(s, numa_mem_id());
+
+	return n ? &n->barn : NULL;
+}
+
+/* Bounds of the number of objects per sheaf */
+#define MIN_SHEAF_CAPACITY	4
+#define MAX_SHEAF_CAPACITY	64
+
+/*
+ * A sheaf holds about half a slab worth of objects, so that a cpu's main and
+ * spare sheaf together cache at most about one slab, and refilling or
+ * flushing a sheaf costs at most one slab to be taken or released.
+ */
+static unsigned int calculate_sheaf_capacity(struct kmem_cache *s)
+{
+	return clamp_t(unsigned int, oo_objects(s->oo) / 2,
+		       MIN_SHEAF_CAPACITY, MAX_SHEAF_CAPACITY);
+}
+
+static struct slab_sheaf *alloc_empty_sheaf(struct kmem_cache *s, gfp_t gfp)
+{
+	struct slab_sheaf *sheaf;
+
+	gfp = (gfp & ~__GFP_ACCOUNT) | __GFP_NOWARN;
+	sheaf = kzalloc(struct_size(sheaf, objects, s->sheaf_capacity), gfp);
+	if (sheaf)
+		stat(s, SHEAF_ALLOC);
+
+	return sheaf;
+}
+
+static void free_empty_sheaf(struct kmem_cache *s, struct slab_sheaf *sheaf)
+{
+	VM_WARN_ON_ONCE(sheaf->size);
+	kfree(sheaf);
+	stat(s, SHEAF_FREE);
+}
+
+/* Return all objects of @sheaf to their slabs. */
+static void sheaf_flush(struct kmem_cache *s, struct slab_sheaf *sheaf)
+{
+	if (!sheaf->size)
+		return;
+
+	stat_add(s, SHEAF_FLUSH, sheaf->size);
+	__kmem_cache_free_bulk(s, sheaf->size, &sheaf->objects[0]);
+	sheaf->size = 0;
+}
+
+/* Fill @sheaf up from the slabs. Returns 0 on success. */
+static int refill_sheaf(struct kmem_cache *s, struct slab_sheaf *sheaf,
+			gfp_t gfp)
+{
+	int to_fill = s->sheaf_capacity - sheaf->size;
+	int filled;
+
+	if (!to_fill)
+		return 0;
+
+	filled = __kmem_cache_alloc_bulk(s, gfp, to_fill,
+					 &sheaf->objects[sheaf->size]);
+	if (!filled)
+		return -ENOMEM;
+
+	sheaf->size += filled;
+	stat_add(s, SHEAF_REFILL, filled);
+	return 0;
+}
+
+static struct slab_sheaf *barn_get_sheaf(struct node_barn *barn, bool full)
+{
+	struct list_head *list;
+	struct slab_sheaf *sheaf = NULL;
+	unsigned long flags;
+
+	list = full ? &barn->sheaves_full : &barn->sheaves_empty;
+
+	spin_lock_irqsave(&barn->lock, flags);
+	if (!list_empty(list)) {
+		sheaf = list_first_entry(list, struct slab_sheaf, barn_list);
+		list_del(&sheaf->barn_list);
+		if (full)
+			barn->nr_full--;
+		else
+			barn->nr_empty--;
+	}
+	spin_unlock_irqrestore(&barn->lock, flags);
+
+	return sheaf;
+}
+
+/* Returns false if the barn already holds enough sheaves of that kind. */
+static bool barn_put_sheaf(struct node_barn *barn, struct slab_sheaf *sheaf,
+			   bool full)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&barn->lock, flags);
+	if (full && barn->nr_full < MAX_FULL_SHEAVES) {
+		list_add(&sheaf->barn_list, &barn->sheaves_full);
+		barn->nr_full++;
+		ret = true;
+	} else if (!full && barn->nr_empty < MAX_EMPTY_SHEAVES) {
+		list_add(&sheaf->barn_list, &barn->sheaves_empty);
+		barn->nr_empty++;
+		ret = true;
+	}
+	spin_unlock_irqrestore(&barn->lock, flags);
+
+	return ret;
+}
+
+/*
+ * Trade a sheaf for one of the opposite kind from the barn: an empty one for
+ * a full one, or a full one for an empty one. Returns NULL if the barn has
+ * none to give.
+ */
+static struct slab_sheaf *barn_exchange_sheaf(struct node_barn *barn,
+					      struct slab_sheaf *sheaf)
+{
+	struct slab_sheaf *other = NULL;
+	bool full = sheaf->size;
+	unsigned long flags;
+
+	spin_lock_irqsave(&barn->lock, flags);
+	if (!full && barn->nr_full) {
+		other = list_first_entry(&barn->sheaves_full,
+					 struct slab_sheaf, barn_list);
+		list_move(&sheaf->barn_list, &barn->sheaves_empty);
+		list_del(&other->barn_list);
+		barn->nr_full--;
+		barn->nr_empty++;
+	} else if (full && barn->nr_empty && barn->nr_full < MAX_FULL_SHEAVES) {
+		other = list_first_entry(&barn->sheaves_empty,
+					 struct slab_sheaf, barn_list);
+		list_del(&other->barn_list);
+		list_add(&sheaf->barn_list, &barn->sheaves_full);
+		barn->nr_empty--;
+		barn->nr_full++;
+	}
+	spin_unlock_irqrestore(&barn->lock, flags);
+
+	return other;
+}
+
+/* Hand an unneeded sheaf over to the barn, or get rid of it. */
+static void barn_stash_sheaf(struct kmem_cache *s, struct slab_sheaf *sheaf)
+{
+	struct node_barn *barn = get_barn(s);
+	bool full = sheaf->size;
+
+	if (barn && barn_put_sheaf(barn, sheaf, full)) {
+		if (full)
+			stat(s, BARN_PUT);
+		return;
+	}
+
+	if (full) {
+		stat(s, BARN_PUT_FAIL);
+		sheaf_flush(s, sheaf);
+	}
+	free_empty_sheaf(s, sheaf);
+}
+
+/* Flush and free all sheaves held by the barn. */
+static void barn_shrink(struct kmem_cache *s, struct node_barn *barn)
+{
+	struct slab_sheaf *sheaf, *next;
+	unsigned long flags;
+	LIST_HEAD(full);
+	LIST_HEAD(empty);
+
+	spin_lock_irqsave(&barn->lock, flags);
+	list_splice_init(&barn->sheaves_full, &full);
+	list_splice_init(&barn->sheaves_empty, &empty);
+	barn->nr_full = 0;
+	barn->nr_empty = 0;
+	spin_unlock_irqrestore(&barn->lock, flags);
+
+	list_for_each_entry_safe(sheaf, next, &full, barn_list) {
+		sheaf_flush(s, sheaf);
+		free_empty_sheaf(s, sheaf);
+	}
+	list_for_each_entry_safe(sheaf, next, &empty, barn_list)
+		free_empty_sheaf(s, sheaf);
+}
+
+/*
+ * The main sheaf is empty: replace it with a full one, from the spare, the
+ * barn, or refilled from the slabs. Called with the local lock held; returns
+ * with it held and a non-empty main sheaf, or NULL with the lock dropped if
+ * no objects could be had.
+ */
+static struct slub_percpu_sheaves *
+__pcs_refill_main(struct kmem_cache *s, struct slub_percpu_sheaves *pcs,
+		  gfp_t gfp, unsigned long *flags)
+{
+	struct slab_sheaf *empty = NULL, *full;
+	struct node_barn *barn;
+
+	if (pcs->spare && pcs->spare->size) {
+		swap(pcs->main, pcs->spare);
+		return pcs;
+	}
+
+	barn = get_barn(s);
+	if (barn) {
+		if (!pcs->spare) {
+			full = barn_get_sheaf(barn, true);
+			if (full) {
+				pcs->spare = pcs->main;
+				pcs->main = full;
+			}
+		} else {
+			full = barn_exchange_sheaf(barn, pcs->main);
+			if (full)
+				pcs->main = full;
+		}
+		if (full) {
+			stat(s, BARN_GET);
+			return pcs;
+		}
+	}
+	stat(s, BARN_GET_FAIL);
+
+	/* Fill an empty sheaf from the slabs, which may sleep */
+	if (pcs->spare) {
+		empty = pcs->spare;
+		pcs->spare = NULL;
+	}
+	local_unlock_irqrestore(&s->cpu_sheaves->lock, *flags);
+
+	if (!empty && barn)
+		empty = barn_get_sheaf(barn, false);
+	if (!empty)
+		empty = alloc_empty_sheaf(s, gfp);
+	if (!empty)
+		return NULL;
+
+	if (refill_sheaf(s, empty, gfp)) {
+		barn_stash_sheaf(s, empty);
+		return NULL;
+	}
+	full = empty;
+
+	local_lock_irqsave(&s->cpu_sheaves->lock, *flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+
+	/*
+	 * We might have been migrated, or frees on this cpu might have put
+	 * objects into the main sheaf in the meantime.
+	 */
+	if (!pcs->main->size)
+		swap(pcs->main, full);
+
+	/* Whichever sheaf is left over becomes the spare, or goes away */
+	if (!pcs->spare)
+		pcs->spare = full;
+	else
+		barn_stash_sheaf(s, full);
+
+	return pcs;
+}
+
+static __fastpath_inline void *alloc_from_pcs(struct kmem_cache *s, gfp_t gfp)
+{
+	struct slub_percpu_sheaves *pcs;
+	unsigned long flags;
+	void *object;
+
+	local_lock_irqsave(&s->cpu_sheaves->lock, flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+
+	if (unlikely(!pcs->main->size)) {
+		pcs = __pcs_refill_main(s, pcs, gfp, &flags);
+		if (unlikely(!pcs))
+			return NULL;
+	}
+
+	object = pcs->main->objects[--pcs->main->size];
+
+	local_unlock_irqrestore(&s->cpu_sheaves->lock, flags);
+	stat(s, ALLOC_PCS);
+
+	return object;
+}
+
+/* Take up to @size objects from the current main or spare sheaf. */
+static unsigned int alloc_from_pcs_bulk(struct kmem_cache *s, size_t size,
+					void **p)
+{
+	struct slub_percpu_sheaves *pcs;
+	struct slab_sheaf *main;
+	unsigned long flags;
+	unsigned int batch;
+
+	local_lock_irqsave(&s->cpu_sheaves->lock, flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+
+	if (!pcs->main->size && pcs->spare && pcs->spare->size)
+		swap(pcs->main, pcs->spare);
+
+	main = pcs->main;
+	batch = min_t(size_t, size, main->size);
+	main->size -= batch;
+	memcpy(p, &main->objects[main->size], batch * sizeof(void *));
+
+	local_unlock_irqrestore(&s->cpu_sheaves->lock, flags);
+	stat_add(s, ALLOC_PCS, batch);
+
+	return batch;
+}
+
+/*
+ * The main sheaf is full: replace it with an empty one, from the spare, the
+ * barn, or a new allocation. If the full sheaf has nowhere to go, flush it
+ * back to the slabs instead. Called and returns with the local lock held.
+ */
+static void __pcs_replace_full_main(struct kmem_cache *s,
+				    struct slub_percpu_sheaves *pcs)
+{
+	struct node_barn *barn = get_barn(s);
+	struct slab_sheaf *empty = NULL;
+
+	if (pcs->spare && !pcs->spare->size) {
+		swap(pcs->main, pcs->spare);
+		return;
+	}
+
+	if (barn) {
+		if (!pcs->spare) {
+			empty = barn_get_sheaf(barn, false);
+			if (empty)
+				pcs->spare = pcs->main;
+		} else {
+			empty = barn_exchange_sheaf(barn, pcs->main);
+			if (empty)
+				stat(s, BARN_PUT);
+		}
+		if (empty) {
+			pcs->main = empty;
+			return;
+		}
+	}
+
+	empty = alloc_empty_sheaf(s, GFP_NOWAIT);
+	if (empty) {
+		if (!pcs->spare) {
+			pcs->spare = pcs->main;
+			pcs->main = empty;
+			return;
+		}
+		if (barn && barn_put_sheaf(barn, pcs->main, true)) {
+			stat(s, BARN_PUT);
+			pcs->main = empty;
+			return;
+		}
+		free_empty_sheaf(s, empty);
+	}
+
+	stat(s, BARN_PUT_FAIL);
+	sheaf_flush(s, pcs->main);
+}
+
+static __fastpath_inline void free_to_pcs(struct kmem_cache *s, void *object)
+{
+	struct slub_percpu_sheaves *pcs;
+	unsigned long flags;
+
+	local_lock_irqsave(&s->cpu_sheaves->lock, flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+
+	if (unlikely(pcs->main->size == s->sheaf_capacity))
+		__pcs_replace_full_main(s, pcs);
+
+	pcs->main->objects[pcs->main->size++] = object;
+
+	local_unlock_irqrestore(&s->cpu_sheaves->lock, flags);
+	stat(s, FREE_PCS);
+}
+
+/* Flush the sheaves of the current cpu back to the slabs. */
+static void pcs_flush_all(struct kmem_cache *s)
+{
+	struct slub_percpu_sheaves *pcs;
+	struct slab_sheaf *spare;
+	unsigned long flags;
+
+	local_lock_irqsave(&s->cpu_sheaves->lock, flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+	spare = pcs->spare;
+	pcs->spare = NULL;
+	sheaf_flush(s, pcs->main);
+	local_unlock_irqrestore(&s->cpu_sheaves->lock, flags);
+
+	if (spare) {
+		sheaf_flush(s, spare);
+		free_empty_sheaf(s, spare);
+	}
+}
+
+/* Same for a dead cpu, whose sheaves nobody else can access. */
+static void __pcs_flush_cpu(struct kmem_cache *s, int cpu)
+{
+	struct slub_percpu_sheaves *pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+
+	sheaf_flush(s, pcs->main);
+	if (pcs->spare) {
+		sheaf_flush(s, pcs->spare);
+		free_empty_sheaf(s, pcs->spare);
+		pcs->spare = NULL;
+	}
+}
+
+static bool pcs_has_objects(struct kmem_cache *s, int cpu)
+{
+	struct slub_percpu_sheaves *pcs;
+
+	if (!slab_has_sheaves(s))
+		return false;
+
+	pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+	return pcs->main->size || pcs->spare;
+}
+
+static int alloc_kmem_cache_sheaves(struct kmem_cache *s)
+{
+	int cpu;
+
+	/* Debugging needs every free to reach the slab */
+	if (!(s->flags & SLAB_PERCPU_SHEAVES) || kmem_cache_debug(s) ||
+	    slab_state < UP)
+		return 1;
+
+	s->sheaf_capacity = calculate_sheaf_capacity(s);
+	s->cpu_sheaves = alloc_percpu(struct slub_percpu_sheaves);
+	if (!s->cpu_sheaves)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct slub_percpu_sheaves *pcs;
+
+		pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+		local_lock_init(&pcs->lock);
+		pcs->main = alloc_empty_sheaf(s, GFP_KERNEL);
+		if (!pcs->main)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void free_kmem_cache_sheaves(struct kmem_cache *s)
+{
+	struct kmem_cache_node *n;
+	int cpu, node;
+
+	if (!slab_has_sheaves(s))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct slub_percpu_sheaves *pcs;
+
+		pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+		if (!pcs->main)
+			continue;
+		__pcs_flush_cpu(s, cpu);
+		free_empty_sheaf(s, pcs->main);
+		pcs->main = NULL;
+	}
+
+	for_each_kmem_cache_node(s, node, n)
+		barn_shrink(s, &n->barn);
+
+	free_percpu(s->cpu_sheaves);
+	s->cpu_sheaves = NULL;
+}
+
 static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 	void *freelist = c->freelist;
 	struct slab *slab = c->slab;
 
+	if (slab_has_sheaves(s))
+		__pcs_flush_cpu(s, cpu);
+
 	c->slab = NULL;
 	c->freelist = NULL;
 	c->tid = next_tid(c->tid);
@@ -3068,6 +3617,10 @@ static void flush_cpu_slab(struct work_struct *w)
 	sfw = container_of(w, struct slub_flush_work, work);
 
 	s = sfw->s;
+
+	if (slab_has_sheaves(s))
+		pcs_flush_all(s);
+
 	c = this_cpu_ptr(s->cpu_slab);
 
 	if (c->slab)
@@ -3080,7 +3633,7 @@ static bool has_cpu_slab(int cpu, struct kmem_cache *s)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->slab || slub_percpu_partial(c);
+	return c->slab || slub_percpu_partial(c) || pcs_has_objects(s, cpu);
 }
 
 static DEFINE_MUTEX(flush_lock);
@@ -3113,6 +3666,14 @@ static void flush_all_cpus_locked(struct kmem_cache *s)
 		flush_work(&sfw->work);
 	}
 
+	if (slab_has_sheaves(s)) {
+		struct kmem_cache_node *n;
+		int node;
+
+		for_each_kmem_cache_node(s, node, n)
+			barn_shrink(s, &n->barn);
+	}
+
 	mutex_unlock(&flush_lock);
 }
 
@@ -3139,6 +3700,19 @@ static int slub_cpu_dead(unsigned int cpu)
 }
 
 #else /* CONFIG_SLUB_TINY */
+static inline bool slab_has_sheaves(struct kmem_cache *s) { return false; }
+static inline void *alloc_from_pcs(struct kmem_cache *s, gfp_t gfp)
+{
+	return NULL;
+}
+static inline unsigned int alloc_from_pcs_bulk(struct kmem_cache *s,
+					       size_t size, void **p)
+{
+	return 0;
+}
+static inline void free_to_pcs(struct kmem_cache *s, void *object) { }
+static inline int alloc_kmem_cache_sheaves(struct kmem_cache *s) { return 1; }
+static inline void free_kmem_cache_sheaves(struct kmem_cache *s) { }
 static inline void flush_all_cpus_locked(struct kmem_cache *s) { }
 static inline void flush_all(struct kmem_cache *s) { }
 static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu) { }
@@ -3847,7 +4421,11 @@ static __fastpath_inline void *slab_alloc_node(struct kmem_cache *s, struct list
 	if (unlikely(object))
 		goto out;
 
-	object = __slab_alloc_node(s, gfpflags, node, addr, orig_size);
+	object = NULL;
+	if (slab_has_sheaves(s) && node == NUMA_NO_NODE)
+		object = alloc_from_pcs(s, gfpflags);
+	if (!object)
+		object = __slab_alloc_node(s, gfpflags, node, addr, orig_size);
 
 	maybe_wipe_obj_freeptr(s, object);
 	init = slab_want_init_on_alloc(gfpflags, s);
@@ -4296,8 +4874,17 @@ void slab_free(struct kmem_cache *s, struct slab *slab, void *object,
 {
 	memcg_slab_free_hook(s, slab, &object, 1);
 
-	if (likely(slab_free_hook(s, object, slab_want_init_on_free(s))))
-		do_slab_free(s, slab, object, object, 1, addr);
+	if (unlikely(!slab_free_hook(s, object, slab_want_init_on_free(s))))
+		return;
+
+	/* Only objects of the local node go to the sheaves */
+	if (slab_has_sheaves(s) && likely(slab_nid(slab) == numa_mem_id()) &&
+	    !is_kfence_address(object)) {
+		free_to_pcs(s, object);
+		return;
+	}
+
+	do_slab_free(s, slab, object, object, 1, addr);
 }
 
 static __fastpath_inline
@@ -4516,6 +5103,14 @@ void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 	if (!size)
 		return;
 
+	if (s && slab_has_sheaves(s)) {
+		size_t i;
+
+		for (i = 0; i < size; i++)
+			slab_free(s, virt_to_slab(p[i]), p[i], _RET_IP_);
+		return;
+	}
+
 	do {
 		struct detached_freelist df;
 
@@ -4645,7 +5240,19 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	if (unlikely(!s))
 		return 0;
 
-	i = __kmem_cache_alloc_bulk(s, flags, size, p);
+	i = 0;
+	if (slab_has_sheaves(s))
+		i = alloc_from_pcs_bulk(s, size, p);
+
+	if (i < size) {
+		if (unlikely(!__kmem_cache_alloc_bulk(s, flags, size - i, p + i))) {
+			if (i)
+				__kmem_cache_free_bulk(s, i, p);
+			i = 0;
+		} else {
+			i = size;
+		}
+	}
 
 	/*
 	 * memcg and kmem_cache debug support and memory initialization.
@@ -4806,6 +5413,13 @@ init_kmem_cache_node(struct kmem_cache_node *n)
 	atomic_long_set(&n->total_objects, 0);
 	INIT_LIST_HEAD(&n->full);
 #endif
+#ifndef CONFIG_SLUB_TINY
+	spin_lock_init(&n->barn.lock);
+	INIT_LIST_HEAD(&n->barn.sheaves_full);
+	INIT_LIST_HEAD(&n->barn.sheaves_empty);
+	n->barn.nr_full = 0;
+	n->barn.nr_empty = 0;
+#endif
 }
 
 #ifndef CONFIG_SLUB_TINY
@@ -4898,6 +5512,7 @@ void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
 #ifndef CONFIG_SLUB_TINY
+	free_kmem_cache_sheaves(s);
 	free_percpu(s->cpu_slab);
 #endif
 	free_kmem_cache_nodes(s);
@@ -5153,7 +5768,7 @@ static int kmem_cache_open(struct kmem_cache *s, slab_flags_t flags)
 	if (!init_kmem_cache_nodes(s))
 		goto error;
 
-	if (alloc_kmem_cache_cpus(s))
+	if (alloc_kmem_cache_cpus(s) && alloc_kmem_cache_sheaves(s))
 		return 0;
 
 error:
@@ -6211,6 +6826,18 @@ static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(cpu_partial);
 
+static ssize_t sheaf_capacity_show(struct kmem_cache *s, char *buf)
+{
+	unsigned int capacity = 0;
+#ifndef CONFIG_SLUB_TINY
+	if (s->cpu_sheaves)
+		capacity = s->sheaf_capacity;
+#endif
+
+	return sysfs_emit(buf, "%u\n", capacity);
+}
+SLAB_ATTR_RO(sheaf_capacity);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (!s->ctor)
@@ -6536,6 +7163,16 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(ALLOC_PCS, alloc_cpu_sheaf);
+STAT_ATTR(FREE_PCS, free_cpu_sheaf);
+STAT_ATTR(SHEAF_FLUSH, sheaf_flush);
+STAT_ATTR(SHEAF_REFILL, sheaf_refill);
+STAT_ATTR(SHEAF_ALLOC, sheaf_alloc);
+STAT_ATTR(SHEAF_FREE, sheaf_free);
+STAT_ATTR(BARN_GET, barn_get);
+STAT_ATTR(BARN_GET_FAIL, barn_get_fail);
+STAT_ATTR(BARN_PUT, barn_put);
+STAT_ATTR(BARN_PUT_FAIL, barn_put_fail);
 #endif	/* CONFIG_SLUB_STATS */
 
 #ifdef CONFIG_KFENCE
@@ -6568,6 +7205,7 @@ static struct attribute *slab_attrs[] = {
 	&order_attr.attr,
 	&min_partial_attr.attr,
 	&cpu_partial_attr.attr,
+	&sheaf_capacity_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
 	&cpu_slabs_attr.attr,
@@ -6623,6 +7261,16 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&alloc_cpu_sheaf_attr.attr,
+	&free_cpu_sheaf_attr.attr,
+	&sheaf_flush_attr.attr,
+	&sheaf_refill_attr.attr,
+	&sheaf_alloc_attr.attr,
+	&sheaf_free_attr.attr,
+	&barn_get_attr.attr,
+	&barn_get_fail_attr.attr,
+	&barn_put_attr.attr,
+	&barn_put_fail_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
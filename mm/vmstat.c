@@ -1303,9 +1303,18 @@ const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+	"ra_history_hit",
+	"ra_history_miss",
+	"ra_history_reset",
+
 	"drop_pagecache",
 	"drop_slab",
 	"oom_kill",
+#ifdef CONFIG_MEMCG
+	"memcg_stock_hit",
+	"memcg_stock_miss",
+	"memcg_stock_evict",
+#endif
 
 #ifdef CONFIG_NUMA_BALANCING
 	"numa_pte_updates",
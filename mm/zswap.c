@@ -20,7 +20,8 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
-#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
 #include <linux/swap.h>
 #include <linux/crypto.h>
 #include <linux/scatterlist.h>
@@ -36,6 +37,7 @@
 #include <linux/pagemap.h>
 #include <linux/workqueue.h>
 #include <linux/list_lru.h>
+#include <linux/xarray.h>
 
 #include "swap.h"
 #include "internal.h"
@@ -171,10 +173,9 @@ struct crypto_acomp_ctx {
 };
 
 /*
- * The lock ordering is zswap_tree.lock -> zswap_pool.lru_lock.
- * The only case where lru_lock is not acquired while holding tree.lock is
- * when a zswap_entry is taken off the lru for writeback, in that case it
- * needs to be verified that it's still valid in the tree.
+ * Entries are added to the lru only after they have been inserted into the
+ * tree.  When a zswap_entry is taken off the lru for writeback, it needs to
+ * be verified that it's still valid in the tree.
  */
 struct zswap_pool {
 	struct zpool *zpools[ZSWAP_NR_ZPOOLS];
@@ -197,14 +198,14 @@ struct zswap_pool {
  * This structure contains the metadata for tracking a single compressed
  * page within zswap.
  *
- * rbnode - links the entry into red-black tree for the appropriate swap type
- * swpentry - associated swap entry, the offset indexes into the red-black tree
+ * swpentry - associated swap entry, the offset indexes into the xarray
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
- *            concurrent calls to load, invalidate, and writeback.  The lock
- *            for the zswap_tree structure that contains the entry must
- *            be held while changing the refcount.  Since the lock must
- *            be held, there is no reason to also make refcount atomic.
+ *            concurrent calls to load, invalidate, and writeback.  The tree
+ *            holds one reference for as long as the entry is indexed.
+ *            Lookups take their reference under RCU with
+ *            refcount_inc_not_zero(), so entries are freed after a grace
+ *            period.
  * length - the length in bytes of the compressed page data.  Needed during
  *          decompression. For a same value filled page length is 0, and both
  *          pool and lru are invalid and must be ignored.
@@ -213,11 +214,11 @@ struct zswap_pool {
  * value - value of the same-value filled pages which have same content
  * objcg - the obj_cgroup that the compressed memory is charged to
  * lru - handle to the pool's lru used to evict pages.
+ * rcu - used to free the entry after an RCU grace period
  */
 struct zswap_entry {
-	struct rb_node rbnode;
 	swp_entry_t swpentry;
-	int refcount;
+	refcount_t refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
 	union {
@@ -226,16 +227,15 @@ struct zswap_entry {
 	};
 	struct obj_cgroup *objcg;
 	struct list_head lru;
+	struct rcu_head rcu;
 };
 
 /*
- * The tree lock in the zswap_tree struct protects a few things:
- * - the rbtree
- * - the refcount field of each entry in the tree
+ * Entries of a swap type are indexed by swap offset.  Lookups are lockless
+ * under RCU, insertions and removals are serialized by the xarray lock.
  */
 struct zswap_tree {
-	struct rb_root rbroot;
-	spinlock_t lock;
+	struct xarray xa;
 };
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
@@ -355,8 +355,7 @@ static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp, int nid)
 	entry = kmem_cache_alloc_node(zswap_entry_cache, gfp, nid);
 	if (!entry)
 		return NULL;
-	entry->refcount = 1;
-	RB_CLEAR_NODE(&entry->rbnode);
+	refcount_set(&entry->refcount, 1);
 	return entry;
 }
 
@@ -365,6 +364,11 @@ static void zswap_entry_cache_free(struct zswap_entry *entry)
 	kmem_cache_free(zswap_entry_cache, entry);
 }
 
+static void zswap_entry_cache_free_rcu(struct rcu_head *head)
+{
+	zswap_entry_cache_free(container_of(head, struct zswap_entry, rcu));
+}
+
 /*********************************
 * zswap lruvec functions
 **********************************/
@@ -458,67 +462,6 @@ static void zswap_lru_putback(struct list_lru *list_lru,
 	rcu_read_unlock();
 }
 
-/*********************************
-* rbtree functions
-**********************************/
-static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
-{
-	struct rb_node *node = root->rb_node;
-	struct zswap_entry *entry;
-	pgoff_t entry_offset;
-
-	while (node) {
-		entry = rb_entry(node, struct zswap_entry, rbnode);
-		entry_offset = swp_offset(entry->swpentry);
-		if (entry_offset > offset)
-			node = node->rb_left;
-		else if (entry_offset < offset)
-			node = node->rb_right;
-		else
-			return entry;
-	}
-	return NULL;
-}
-
-/*
- * In the case that a entry with the same offset is found, a pointer to
- * the existing entry is stored in dupentry and the function returns -EEXIST
- */
-static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
-			struct zswap_entry **dupentry)
-{
-	struct rb_node **link = &root->rb_node, *parent = NULL;
-	struct zswap_entry *myentry;
-	pgoff_t myentry_offset, entry_offset = swp_offset(entry->swpentry);
-
-	while (*link) {
-		parent = *link;
-		myentry = rb_entry(parent, struct zswap_entry, rbnode);
-		myentry_offset = swp_offset(myentry->swpentry);
-		if (myentry_offset > entry_offset)
-			link = &(*link)->rb_left;
-		else if (myentry_offset < entry_offset)
-			link = &(*link)->rb_right;
-		else {
-			*dupentry = myentry;
-			return -EEXIST;
-		}
-	}
-	rb_link_node(&entry->rbnode, parent, link);
-	rb_insert_color(&entry->rbnode, root);
-	return 0;
-}
-
-static bool zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
-{
-	if (!RB_EMPTY_NODE(&entry->rbnode)) {
-		rb_erase(&entry->rbnode, root);
-		RB_CLEAR_NODE(&entry->rbnode);
-		return true;
-	}
-	return false;
-}
-
 static struct zpool *zswap_find_zpool(struct zswap_entry *entry)
 {
 	int i = 0;
@@ -547,41 +490,36 @@ static void zswap_free_entry(struct zswap_entry *entry)
 		obj_cgroup_uncharge_zswap(entry->objcg, entry->length);
 		obj_cgroup_put(entry->objcg);
 	}
-	zswap_entry_cache_free(entry);
+	/* lockless lookups may still be looking at the entry */
+	call_rcu(&entry->rcu, zswap_entry_cache_free_rcu);
 	atomic_dec(&zswap_stored_pages);
 	zswap_update_total_size();
 }
 
-/* caller must hold the tree lock */
+/* caller must already hold a reference */
 static void zswap_entry_get(struct zswap_entry *entry)
 {
-	entry->refcount++;
+	refcount_inc(&entry->refcount);
 }
 
-/* caller must hold the tree lock
-* remove from the tree and free it, if nobody reference the entry
-*/
-static void zswap_entry_put(struct zswap_tree *tree,
-			struct zswap_entry *entry)
+/* free the entry, if nobody references it anymore */
+static void zswap_entry_put(struct zswap_entry *entry)
 {
-	int refcount = --entry->refcount;
-
-	WARN_ON_ONCE(refcount < 0);
-	if (refcount == 0) {
-		WARN_ON_ONCE(!RB_EMPTY_NODE(&entry->rbnode));
+	if (refcount_dec_and_test(&entry->refcount))
 		zswap_free_entry(entry);
-	}
 }
 
-/* caller must hold the tree lock */
-static struct zswap_entry *zswap_entry_find_get(struct rb_root *root,
+/* look up the entry for offset and take a reference on it */
+static struct zswap_entry *zswap_entry_find_get(struct zswap_tree *tree,
 				pgoff_t offset)
 {
 	struct zswap_entry *entry;
 
-	entry = zswap_rb_search(root, offset);
-	if (entry)
-		zswap_entry_get(entry);
+	rcu_read_lock();
+	entry = xa_load(&tree->xa, offset);
+	if (entry && !refcount_inc_not_zero(&entry->refcount))
+		entry = NULL;
+	rcu_read_unlock();
 
 	return entry;
 }
@@ -844,8 +782,9 @@ static struct zswap_pool *zswap_pool_find_get(char *type, char *compressor)
 static void zswap_invalidate_entry(struct zswap_tree *tree,
 				   struct zswap_entry *entry)
 {
-	if (zswap_rb_erase(&tree->rbroot, entry))
-		zswap_entry_put(tree, entry);
+	if (xa_cmpxchg(&tree->xa, swp_offset(entry->swpentry), entry, NULL,
+		       GFP_KERNEL) == entry)
+		zswap_entry_put(entry);
 }
 
 static enum lru_status shrink_memcg_cb(struct list_head *item, struct list_lru_one *l,
@@ -866,24 +805,32 @@ static enum lru_status shrink_memcg_cb(struct list_head *item, struct list_lru_o
 	swpoffset = swp_offset(entry->swpentry);
 	tree = zswap_trees[swp_type(entry->swpentry)];
 	list_lru_isolate(l, item);
+	/*
+	 * The entry can't have been handed to call_rcu() while it was on the
+	 * LRU, so entering the RCU read-side section before the lru lock is
+	 * dropped keeps its memory from being freed and reused underneath
+	 * the checks below.
+	 */
+	rcu_read_lock();
 	/*
 	 * It's safe to drop the lock here because we return either
 	 * LRU_REMOVED_RETRY or LRU_RETRY.
 	 */
 	spin_unlock(lock);
 
-	/* Check for invalidate() race */
-	spin_lock(&tree->lock);
-	if (entry != zswap_rb_search(&tree->rbroot, swpoffset))
-		goto unlock;
-
-	/* Hold a reference to prevent a free during writeback */
-	zswap_entry_get(entry);
-	spin_unlock(&tree->lock);
+	/*
+	 * Check for invalidate() race, and hold a reference to prevent a
+	 * free during writeback.
+	 */
+	if (entry != xa_load(&tree->xa, swpoffset) ||
+	    !refcount_inc_not_zero(&entry->refcount)) {
+		rcu_read_unlock();
+		goto relock;
+	}
+	rcu_read_unlock();
 
 	writeback_result = zswap_writeback_entry(entry, tree);
 
-	spin_lock(&tree->lock);
 	if (writeback_result) {
 		zswap_reject_reclaim_fail++;
 		zswap_lru_putback(&entry->pool->list_lru, entry);
@@ -897,7 +844,7 @@ static enum lru_status shrink_memcg_cb(struct list_head *item, struct list_lru_o
 		if (writeback_result == -EEXIST && encountered_page_in_swapcache)
 			*encountered_page_in_swapcache = true;
 
-		goto put_unlock;
+		goto put;
 	}
 	zswap_written_back_pages++;
 
@@ -908,15 +855,14 @@ static enum lru_status shrink_memcg_cb(struct list_head *item, struct list_lru_o
 	/*
 	 * Writeback started successfully, the page now belongs to the
 	 * swapcache. Drop the entry from zswap - unless invalidate already
-	 * took it out while we had the tree->lock released for IO.
+	 * took it out while we were doing IO.
 	 */
 	zswap_invalidate_entry(tree, entry);
 
-put_unlock:
+put:
 	/* Drop local reference */
-	zswap_entry_put(tree, entry);
-unlock:
-	spin_unlock(&tree->lock);
+	zswap_entry_put(entry);
+relock:
 	spin_lock(lock);
 	return ret;
 }
@@ -1435,15 +1381,12 @@ static int zswap_writeback_entry(struct zswap_entry *entry,
 	 * backs (our zswap_entry reference doesn't prevent that), to
 	 * avoid overwriting a new swap folio with old compressed data.
 	 */
-	spin_lock(&tree->lock);
-	if (zswap_rb_search(&tree->rbroot, swp_offset(entry->swpentry)) != entry) {
-		spin_unlock(&tree->lock);
+	if (xa_load(&tree->xa, swp_offset(entry->swpentry)) != entry) {
 		delete_from_swap_cache(folio);
 		folio_unlock(folio);
 		folio_put(folio);
 		return -ENOMEM;
 	}
-	spin_unlock(&tree->lock);
 
 	__zswap_load(entry, &folio->page);
 
@@ -1490,19 +1433,21 @@ static void zswap_fill_page(void *ptr, unsigned long value)
 	memset_l(page, value, PAGE_SIZE / sizeof(unsigned long));
 }
 
-bool zswap_store(struct folio *folio)
+/*
+ * Compress and store sub-page index of a folio in the tree, under the swap
+ * offset of the folio plus index.
+ */
+static bool zswap_store_page(struct folio *folio, long index,
+			     struct obj_cgroup *objcg, struct zswap_tree *tree)
 {
 	swp_entry_t swp = folio->swap;
 	int type = swp_type(swp);
-	pgoff_t offset = swp_offset(swp);
-	struct page *page = &folio->page;
-	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *dupentry;
+	pgoff_t offset = swp_offset(swp) + index;
+	struct page *page = folio_page(folio, index);
+	struct zswap_entry *entry, *old;
 	struct scatterlist input, output;
 	struct crypto_acomp_ctx *acomp_ctx;
-	struct obj_cgroup *objcg = NULL;
-	struct mem_cgroup *memcg = NULL;
-	struct zswap_pool *pool;
+	struct mem_cgroup *memcg;
 	struct zpool *zpool;
 	unsigned int dlen = PAGE_SIZE;
 	unsigned long handle, value;
@@ -1511,61 +1456,11 @@ bool zswap_store(struct folio *folio)
 	gfp_t gfp;
 	int ret;
 
-	VM_WARN_ON_ONCE(!folio_test_locked(folio));
-	VM_WARN_ON_ONCE(!folio_test_swapcache(folio));
-
-	/* Large folios aren't supported */
-	if (folio_test_large(folio))
-		return false;
-
-	if (!tree)
-		return false;
-
-	/*
-	 * If this is a duplicate, it must be removed before attempting to store
-	 * it, otherwise, if the store fails the old page won't be removed from
-	 * the tree, and it might be written back overriding the new data.
-	 */
-	spin_lock(&tree->lock);
-	dupentry = zswap_rb_search(&tree->rbroot, offset);
-	if (dupentry) {
-		zswap_duplicate_entry++;
-		zswap_invalidate_entry(tree, dupentry);
-	}
-	spin_unlock(&tree->lock);
-
-	if (!zswap_enabled)
-		return false;
-
-	objcg = get_obj_cgroup_from_folio(folio);
-	if (objcg && !obj_cgroup_may_zswap(objcg)) {
-		memcg = get_mem_cgroup_from_objcg(objcg);
-		if (shrink_memcg(memcg)) {
-			mem_cgroup_put(memcg);
-			goto reject;
-		}
-		mem_cgroup_put(memcg);
-	}
-
-	/* reclaim space if needed */
-	if (zswap_is_full()) {
-		zswap_pool_limit_hit++;
-		zswap_pool_reached_full = true;
-		goto shrink;
-	}
-
-	if (zswap_pool_reached_full) {
-	       if (!zswap_can_accept())
-			goto shrink;
-		else
-			zswap_pool_reached_full = false;
-	}
-
 	/* allocate entry */
 	entry = zswap_entry_cache_alloc(GFP_KERNEL, page_to_nid(page));
 	if (!entry) {
 		zswap_reject_kmemcache_fail++;
-		goto reject;
+		return false;
 	}
 
 	if (zswap_same_filled_pages_enabled) {
@@ -1605,7 +1500,7 @@ bool zswap_store(struct folio *folio)
 
 	dst = acomp_ctx->buffer;
 	sg_init_table(&input, 1);
-	sg_set_page(&input, &folio->page, PAGE_SIZE, 0);
+	sg_set_page(&input, page, PAGE_SIZE, 0);
 
 	/*
 	 * We need PAGE_SIZE * 2 here since there maybe over-compression case,
@@ -1661,44 +1556,152 @@ bool zswap_store(struct folio *folio)
 insert_entry:
 	entry->objcg = objcg;
 	if (objcg) {
+		obj_cgroup_get(objcg);
 		obj_cgroup_charge_zswap(objcg, entry->length);
-		/* Account before objcg ref is moved to tree */
 		count_objcg_event(objcg, ZSWPOUT);
 	}
 
-	/* map */
-	spin_lock(&tree->lock);
 	/*
-	 * A duplicate entry should have been removed at the beginning of this
-	 * function. Since the swap entry should be pinned, if a duplicate is
+	 * map
+	 *
+	 * The initial reference is owned by the tree.  Hold another one until
+	 * the entry is on the lru and accounted, as it can be invalidated as
+	 * soon as it is visible in the tree.
+	 */
+	zswap_entry_get(entry);
+	old = xa_store(&tree->xa, offset, entry, GFP_KERNEL);
+	if (xa_is_err(old)) {
+		zswap_reject_alloc_fail++;
+		goto store_failed;
+	}
+	/*
+	 * A duplicate entry should have been removed at the beginning of
+	 * zswap_store(). Since the swap entry should be pinned, if a duplicate is
 	 * found again here it means that something went wrong in the swap
 	 * cache.
 	 */
-	while (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+	if (old) {
 		WARN_ON(1);
 		zswap_duplicate_entry++;
-		zswap_invalidate_entry(tree, dupentry);
+		zswap_entry_put(old);
 	}
 	if (entry->length) {
 		INIT_LIST_HEAD(&entry->lru);
 		zswap_lru_add(&entry->pool->list_lru, entry);
 		atomic_inc(&entry->pool->nr_stored);
 	}
-	spin_unlock(&tree->lock);
 
 	/* update stats */
 	atomic_inc(&zswap_stored_pages);
 	zswap_update_total_size();
 	count_vm_event(ZSWPOUT);
 
+	zswap_entry_put(entry);
 	return true;
 
+store_failed:
+	if (objcg) {
+		obj_cgroup_uncharge_zswap(objcg, entry->length);
+		obj_cgroup_put(objcg);
+	}
+	if (!entry->length) {
+		atomic_dec(&zswap_same_filled_pages);
+		goto freepage;
+	}
+	zpool_free(zswap_find_zpool(entry), entry->handle);
+	goto put_pool;
 put_dstmem:
 	mutex_unlock(&acomp_ctx->mutex);
 put_pool:
 	zswap_pool_put(entry->pool);
 freepage:
 	zswap_entry_cache_free(entry);
+	return false;
+}
+
+bool zswap_store(struct folio *folio)
+{
+	long nr_pages = folio_nr_pages(folio);
+	swp_entry_t swp = folio->swap;
+	pgoff_t offset = swp_offset(swp);
+	struct zswap_tree *tree = zswap_trees[swp_type(swp)];
+	struct obj_cgroup *objcg = NULL;
+	struct mem_cgroup *memcg = NULL;
+	struct zswap_entry *old;
+	struct zswap_pool *pool;
+	long index;
+
+	VM_WARN_ON_ONCE(!folio_test_locked(folio));
+	VM_WARN_ON_ONCE(!folio_test_swapcache(folio));
+
+	if (!tree)
+		return false;
+
+	/*
+	 * If this is a duplicate, it must be removed before attempting to store
+	 * it, otherwise, if the store fails the old page won't be removed from
+	 * the tree, and it might be written back overriding the new data.
+	 */
+	for (index = 0; index < nr_pages; index++) {
+		old = xa_erase(&tree->xa, offset + index);
+		if (old) {
+			zswap_duplicate_entry++;
+			zswap_entry_put(old);
+		}
+	}
+
+	if (!zswap_enabled)
+		return false;
+
+	objcg = get_obj_cgroup_from_folio(folio);
+	if (objcg && !obj_cgroup_may_zswap(objcg)) {
+		memcg = get_mem_cgroup_from_objcg(objcg);
+		if (shrink_memcg(memcg)) {
+			mem_cgroup_put(memcg);
+			goto reject;
+		}
+		mem_cgroup_put(memcg);
+	}
+
+	/* reclaim space if needed */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		zswap_pool_reached_full = true;
+		goto shrink;
+	}
+
+	if (zswap_pool_reached_full) {
+	       if (!zswap_can_accept())
+			goto shrink;
+		else
+			zswap_pool_reached_full = false;
+	}
+
+	/*
+	 * Large folios are stored as one entry per sub-page, which keeps
+	 * writeback and invalidation at page granularity.  The folio is only
+	 * stored if all of its sub-pages are.
+	 */
+	for (index = 0; index < nr_pages; index++) {
+		if (!zswap_store_page(folio, index, objcg, tree))
+			goto store_failed;
+	}
+
+	count_mthp_stat(folio_order(folio), MTHP_STAT_ZSWPOUT);
+	if (objcg)
+		obj_cgroup_put(objcg);
+	return true;
+
+store_failed:
+	/*
+	 * The folio is going to be written to the swap device as a whole, so
+	 * the sub-pages stored so far must not be loaded or written back.
+	 */
+	while (index--) {
+		old = xa_erase(&tree->xa, offset + index);
+		if (old)
+			zswap_entry_put(old);
+	}
 reject:
 	if (objcg)
 		obj_cgroup_put(objcg);
@@ -1711,26 +1714,18 @@ bool zswap_store(struct folio *folio)
 	goto reject;
 }
 
-bool zswap_load(struct folio *folio)
+static bool zswap_load_page(struct folio *folio, long index,
+			    struct zswap_tree *tree)
 {
-	swp_entry_t swp = folio->swap;
-	int type = swp_type(swp);
-	pgoff_t offset = swp_offset(swp);
-	struct page *page = &folio->page;
-	struct zswap_tree *tree = zswap_trees[type];
+	pgoff_t offset = swp_offset(folio->swap) + index;
+	struct page *page = folio_page(folio, index);
 	struct zswap_entry *entry;
 	u8 *dst;
 
-	VM_WARN_ON_ONCE(!folio_test_locked(folio));
-
 	/* find */
-	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
-	if (!entry) {
-		spin_unlock(&tree->lock);
+	entry = zswap_entry_find_get(tree, offset);
+	if (!entry)
 		return false;
-	}
-	spin_unlock(&tree->lock);
 
 	if (entry->length)
 		__zswap_load(entry, page);
@@ -1744,16 +1739,80 @@ bool zswap_load(struct folio *folio)
 	if (entry->objcg)
 		count_objcg_event(entry->objcg, ZSWPIN);
 
-	spin_lock(&tree->lock);
-	if (zswap_exclusive_loads_enabled) {
+	if (zswap_exclusive_loads_enabled)
 		zswap_invalidate_entry(tree, entry);
-		folio_mark_dirty(folio);
-	} else if (entry->length) {
+	else if (entry->length) {
 		zswap_lru_del(&entry->pool->list_lru, entry);
 		zswap_lru_add(&entry->pool->list_lru, entry);
 	}
-	zswap_entry_put(tree, entry);
-	spin_unlock(&tree->lock);
+	zswap_entry_put(entry);
+
+	return true;
+}
+
+/*
+ * Returns how many of the @nr_pages swap slots starting at @swp have their
+ * contents stored in zswap.
+ */
+int zswap_nr_present(swp_entry_t swp, int nr_pages)
+{
+	struct zswap_tree *tree = zswap_trees[swp_type(swp)];
+	pgoff_t offset = swp_offset(swp);
+	int index, nr_stored = 0;
+
+	if (!tree)
+		return 0;
+
+	for (index = 0; index < nr_pages; index++)
+		if (xa_load(&tree->xa, offset + index))
+			nr_stored++;
+
+	return nr_stored;
+}
+
+/*
+ * Returns true if zswap handled the folio, in which case it is uptodate
+ * unless it was only partially stored in zswap.  Returns false if the folio
+ * needs to be read from the swap device.
+ */
+bool zswap_load(struct folio *folio)
+{
+	long nr_pages = folio_nr_pages(folio);
+	swp_entry_t swp = folio->swap;
+	pgoff_t offset = swp_offset(swp);
+	struct zswap_tree *tree = zswap_trees[swp_type(swp)];
+	long index, nr_stored;
+
+	VM_WARN_ON_ONCE(!folio_test_locked(folio));
+
+	if (!tree)
+		return false;
+
+	if (folio_test_large(folio)) {
+		nr_stored = zswap_nr_present(swp, nr_pages);
+		if (!nr_stored)
+			return false;
+		/*
+		 * The rest of the folio is on the swap device, there is no
+		 * way to assemble it here.  Leave it !uptodate, so that the
+		 * caller fails the swapin instead of exposing stale data.
+		 */
+		if (WARN_ON_ONCE(nr_stored != nr_pages))
+			return true;
+	}
+
+	for (index = 0; index < nr_pages; index++) {
+		if (!zswap_load_page(folio, index, tree)) {
+			/* only the first sub-page may legitimately be absent */
+			WARN_ON_ONCE(index);
+			return index != 0;
+		}
+	}
+
+	if (zswap_exclusive_loads_enabled)
+		folio_mark_dirty(folio);
+	folio_mark_uptodate(folio);
+	count_mthp_stat(folio_order(folio), MTHP_STAT_ZSWPIN);
 
 	return true;
 }
@@ -1763,16 +1822,10 @@ void zswap_invalidate(int type, pgoff_t offset)
 	struct zswap_tree *tree = zswap_trees[type];
 	struct zswap_entry *entry;
 
-	/* find */
-	spin_lock(&tree->lock);
-	entry = zswap_rb_search(&tree->rbroot, offset);
-	if (!entry) {
-		/* entry was written back */
-		spin_unlock(&tree->lock);
-		return;
-	}
-	zswap_invalidate_entry(tree, entry);
-	spin_unlock(&tree->lock);
+	/* a missing entry was written back */
+	entry = xa_erase(&tree->xa, offset);
+	if (entry)
+		zswap_entry_put(entry);
 }
 
 void zswap_swapon(int type)
@@ -1785,25 +1838,23 @@ void zswap_swapon(int type)
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
-	spin_lock_init(&tree->lock);
+	xa_init(&tree->xa);
 	zswap_trees[type] = tree;
 }
 
 void zswap_swapoff(int type)
 {
 	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *n;
+	struct zswap_entry *entry;
+	unsigned long offset;
 
 	if (!tree)
 		return;
 
 	/* walk the tree and free everything */
-	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
+	xa_for_each(&tree->xa, offset, entry)
 		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
-	spin_unlock(&tree->lock);
+	xa_destroy(&tree->xa);
 	kfree(tree);
 	zswap_trees[type] = NULL;
 }
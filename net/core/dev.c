@@ -4417,6 +4417,87 @@ int __dev_direct_xmit(struct sk_buff *skb, u16 queue_id)
 }
 EXPORT_SYMBOL(__dev_direct_xmit);
 
+/**
+ * __dev_direct_xmit_batch - transmit several skbs on one tx queue
+ * @skbs: skbs to send, all for the same device
+ * @n: number of entries in @skbs
+ * @queue_id: tx queue to use
+ * @sent: set to the index of the first entry not handed to the driver
+ *
+ * Batched form of __dev_direct_xmit(). Entries that cannot be sent because
+ * the device is down or the skb fails validation are freed and cleared to
+ * NULL. The others are passed to the driver under a single acquisition of
+ * the tx queue lock, with xmit_more set on all but the last one, so that the
+ * driver can kick the hardware once for the whole batch.
+ *
+ * Returns NETDEV_TX_BUSY if the driver refused an skb: that entry and the
+ * ones after it are left to the caller. Otherwise returns NET_XMIT_DROP if
+ * any entry was dropped, NETDEV_TX_OK if not.
+ */
+int __dev_direct_xmit_batch(struct sk_buff **skbs, unsigned int n,
+			    u16 queue_id, unsigned int *sent)
+{
+	struct net_device *dev = skbs[0]->dev;
+	unsigned int i, last = n;
+	struct netdev_queue *txq;
+	int ret = NETDEV_TX_OK;
+	bool again = false;
+	bool up;
+
+	up = netif_running(dev) && netif_carrier_ok(dev);
+
+	for (i = 0; i < n; i++) {
+		struct sk_buff *skb = skbs[i];
+
+		if (likely(up)) {
+			skb = validate_xmit_skb_list(skb, dev, &again);
+			if (likely(skb == skbs[i])) {
+				skb_set_queue_mapping(skb, queue_id);
+				last = i;
+				continue;
+			}
+		}
+
+		dev_core_stats_tx_dropped_inc(dev);
+		kfree_skb_list(skb);
+		skbs[i] = NULL;
+		ret = NET_XMIT_DROP;
+	}
+
+	*sent = n;
+	if (last == n)
+		return ret;
+
+	txq = netdev_get_tx_queue(dev, queue_id);
+
+	local_bh_disable();
+
+	dev_xmit_recursion_inc();
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	for (i = 0; i <= last; i++) {
+		int rc = NETDEV_TX_BUSY;
+
+		if (!skbs[i])
+			continue;
+
+		if (!netif_xmit_frozen_or_drv_stopped(txq))
+			rc = netdev_start_xmit(skbs[i], dev, txq, i != last);
+		if (!dev_xmit_complete(rc)) {
+			*sent = i;
+			ret = NETDEV_TX_BUSY;
+			break;
+		}
+		if (rc == NET_XMIT_DROP)
+			ret = NET_XMIT_DROP;
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	dev_xmit_recursion_dec();
+
+	local_bh_enable();
+	return ret;
+}
+EXPORT_SYMBOL(__dev_direct_xmit_batch);
+
 /*************************************************************************
  *			Receiver routines
  *************************************************************************/
@@ -6088,15 +6169,23 @@ bool napi_complete_done(struct napi_struct *n, int work_done)
 
 	if (work_done) {
 		if (n->gro_bitmask)
-			timeout = READ_ONCE(n->dev->gro_flush_timeout);
-		n->defer_hard_irqs_count = READ_ONCE(n->dev->napi_defer_hard_irqs);
+			timeout = napi_get_gro_flush_timeout(n);
+		n->defer_hard_irqs_count = napi_get_defer_hard_irqs(n);
 	}
 	if (n->defer_hard_irqs_count > 0) {
 		n->defer_hard_irqs_count--;
-		timeout = READ_ONCE(n->dev->gro_flush_timeout);
+		timeout = napi_get_gro_flush_timeout(n);
 		if (timeout)
 			ret = false;
 	}
+	if (test_bit(NAPI_STATE_IRQ_SUSPENDED, &n->state)) {
+		/* An application busy polling this NAPI is consuming, keep
+		 * the device IRQs masked.  The suspend timer is already
+		 * armed as a safety net and must not be shortened.
+		 */
+		ret = false;
+		timeout = 0;
+	}
 	if (n->gro_bitmask) {
 		/* When the NAPI instance uses a timeout and keeps postponing
 		 * it, we need to bound somehow the time packets are kept in
@@ -6199,9 +6288,11 @@ static void busy_poll_stop(struct napi_struct *napi, void *have_poll_lock, bool
 	local_bh_disable();
 
 	if (prefer_busy_poll) {
-		napi->defer_hard_irqs_count = READ_ONCE(napi->dev->napi_defer_hard_irqs);
-		timeout = READ_ONCE(napi->dev->gro_flush_timeout);
-		if (napi->defer_hard_irqs_count && timeout) {
+		napi->defer_hard_irqs_count = napi_get_defer_hard_irqs(napi);
+		timeout = napi_get_gro_flush_timeout(napi);
+		if (test_bit(NAPI_STATE_IRQ_SUSPENDED, &napi->state)) {
+			skip_schedule = true;
+		} else if (napi->defer_hard_irqs_count && timeout) {
 			hrtimer_start(&napi->timer, ns_to_ktime(timeout), HRTIMER_MODE_REL_PINNED);
 			skip_schedule = true;
 		}
@@ -6302,6 +6393,56 @@ void napi_busy_loop(unsigned int napi_id,
 }
 EXPORT_SYMBOL(napi_busy_loop);
 
+/**
+ * napi_suspend_irqs - keep the device IRQs of a NAPI masked
+ * @napi_id: NAPI ID the caller is busy polling
+ *
+ * Called by a busy polling application which just found work, so that
+ * the NAPI neither re-enables the device IRQs nor gets rescheduled from
+ * softirq while the application is consuming it. The suspension ends
+ * with napi_resume_irqs(), or when irq_suspend_timeout expires in case
+ * the application stops polling. Nothing happens while the timeout is 0.
+ */
+void napi_suspend_irqs(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	unsigned long timeout;
+
+	rcu_read_lock();
+	napi = napi_by_id(napi_id);
+	if (napi) {
+		timeout = napi_get_irq_suspend_timeout(napi);
+		if (timeout) {
+			set_bit(NAPI_STATE_IRQ_SUSPENDED, &napi->state);
+			hrtimer_start(&napi->timer, ns_to_ktime(timeout),
+				      HRTIMER_MODE_REL_PINNED);
+		}
+	}
+	rcu_read_unlock();
+}
+
+/**
+ * napi_resume_irqs - end the IRQ suspension of a NAPI
+ * @napi_id: NAPI ID passed to napi_suspend_irqs()
+ *
+ * Called once the busy polling application ran out of work and is about
+ * to sleep. The NAPI is scheduled one more time, so that the driver
+ * re-enables its IRQs when it completes.
+ */
+void napi_resume_irqs(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+
+	rcu_read_lock();
+	napi = napi_by_id(napi_id);
+	if (napi && test_and_clear_bit(NAPI_STATE_IRQ_SUSPENDED, &napi->state)) {
+		local_bh_disable();
+		napi_schedule(napi);
+		local_bh_enable();
+	}
+	rcu_read_unlock();
+}
+
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
 static void napi_hash_add(struct napi_struct *napi)
@@ -6311,13 +6452,24 @@ static void napi_hash_add(struct napi_struct *napi)
 
 	spin_lock(&napi_hash_lock);
 
+	/* Keep the NAPI ID of the previous NAPI for this config, so that
+	 * applications tracking it do not notice the re-creation.
+	 */
+	if (napi->config && napi->config->napi_id &&
+	    !napi_by_id(napi->config->napi_id)) {
+		napi->napi_id = napi->config->napi_id;
+		goto add;
+	}
+
 	/* 0..NR_CPUS range is reserved for sender_cpu use */
 	do {
 		if (unlikely(++napi_gen_id < MIN_NAPI_ID))
 			napi_gen_id = MIN_NAPI_ID;
 	} while (napi_by_id(napi_gen_id));
 	napi->napi_id = napi_gen_id;
-
+	if (napi->config)
+		napi->config->napi_id = napi->napi_id;
+add:
 	hlist_add_head_rcu(&napi->napi_hash_node,
 			   &napi_hash[napi->napi_id % HASH_SIZE(napi_hash)]);
 
@@ -6342,6 +6494,9 @@ static enum hrtimer_restart napi_watchdog(struct hrtimer *timer)
 
 	napi = container_of(timer, struct napi_struct, timer);
 
+	/* the application stopped polling without resuming the IRQs */
+	clear_bit(NAPI_STATE_IRQ_SUSPENDED, &napi->state);
+
 	/* Note : we use a relaxed variant of napi_schedule_prep() not setting
 	 * NAPI_STATE_MISSED, since we do not react to a device IRQ.
 	 */
@@ -6462,6 +6617,19 @@ void netif_napi_add_weight(struct net_device *dev, struct napi_struct *napi,
 				weight);
 	napi->weight = weight;
 	napi->dev = dev;
+	if (napi->config) {
+		napi_set_defer_hard_irqs(napi, napi->config->defer_hard_irqs);
+		napi_set_gro_flush_timeout(napi, napi->config->gro_flush_timeout);
+		napi_set_irq_suspend_timeout(napi,
+					     napi->config->irq_suspend_timeout);
+	} else {
+		napi->index = -1;
+		napi_set_defer_hard_irqs(napi,
+					 READ_ONCE(dev->napi_defer_hard_irqs));
+		napi_set_gro_flush_timeout(napi,
+					   READ_ONCE(dev->gro_flush_timeout));
+		napi_set_irq_suspend_timeout(napi, 0);
+	}
 #ifdef CONFIG_NETPOLL
 	napi->poll_owner = -1;
 #endif
@@ -6496,7 +6664,8 @@ void napi_disable(struct napi_struct *n)
 		}
 
 		new = val | NAPIF_STATE_SCHED | NAPIF_STATE_NPSVC;
-		new &= ~(NAPIF_STATE_THREADED | NAPIF_STATE_PREFER_BUSY_POLL);
+		new &= ~(NAPIF_STATE_THREADED | NAPIF_STATE_PREFER_BUSY_POLL |
+			 NAPIF_STATE_IRQ_SUSPENDED);
 	} while (!try_cmpxchg(&n->state, &val, new));
 
 	hrtimer_cancel(&n->timer);
@@ -6545,6 +6714,16 @@ void __netif_napi_del(struct napi_struct *napi)
 	if (!test_and_clear_bit(NAPI_STATE_LISTED, &napi->state))
 		return;
 
+	if (napi->config) {
+		napi->config->defer_hard_irqs = napi_get_defer_hard_irqs(napi);
+		napi->config->gro_flush_timeout =
+			napi_get_gro_flush_timeout(napi);
+		napi->config->irq_suspend_timeout =
+			napi_get_irq_suspend_timeout(napi);
+		napi->config = NULL;
+		napi->index = -1;
+	}
+
 	napi_hash_del(napi);
 	list_del_rcu(&napi->dev_list);
 	napi_free_frags(napi);
@@ -10748,12 +10927,61 @@ void netdev_sw_irq_coalesce_default_on(struct net_device *dev)
 	WARN_ON(dev->reg_state == NETREG_REGISTERED);
 
 	if (!IS_ENABLED(CONFIG_PREEMPT_RT)) {
-		dev->gro_flush_timeout = 20000;
-		dev->napi_defer_hard_irqs = 1;
+		netdev_set_gro_flush_timeout(dev, 20000);
+		netdev_set_defer_hard_irqs(dev, 1);
 	}
 }
 EXPORT_SYMBOL_GPL(netdev_sw_irq_coalesce_default_on);
 
+static unsigned int netdev_napi_config_count(const struct net_device *dev)
+{
+	return max(dev->num_rx_queues, dev->num_tx_queues);
+}
+
+/**
+ * netdev_set_defer_hard_irqs() - set the IRQ deferral of all NAPIs
+ * @netdev: network device
+ * @defer: number of polls to defer the hard IRQs for
+ *
+ * Sets the device default as well as the value of every NAPI and every
+ * persistent NAPI config of @netdev, overriding per NAPI settings.
+ */
+void netdev_set_defer_hard_irqs(struct net_device *netdev, u32 defer)
+{
+	struct napi_struct *napi;
+	unsigned int i;
+
+	WRITE_ONCE(netdev->napi_defer_hard_irqs, defer);
+
+	list_for_each_entry(napi, &netdev->napi_list, dev_list)
+		napi_set_defer_hard_irqs(napi, defer);
+
+	for (i = 0; i < netdev_napi_config_count(netdev); i++)
+		netdev->napi_config[i].defer_hard_irqs = defer;
+}
+
+/**
+ * netdev_set_gro_flush_timeout() - set the GRO flush timeout of all NAPIs
+ * @netdev: network device
+ * @timeout: timeout in nanoseconds
+ *
+ * Like netdev_set_defer_hard_irqs(), for the GRO flush timeout.
+ */
+void netdev_set_gro_flush_timeout(struct net_device *netdev,
+				  unsigned long timeout)
+{
+	struct napi_struct *napi;
+	unsigned int i;
+
+	WRITE_ONCE(netdev->gro_flush_timeout, timeout);
+
+	list_for_each_entry(napi, &netdev->napi_list, dev_list)
+		napi_set_gro_flush_timeout(napi, timeout);
+
+	for (i = 0; i < netdev_napi_config_count(netdev); i++)
+		netdev->napi_config[i].gro_flush_timeout = timeout;
+}
+
 void netdev_freemem(struct net_device *dev)
 {
 	char *addr = (char *)dev - dev->padded;
@@ -10874,6 +11102,12 @@ struct net_device *alloc_netdev_mqs(int sizeof_priv, const char *name,
 	if (netif_alloc_rx_queues(dev))
 		goto free_all;
 
+	dev->napi_config = kvcalloc(max(txqs, rxqs),
+				    sizeof(*dev->napi_config),
+				    GFP_KERNEL_ACCOUNT);
+	if (!dev->napi_config)
+		goto free_all;
+
 	strcpy(dev->name, name);
 	dev->name_assign_type = name_assign_type;
 	dev->group = INIT_NETDEV_GROUP;
@@ -10934,6 +11168,9 @@ void free_netdev(struct net_device *dev)
 	list_for_each_entry_safe(p, n, &dev->napi_list, dev_list)
 		netif_napi_del(p);
 
+	kvfree(dev->napi_config);
+	dev->napi_config = NULL;
+
 	ref_tracker_dir_exit(&dev->refcnt_tracker);
 #ifdef CONFIG_PCPU_DEV_REFCNT
 	free_percpu(dev->pcpu_refcnt);
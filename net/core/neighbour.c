@@ -62,10 +62,17 @@ static const struct seq_operations neigh_stat_seq_ops;
 #endif
 
 /*
-   Neighbour hash table buckets are protected with rwlock tbl->lock.
-
-   - All the scans/updates to hash buckets MUST be made under this lock.
-   - NOTHING clever should be made under this lock: no callbacks
+   Neighbour hash table buckets are protected with rwlock tbl->lock
+   and the hashed bucket spinlocks tbl->hash_locks.
+
+   - Lookups are lockless under RCU.
+   - Insertion and garbage collection hold tbl->lock for reading and
+     the lock of the bucket they modify.  gc_list and managed_list are
+     protected by tbl->gc_lock, which nests inside the bucket lock and
+     neigh->lock.
+   - Resizing, flushing and the rare control path updates hold
+     tbl->lock for writing, which excludes all of the above.
+   - NOTHING clever should be made under these locks: no callbacks
      to protocol backends, no attempts to send something to network.
      It will result in deadlocks, if backend/driver wants to use neighbour
      cache.
@@ -115,8 +122,40 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 }
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
-static void neigh_mark_dead(struct neighbour *n)
+static u32 neigh_hash_bucket(struct neigh_table *tbl,
+			     struct neigh_hash_table *nht,
+			     const void *pkey, const struct net_device *dev)
+{
+	return tbl->hash(pkey, dev, nht->hash_rnd) >> (32 - nht->hash_shift);
+}
+
+static spinlock_t *neigh_bucket_lock(struct neigh_table *tbl, u32 hash_val)
+{
+	return &tbl->hash_locks[hash_val & tbl->hash_locks_mask];
+}
+
+/* Must be called with tbl->lock held for reading and BH disabled. */
+static spinlock_t *neigh_lock_bucket(struct neigh_table *tbl, u32 hash_val)
+{
+	spinlock_t *lock = neigh_bucket_lock(tbl, hash_val);
+
+	if (!spin_trylock(lock)) {
+		NEIGH_CACHE_STAT_INC(tbl, lock_waits);
+		spin_lock(lock);
+	}
+	return lock;
+}
+
+static void neigh_gc_time_add(struct neigh_table *tbl, u64 start)
+{
+	NEIGH_CACHE_STAT_ADD(tbl, gc_time,
+			     div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
+}
+
+static void __neigh_mark_dead(struct neighbour *n)
 {
+	lockdep_assert_held(&n->tbl->gc_lock);
+
 	n->dead = 1;
 	if (!list_empty(&n->gc_list)) {
 		list_del_init(&n->gc_list);
@@ -126,12 +165,20 @@ static void neigh_mark_dead(struct neighbour *n)
 		list_del_init(&n->managed_list);
 }
 
+static void neigh_mark_dead(struct neighbour *n)
+{
+	spin_lock(&n->tbl->gc_lock);
+	__neigh_mark_dead(n);
+	spin_unlock(&n->tbl->gc_lock);
+}
+
 static void neigh_update_gc_list(struct neighbour *n)
 {
 	bool on_gc_list, exempt_from_gc;
 
-	write_lock_bh(&n->tbl->lock);
+	read_lock_bh(&n->tbl->lock);
 	write_lock(&n->lock);
+	spin_lock(&n->tbl->gc_lock);
 	if (n->dead)
 		goto out;
 
@@ -151,16 +198,18 @@ static void neigh_update_gc_list(struct neighbour *n)
 		atomic_inc(&n->tbl->gc_entries);
 	}
 out:
+	spin_unlock(&n->tbl->gc_lock);
 	write_unlock(&n->lock);
-	write_unlock_bh(&n->tbl->lock);
+	read_unlock_bh(&n->tbl->lock);
 }
 
 static void neigh_update_managed_list(struct neighbour *n)
 {
 	bool on_managed_list, add_to_managed;
 
-	write_lock_bh(&n->tbl->lock);
+	read_lock_bh(&n->tbl->lock);
 	write_lock(&n->lock);
+	spin_lock(&n->tbl->gc_lock);
 	if (n->dead)
 		goto out;
 
@@ -172,8 +221,9 @@ static void neigh_update_managed_list(struct neighbour *n)
 	else if (add_to_managed && !on_managed_list)
 		list_add_tail(&n->managed_list, &n->tbl->managed_list);
 out:
+	spin_unlock(&n->tbl->gc_lock);
 	write_unlock(&n->lock);
-	write_unlock_bh(&n->tbl->lock);
+	read_unlock_bh(&n->tbl->lock);
 }
 
 static void neigh_update_flags(struct neighbour *neigh, u32 flags, int *notify,
@@ -236,8 +286,7 @@ bool neigh_remove_one(struct neighbour *ndel, struct neigh_table *tbl)
 
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
-	hash_val = tbl->hash(pkey, ndel->dev, nht->hash_rnd);
-	hash_val = hash_val >> (32 - nht->hash_shift);
+	hash_val = neigh_hash_bucket(tbl, nht, pkey, ndel->dev);
 
 	np = &nht->hash_buckets[hash_val];
 	while ((n = rcu_dereference_protected(*np,
@@ -249,35 +298,84 @@ bool neigh_remove_one(struct neighbour *ndel, struct neigh_table *tbl)
 	return false;
 }
 
+/* Unlink @n from its hash chain if it is stale.  tbl->gc_lock is held,
+ * which nests inside the bucket lock and n->lock, so both can only be
+ * trylocked; a busy entry is simply left for the next run.
+ */
+static bool neigh_forced_gc_one(struct neigh_table *tbl,
+				struct neigh_hash_table *nht,
+				struct neighbour *n, unsigned long tref)
+{
+	struct neighbour __rcu **np;
+	struct neighbour *n1;
+	bool removed = false;
+	spinlock_t *lock;
+	u32 hash_val;
+
+	hash_val = neigh_hash_bucket(tbl, nht, n->primary_key, n->dev);
+	lock = neigh_bucket_lock(tbl, hash_val);
+	if (!spin_trylock(lock)) {
+		NEIGH_CACHE_STAT_INC(tbl, lock_waits);
+		return false;
+	}
+	if (!write_trylock(&n->lock))
+		goto unlock;
+
+	if (refcount_read(&n->refcnt) != 1)
+		goto unlock_neigh;
+
+	if ((n->nud_state != NUD_FAILED) &&
+	    (n->nud_state != NUD_NOARP) &&
+	    !(tbl->is_multicast && tbl->is_multicast(n->primary_key)) &&
+	    time_in_range(n->updated, tref, jiffies))
+		goto unlock_neigh;
+
+	np = &nht->hash_buckets[hash_val];
+	while ((n1 = rcu_dereference_protected(*np, lockdep_is_held(lock)))) {
+		if (n1 == n) {
+			rcu_assign_pointer(*np,
+				rcu_dereference_protected(n->next,
+							  lockdep_is_held(lock)));
+			__neigh_mark_dead(n);
+			removed = true;
+			break;
+		}
+		np = &n1->next;
+	}
+
+unlock_neigh:
+	write_unlock(&n->lock);
+unlock:
+	spin_unlock(lock);
+	return removed;
+}
+
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
 	int max_clean = atomic_read(&tbl->gc_entries) -
 			READ_ONCE(tbl->gc_thresh2);
-	u64 tmax = ktime_get_ns() + NSEC_PER_MSEC;
+	u64 start = ktime_get_ns(), tmax = start + NSEC_PER_MSEC;
 	unsigned long tref = jiffies - 5 * HZ;
+	struct neigh_hash_table *nht;
 	struct neighbour *n, *tmp;
+	LIST_HEAD(dispose);
 	int shrunk = 0;
 	int loop = 0;
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
-	write_lock_bh(&tbl->lock);
+	read_lock_bh(&tbl->lock);
+	nht = rcu_dereference_protected(tbl->nht,
+					lockdep_is_held(&tbl->lock));
+	spin_lock(&tbl->gc_lock);
 
 	list_for_each_entry_safe(n, tmp, &tbl->gc_list, gc_list) {
 		if (refcount_read(&n->refcnt) == 1) {
-			bool remove = false;
-
-			write_lock(&n->lock);
-			if ((n->nud_state == NUD_FAILED) ||
-			    (n->nud_state == NUD_NOARP) ||
-			    (tbl->is_multicast &&
-			     tbl->is_multicast(n->primary_key)) ||
-			    !time_in_range(n->updated, tref, jiffies))
-				remove = true;
-			write_unlock(&n->lock);
-
-			if (remove && neigh_remove_one(n, tbl))
+			if (neigh_forced_gc_one(tbl, nht, n, tref)) {
+				/* Dead entries are off gc_list for good. */
+				list_add(&n->gc_list, &dispose);
 				shrunk++;
+			}
 			if (shrunk >= max_clean)
 				break;
 			if (++loop == 16) {
@@ -290,7 +388,15 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 
 	WRITE_ONCE(tbl->last_flush, jiffies);
 unlock:
-	write_unlock_bh(&tbl->lock);
+	spin_unlock(&tbl->gc_lock);
+	read_unlock_bh(&tbl->lock);
+
+	list_for_each_entry_safe(n, tmp, &dispose, gc_list) {
+		list_del_init(&n->gc_list);
+		neigh_cleanup_and_release(n);
+	}
+
+	neigh_gc_time_add(tbl, start);
 
 	return shrunk;
 }
@@ -615,6 +721,29 @@ static struct neigh_hash_table *neigh_hash_grow(struct neigh_table *tbl,
 	return new_nht;
 }
 
+/* Resizing needs tbl->lock for writing, so do it before an insertion
+ * rather than under the bucket lock.
+ */
+static void neigh_hash_maybe_grow(struct neigh_table *tbl)
+{
+	struct neigh_hash_table *nht;
+	unsigned int shift;
+
+	rcu_read_lock();
+	shift = rcu_dereference(tbl->nht)->hash_shift;
+	rcu_read_unlock();
+
+	if (atomic_read(&tbl->entries) <= (1 << shift))
+		return;
+
+	write_lock_bh(&tbl->lock);
+	nht = rcu_dereference_protected(tbl->nht,
+					lockdep_is_held(&tbl->lock));
+	if (atomic_read(&tbl->entries) > (1 << nht->hash_shift))
+		neigh_hash_grow(tbl, nht->hash_shift + 1);
+	write_unlock_bh(&tbl->lock);
+}
+
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 			       struct net_device *dev)
 {
@@ -643,6 +772,7 @@ ___neigh_create(struct neigh_table *tbl, const void *pkey,
 	u32 hash_val, key_len = tbl->key_len;
 	struct neighbour *n1, *rc, *n;
 	struct neigh_hash_table *nht;
+	spinlock_t *lock;
 	int error;
 
 	n = neigh_alloc(tbl, dev, flags, exempt_from_gc);
@@ -679,14 +809,14 @@ ___neigh_create(struct neigh_table *tbl, const void *pkey,
 
 	n->confirmed = jiffies - (NEIGH_VAR(n->parms, BASE_REACHABLE_TIME) << 1);
 
-	write_lock_bh(&tbl->lock);
+	neigh_hash_maybe_grow(tbl);
+
+	read_lock_bh(&tbl->lock);
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
 
-	if (atomic_read(&tbl->entries) > (1 << nht->hash_shift))
-		nht = neigh_hash_grow(tbl, nht->hash_shift + 1);
-
-	hash_val = tbl->hash(n->primary_key, dev, nht->hash_rnd) >> (32 - nht->hash_shift);
+	hash_val = neigh_hash_bucket(tbl, nht, n->primary_key, dev);
+	lock = neigh_lock_bucket(tbl, hash_val);
 
 	if (n->parms->dead) {
 		rc = ERR_PTR(-EINVAL);
@@ -694,10 +824,10 @@ ___neigh_create(struct neigh_table *tbl, const void *pkey,
 	}
 
 	for (n1 = rcu_dereference_protected(nht->hash_buckets[hash_val],
-					    lockdep_is_held(&tbl->lock));
+					    lockdep_is_held(lock));
 	     n1 != NULL;
 	     n1 = rcu_dereference_protected(n1->next,
-			lockdep_is_held(&tbl->lock))) {
+			lockdep_is_held(lock))) {
 		if (dev == n1->dev && !memcmp(n1->primary_key, n->primary_key, key_len)) {
 			if (want_ref)
 				neigh_hold(n1);
@@ -707,23 +837,27 @@ ___neigh_create(struct neigh_table *tbl, const void *pkey,
 	}
 
 	n->dead = 0;
+	spin_lock(&tbl->gc_lock);
 	if (!exempt_from_gc)
 		list_add_tail(&n->gc_list, &n->tbl->gc_list);
 	if (n->flags & NTF_MANAGED)
 		list_add_tail(&n->managed_list, &n->tbl->managed_list);
+	spin_unlock(&tbl->gc_lock);
 	if (want_ref)
 		neigh_hold(n);
 	rcu_assign_pointer(n->next,
 			   rcu_dereference_protected(nht->hash_buckets[hash_val],
-						     lockdep_is_held(&tbl->lock)));
+						     lockdep_is_held(lock)));
 	rcu_assign_pointer(nht->hash_buckets[hash_val], n);
-	write_unlock_bh(&tbl->lock);
+	spin_unlock(lock);
+	read_unlock_bh(&tbl->lock);
 	neigh_dbg(2, "neigh %p is created\n", n);
 	rc = n;
 out:
 	return rc;
 out_tbl_unlock:
-	write_unlock_bh(&tbl->lock);
+	spin_unlock(lock);
+	read_unlock_bh(&tbl->lock);
 out_neigh_release:
 	if (!exempt_from_gc)
 		atomic_dec(&tbl->gc_entries);
@@ -943,24 +1077,27 @@ static void neigh_connect(struct neighbour *neigh)
 	WRITE_ONCE(neigh->output, neigh->ops->connected_output);
 }
 
+/* Hash buckets scanned by one run of the periodic GC */
+#define NEIGH_GC_SLICE	1024
+
 static void neigh_periodic_work(struct work_struct *work)
 {
 	struct neigh_table *tbl = container_of(work, struct neigh_table, gc_work.work);
+	unsigned long delay = NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1;
+	u64 start = ktime_get_ns();
 	struct neighbour *n;
 	struct neighbour __rcu **np;
-	unsigned int i;
+	unsigned int i, budget;
 	struct neigh_hash_table *nht;
+	spinlock_t *lock;
 
 	NEIGH_CACHE_STAT_INC(tbl, periodic_gc_runs);
 
-	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-
 	/*
 	 *	periodically recompute ReachableTime from random function
 	 */
 
+	read_lock_bh(&tbl->lock);
 	if (time_after(jiffies, tbl->last_rand + 300 * HZ)) {
 		struct neigh_parms *p;
 
@@ -969,15 +1106,37 @@ static void neigh_periodic_work(struct work_struct *work)
 			p->reachable_time =
 				neigh_rand_reach_time(NEIGH_VAR(p, BASE_REACHABLE_TIME));
 	}
+	read_unlock_bh(&tbl->lock);
 
-	if (atomic_read(&tbl->entries) < READ_ONCE(tbl->gc_thresh1))
+	if (atomic_read(&tbl->entries) < READ_ONCE(tbl->gc_thresh1)) {
+		tbl->gc_bucket = 0;
 		goto out;
+	}
 
-	for (i = 0 ; i < (1 << nht->hash_shift); i++) {
+	/* Only a slice of the table is scanned per run, one bucket lock at
+	 * a time, so that creation of new entries is never held up by a
+	 * walk of the whole table.
+	 */
+	for (budget = NEIGH_GC_SLICE; budget; budget--) {
+		read_lock_bh(&tbl->lock);
+		nht = rcu_dereference_protected(tbl->nht,
+						lockdep_is_held(&tbl->lock));
+
+		/* The table may have grown since the previous run; the pass
+		 * then just ends at the new size.
+		 */
+		i = tbl->gc_bucket;
+		if (i >= (1 << nht->hash_shift)) {
+			read_unlock_bh(&tbl->lock);
+			tbl->gc_bucket = 0;
+			goto out;
+		}
+
+		lock = neigh_lock_bucket(tbl, i);
 		np = &nht->hash_buckets[i];
 
 		while ((n = rcu_dereference_protected(*np,
-				lockdep_is_held(&tbl->lock))) != NULL) {
+				lockdep_is_held(lock))) != NULL) {
 			unsigned int state;
 
 			write_lock(&n->lock);
@@ -999,7 +1158,7 @@ static void neigh_periodic_work(struct work_struct *work)
 						 n->used + NEIGH_VAR(n->parms, GC_STALETIME)))) {
 				rcu_assign_pointer(*np,
 					rcu_dereference_protected(n->next,
-						lockdep_is_held(&tbl->lock)));
+						lockdep_is_held(lock)));
 				neigh_mark_dead(n);
 				write_unlock(&n->lock);
 				neigh_cleanup_and_release(n);
@@ -1014,20 +1173,22 @@ static void neigh_periodic_work(struct work_struct *work)
 		 * It's fine to release lock here, even if hash table
 		 * grows while we are preempted.
 		 */
-		write_unlock_bh(&tbl->lock);
+		spin_unlock(lock);
+		read_unlock_bh(&tbl->lock);
+		tbl->gc_bucket = i + 1;
 		cond_resched();
-		write_lock_bh(&tbl->lock);
-		nht = rcu_dereference_protected(tbl->nht,
-						lockdep_is_held(&tbl->lock));
 	}
+
+	/* The pass is not over yet, go on with the next slice. */
+	delay = 1;
 out:
+	neigh_gc_time_add(tbl, start);
+
 	/* Cycle through all hash buckets every BASE_REACHABLE_TIME/2 ticks.
 	 * ARP entry timeouts range from 1/2 BASE_REACHABLE_TIME to 3/2
 	 * BASE_REACHABLE_TIME.
 	 */
-	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
-			      NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1);
-	write_unlock_bh(&tbl->lock);
+	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work, delay);
 }
 
 static __inline__ int neigh_max_probes(struct neighbour *n)
@@ -1812,6 +1973,10 @@ void neigh_table_init(int index, struct neigh_table *tbl)
 		WARN_ON(tbl->entry_size % NEIGH_PRIV_ALIGN);
 
 	rwlock_init(&tbl->lock);
+	spin_lock_init(&tbl->gc_lock);
+	if (alloc_bucket_spinlocks(&tbl->hash_locks, &tbl->hash_locks_mask,
+				   1024, 16, GFP_KERNEL))
+		panic("cannot allocate neighbour cache hash locks");
 
 	INIT_DEFERRABLE_WORK(&tbl->gc_work, neigh_periodic_work);
 	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
@@ -1849,6 +2014,9 @@ int neigh_table_clear(int index, struct neigh_table *tbl)
 	kfree(tbl->phash_buckets);
 	tbl->phash_buckets = NULL;
 
+	free_bucket_spinlocks(tbl->hash_locks);
+	tbl->hash_locks = NULL;
+
 	remove_proc_entry(tbl->id, init_net.proc_net_stat);
 
 	free_percpu(tbl->stats);
@@ -3466,13 +3634,14 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 	struct neigh_statistics *st = v;
 
 	if (v == SEQ_START_TOKEN) {
-		seq_puts(seq, "entries  allocs   destroys hash_grows lookups  hits     res_failed rcv_probes_mcast rcv_probes_ucast periodic_gc_runs forced_gc_runs unresolved_discards table_fulls\n");
+		seq_puts(seq, "entries  allocs   destroys hash_grows lookups  hits     res_failed rcv_probes_mcast rcv_probes_ucast periodic_gc_runs forced_gc_runs unresolved_discards table_fulls gc_time  lock_waits\n");
 		return 0;
 	}
 
 	seq_printf(seq, "%08x %08lx %08lx %08lx   %08lx %08lx %08lx   "
 			"%08lx         %08lx         %08lx         "
-			"%08lx       %08lx            %08lx\n",
+			"%08lx       %08lx            %08lx    "
+			"%08lx %08lx\n",
 		   atomic_read(&tbl->entries),
 
 		   st->allocs,
@@ -3490,7 +3659,9 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 		   st->periodic_gc_runs,
 		   st->forced_gc_runs,
 		   st->unres_discards,
-		   st->table_fulls
+		   st->table_fulls,
+		   st->gc_time,
+		   st->lock_waits
 		   );
 
 	return 0;
@@ -190,6 +190,14 @@ netdev_nl_napi_fill_one(struct sk_buff *rsp, struct napi_struct *napi,
 			goto nla_put_failure;
 	}
 
+	if (nla_put_u32(rsp, NETDEV_A_NAPI_DEFER_HARD_IRQS,
+			napi_get_defer_hard_irqs(napi)) ||
+	    nla_put_uint(rsp, NETDEV_A_NAPI_GRO_FLUSH_TIMEOUT,
+			 napi_get_gro_flush_timeout(napi)) ||
+	    nla_put_uint(rsp, NETDEV_A_NAPI_IRQ_SUSPEND_TIMEOUT,
+			 napi_get_irq_suspend_timeout(napi)))
+		goto nla_put_failure;
+
 	genlmsg_end(rsp, hdr);
 
 	return 0;
@@ -293,6 +301,48 @@ int netdev_nl_napi_get_dumpit(struct sk_buff *skb, struct netlink_callback *cb)
 	return skb->len;
 }
 
+static void
+netdev_nl_napi_set_config(struct napi_struct *napi, struct genl_info *info)
+{
+	if (info->attrs[NETDEV_A_NAPI_DEFER_HARD_IRQS])
+		napi_set_defer_hard_irqs(napi,
+			nla_get_u32(info->attrs[NETDEV_A_NAPI_DEFER_HARD_IRQS]));
+
+	if (info->attrs[NETDEV_A_NAPI_GRO_FLUSH_TIMEOUT])
+		napi_set_gro_flush_timeout(napi,
+			nla_get_uint(info->attrs[NETDEV_A_NAPI_GRO_FLUSH_TIMEOUT]));
+
+	if (info->attrs[NETDEV_A_NAPI_IRQ_SUSPEND_TIMEOUT])
+		napi_set_irq_suspend_timeout(napi,
+			nla_get_uint(info->attrs[NETDEV_A_NAPI_IRQ_SUSPEND_TIMEOUT]));
+}
+
+int netdev_nl_napi_set_doit(struct sk_buff *skb, struct genl_info *info)
+{
+	struct napi_struct *napi;
+	u32 napi_id;
+	int err = 0;
+
+	if (GENL_REQ_ATTR_CHECK(info, NETDEV_A_NAPI_ID))
+		return -EINVAL;
+
+	napi_id = nla_get_u32(info->attrs[NETDEV_A_NAPI_ID]);
+
+	rtnl_lock();
+
+	napi = napi_by_id(napi_id);
+	if (napi && dev_net(napi->dev) == genl_info_net(info)) {
+		netdev_nl_napi_set_config(napi, info);
+	} else {
+		NL_SET_BAD_ATTR(info->extack, info->attrs[NETDEV_A_NAPI_ID]);
+		err = -ENOENT;
+	}
+
+	rtnl_unlock();
+
+	return err;
+}
+
 static int
 netdev_nl_queue_fill_one(struct sk_buff *rsp, struct net_device *netdev,
 			 u32 q_idx, u32 q_type, const struct genl_info *info)
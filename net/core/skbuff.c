@@ -683,6 +683,52 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/**
+ *	alloc_skb_bulk - allocate several network buffers at once
+ *	@skbs: array filled with the new buffers
+ *	@sizes: size of the linear data area of each buffer
+ *	@n: number of buffers wanted
+ *	@gfp_mask: allocation mask
+ *
+ *	Equivalent to calling alloc_skb() @n times, except that all the heads
+ *	come from a single bulk request to the skbuff cache. The buffers are
+ *	allocated in order and the first failure ends the batch.
+ *
+ *	Returns the number of buffers stored in @skbs.
+ */
+unsigned int alloc_skb_bulk(struct sk_buff **skbs, const unsigned int *sizes,
+			    unsigned int n, gfp_t gfp_mask)
+{
+	unsigned int i;
+
+	if (!kmem_cache_alloc_bulk(skbuff_cache, gfp_mask & ~GFP_DMA, n,
+				   (void **)skbs))
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		struct sk_buff *skb = skbs[i];
+		unsigned int size = sizes[i];
+		bool pfmemalloc;
+		u8 *data;
+
+		data = kmalloc_reserve(&size, gfp_mask, NUMA_NO_NODE,
+				       &pfmemalloc);
+		if (unlikely(!data)) {
+			kmem_cache_free_bulk(skbuff_cache, n - i,
+					     (void **)&skbs[i]);
+			break;
+		}
+		prefetchw(data + SKB_WITH_OVERHEAD(size));
+
+		memset(skb, 0, offsetof(struct sk_buff, tail));
+		__build_skb_around(skb, data, size);
+		skb->pfmemalloc = pfmemalloc;
+	}
+
+	return i;
+}
+EXPORT_SYMBOL(alloc_skb_bulk);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -4879,7 +4925,8 @@ static void skb_extensions_init(void) {}
 
 /* The SKB kmem_cache slab is critical for network performance.  Never
  * merge/alias the slab with similar sized objects.  This avoids fragmentation
- * that hurts performance of kmem_cache_{alloc,free}_bulk APIs.
+ * that hurts performance of kmem_cache_{alloc,free}_bulk APIs.  The per-cpu
+ * sheaves also absorb skbs allocated on one CPU and freed on another.
  */
 #ifndef CONFIG_SLUB_TINY
 #define FLAG_SKB_NO_MERGE	SLAB_NO_MERGE
@@ -4893,7 +4940,8 @@ void __init skb_init(void)
 					      sizeof(struct sk_buff),
 					      0,
 					      SLAB_HWCACHE_ALIGN|SLAB_PANIC|
-						FLAG_SKB_NO_MERGE,
+						FLAG_SKB_NO_MERGE|
+						SLAB_PERCPU_SHEAVES,
 					      offsetof(struct sk_buff, cb),
 					      sizeof_field(struct sk_buff, cb),
 					      NULL);
@@ -1279,6 +1279,8 @@ static void __exit dccp_fini(void)
 		   get_order((dccp_hashinfo.ehash_mask + 1) *
 			     sizeof(struct inet_ehash_bucket)));
 	inet_ehash_locks_free(&dccp_hashinfo);
+	/* Wait for inet_bind_bucket_destroy() callbacks. */
+	rcu_barrier();
 	kmem_cache_destroy(dccp_hashinfo.bind_bucket_cachep);
 	dccp_ackvec_exit();
 	dccp_sysctl_exit();
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Lookup benchmark for the DXR in front of the IPv4 FIB trie.
+ *
+ * Random destinations are looked up in one routing table of the loading
+ * network namespace, first by walking the trie and then through the DXR.
+ * Both passes have to agree on every result, and the time per lookup of
+ * each is reported.  Load it after populating the table, e.g. with a full
+ * BGP feed, and unload it again; the module never stays loaded.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/nsproxy.h>
+#include <linux/random.h>
+#include <linux/rtnetlink.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <net/ip_fib.h>
+#include <net/net_namespace.h>
+
+static unsigned int nr_lookups = 1 << 18;
+module_param(nr_lookups, uint, 0444);
+MODULE_PARM_DESC(nr_lookups, "number of random destinations");
+
+static unsigned int table = RT_TABLE_MAIN;
+module_param(table, uint, 0444);
+MODULE_PARM_DESC(table, "routing table to look up");
+
+#define BATCH	1024
+
+struct dxr_bench_result {
+	struct fib_info		*fi;
+	int			err;
+	unsigned char		prefixlen;
+	unsigned char		type;
+};
+
+static u64 __init dxr_bench_run(struct fib_table *tb, const __be32 *daddr,
+				struct dxr_bench_result *res)
+{
+	u64 elapsed = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < nr_lookups; i += BATCH) {
+		unsigned int n = min(nr_lookups - i, BATCH);
+		ktime_t start;
+
+		rcu_read_lock();
+		start = ktime_get();
+		for (j = i; j < i + n; j++) {
+			struct flowi4 fl4 = {
+				.daddr = daddr[j],
+			};
+			struct fib_result r = {};
+
+			res[j].err = fib_table_lookup(tb, &fl4, &r,
+						      FIB_LOOKUP_NOREF);
+			res[j].fi = r.fi;
+			res[j].prefixlen = r.prefixlen;
+			res[j].type = r.type;
+		}
+		elapsed += ktime_to_ns(ktime_sub(ktime_get(), start));
+		rcu_read_unlock();
+
+		cond_resched();
+	}
+
+	return elapsed;
+}
+
+static int __init fib_dxr_benchmark_init(void)
+{
+	struct net *net = current->nsproxy->net_ns;
+	bool enabled = static_key_enabled(&fib_dxr_key);
+	struct dxr_bench_result *trie, *dxr;
+	unsigned int i, mismatches = 0;
+	u64 trie_ns, dxr_ns;
+	struct fib_table *tb;
+	__be32 *daddr;
+	int err = -ENOMEM;
+
+	if (!nr_lookups)
+		return -EINVAL;
+
+	rtnl_lock();
+	tb = fib_new_table(net, table);
+	rtnl_unlock();
+	if (!tb)
+		return -ENOENT;
+
+	daddr = vmalloc_array(nr_lookups, sizeof(*daddr));
+	trie = vmalloc_array(nr_lookups, sizeof(*trie));
+	dxr = vmalloc_array(nr_lookups, sizeof(*dxr));
+	if (!daddr || !trie || !dxr)
+		goto out;
+
+	get_random_bytes(daddr, nr_lookups * sizeof(*daddr));
+
+	fib_dxr_set_enabled(false);
+	trie_ns = dxr_bench_run(tb, daddr, trie);
+
+	/* the first lookup requests the build, wait for it */
+	fib_dxr_set_enabled(true);
+	dxr_bench_run(tb, daddr, dxr);
+	fib_dxr_flush();
+	dxr_ns = dxr_bench_run(tb, daddr, dxr);
+
+	for (i = 0; i < nr_lookups; i++) {
+		if (trie[i].err == dxr[i].err &&
+		    (trie[i].err ||
+		     (trie[i].fi == dxr[i].fi &&
+		      trie[i].prefixlen == dxr[i].prefixlen &&
+		      trie[i].type == dxr[i].type)))
+			continue;
+
+		if (!mismatches++)
+			pr_err("%pI4: trie %d/%u, dxr %d/%u\n", &daddr[i],
+			       trie[i].err, trie[i].prefixlen,
+			       dxr[i].err, dxr[i].prefixlen);
+	}
+
+	pr_info("table %u, %u lookups: trie %llu ns, dxr %llu ns per lookup, %u mismatches\n",
+		table, nr_lookups, div_u64(trie_ns, nr_lookups),
+		div_u64(dxr_ns, nr_lookups), mismatches);
+
+	fib_dxr_set_enabled(enabled);
+	err = mismatches ? -EINVAL : -EAGAIN;
+out:
+	vfree(daddr);
+	vfree(trie);
+	vfree(dxr);
+
+	/* Fail will directly unload the module */
+	return err;
+}
+module_init(fib_dxr_benchmark_init);
+
+MODULE_DESCRIPTION("IPv4 FIB DXR lookup benchmark");
+MODULE_LICENSE("GPL");
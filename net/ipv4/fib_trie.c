@@ -38,6 +38,7 @@
 #include <linux/cache.h>
 #include <linux/uaccess.h>
 #include <linux/bitops.h>
+#include <linux/bitmap.h>
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
@@ -48,6 +49,7 @@
 #include <linux/in.h>
 #include <linux/inet.h>
 #include <linux/inetdevice.h>
+#include <linux/jump_label.h>
 #include <linux/netdevice.h>
 #include <linux/if_arp.h>
 #include <linux/proc_fs.h>
@@ -61,6 +63,7 @@
 #include <linux/export.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include <net/net_namespace.h>
 #include <net/inet_dscp.h>
 #include <net/ip.h>
@@ -169,6 +172,12 @@ struct trie {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie_use_stats __percpu *stats;
 #endif
+#ifdef CONFIG_IP_FIB_DXR
+	struct fib_dxr __rcu *dxr;
+	struct list_head dxr_pending;
+	struct list_head dxr_list;
+	unsigned long dxr_flags;
+#endif
 };
 
 static struct key_vector *resize(struct trie *t, struct key_vector *tn);
@@ -1107,6 +1116,465 @@ static void trie_rebalance(struct trie *t, struct key_vector *tn)
 		tn = resize(t, tn);
 }
 
+#ifdef CONFIG_IP_FIB_DXR
+/* DXR: a read-mostly range table in front of the trie
+ *
+ * The address space is cut into 2^16 chunks on the upper 16 bits of the
+ * key.  Every chunk is described by a sorted run of ranges on the lower
+ * 16 bits, each pointing to the leaf that holds the longest prefix
+ * covering it, or to NULL if no prefix covers it at all.  A lookup is
+ * then one indexed load plus a short binary search instead of a walk
+ * down the trie.
+ *
+ * The ranges resolve to leaves rather than to next hops, so the aliases
+ * are still matched against the flow by fib_table_lookup() and any
+ * semantic miss (TOS, scope, dead next hops) falls back to a full trie
+ * walk.
+ *
+ * The table is built lazily on the first lookup and rebuilt under RTNL
+ * from a delayed work item.  Route changes only mark the chunks they
+ * cover dirty; lookups falling into a dirty chunk use the trie until the
+ * next generation is published, and clean chunks are copied over from
+ * the previous generation as they are.
+ */
+#define DXR_CHUNK_BITS	16
+#define DXR_CHUNKS	(1U << DXR_CHUNK_BITS)
+#define DXR_RANGE_BITS	(KEYLENGTH - DXR_CHUNK_BITS)
+#define DXR_RANGE_SIZE	(1U << DXR_RANGE_BITS)
+
+struct dxr_chunk {
+	u32			base;
+	u32			nr;
+};
+
+struct fib_dxr {
+	struct rcu_head		rcu;
+	u32			nr_ranges;
+	u16			*start;
+	struct key_vector	**leaf;
+	unsigned long		dirty[BITS_TO_LONGS(DXR_CHUNKS)];
+	struct dxr_chunk	chunk[DXR_CHUNKS];
+};
+
+/* scratch space for the chunks of one rebuild */
+struct dxr_build {
+	u32			nr;
+	u32			size;
+	u16			*start;
+	struct key_vector	**leaf;
+};
+
+enum {
+	DXR_QUEUED,
+	DXR_DEAD,
+};
+
+DEFINE_STATIC_KEY_FALSE(fib_dxr_key);
+EXPORT_SYMBOL_GPL(fib_dxr_key);
+
+static bool fib_dxr_boot __initdata;
+
+static int __init fib_dxr_setup(char *str)
+{
+	return kstrtobool(str, &fib_dxr_boot) == 0;
+}
+__setup("fib_dxr=", fib_dxr_setup);
+
+static void fib_dxr_work_fn(struct work_struct *work);
+
+static DECLARE_DELAYED_WORK(fib_dxr_work, fib_dxr_work_fn);
+static DEFINE_SPINLOCK(fib_dxr_lock);
+static LIST_HEAD(fib_dxr_pending);
+/* tables with a published DXR, protected by RTNL */
+static LIST_HEAD(fib_dxr_tables);
+
+static struct key_vector *leaf_walk_rcu(struct key_vector **tn, t_key key);
+
+static void fib_dxr_request(struct trie *t)
+{
+	if (test_and_set_bit(DXR_QUEUED, &t->dxr_flags))
+		return;
+
+	spin_lock_bh(&fib_dxr_lock);
+	if (!test_bit(DXR_DEAD, &t->dxr_flags))
+		list_add_tail(&t->dxr_pending, &fib_dxr_pending);
+	spin_unlock_bh(&fib_dxr_lock);
+
+	schedule_delayed_work(&fib_dxr_work, HZ / 10);
+}
+
+/* Returns true if the DXR could answer, with @l set to the leaf holding
+ * the longest prefix covering @key or to NULL if there is none.
+ */
+static bool fib_dxr_lookup(struct trie *t, t_key key, struct key_vector **l)
+{
+	struct fib_dxr *d = rcu_dereference(t->dxr);
+	const struct dxr_chunk *c;
+	u32 lo, hi, mid, off;
+
+	if (unlikely(!d)) {
+		fib_dxr_request(t);
+		return false;
+	}
+
+	if (test_bit(key >> DXR_RANGE_BITS, d->dirty))
+		return false;
+
+	c = &d->chunk[key >> DXR_RANGE_BITS];
+	off = key & (DXR_RANGE_SIZE - 1);
+
+	/* find the last range starting at or below off, the first one
+	 * always starts at 0
+	 */
+	lo = c->base;
+	hi = c->base + c->nr - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (d->start[mid] <= off)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	*l = d->leaf[lo];
+	return true;
+}
+
+/* Caller must hold RTNL */
+static void fib_dxr_dirty(struct trie *t, t_key key, u8 slen)
+{
+	struct fib_dxr *d = rtnl_dereference(t->dxr);
+
+	if (!d)
+		return;
+
+	if (slen < DXR_RANGE_BITS)
+		set_bit(key >> DXR_RANGE_BITS, d->dirty);
+	else
+		bitmap_set(d->dirty, key >> DXR_RANGE_BITS,
+			   1U << (slen - DXR_RANGE_BITS));
+
+	fib_dxr_request(t);
+}
+
+static void fib_dxr_free(struct fib_dxr *d)
+{
+	kvfree(d->start);
+	kvfree(d->leaf);
+	kvfree(d);
+}
+
+static void fib_dxr_free_rcu(struct rcu_head *head)
+{
+	fib_dxr_free(container_of(head, struct fib_dxr, rcu));
+}
+
+/* Caller must hold RTNL */
+static void fib_dxr_drop(struct trie *t)
+{
+	struct fib_dxr *d = rtnl_dereference(t->dxr);
+
+	if (!d)
+		return;
+
+	RCU_INIT_POINTER(t->dxr, NULL);
+	list_del(&t->dxr_list);
+	call_rcu(&d->rcu, fib_dxr_free_rcu);
+}
+
+/* Caller must hold RTNL */
+static void fib_dxr_release(struct trie *t)
+{
+	spin_lock_bh(&fib_dxr_lock);
+	set_bit(DXR_DEAD, &t->dxr_flags);
+	list_del_init(&t->dxr_pending);
+	spin_unlock_bh(&fib_dxr_lock);
+
+	fib_dxr_drop(t);
+}
+
+static int dxr_build_grow(struct dxr_build *b)
+{
+	u32 size = b->size ? 2 * b->size : DXR_RANGE_SIZE;
+	struct key_vector **leaf;
+	u16 *start;
+
+	start = kvmalloc_array(size, sizeof(*start), GFP_KERNEL);
+	leaf = kvmalloc_array(size, sizeof(*leaf), GFP_KERNEL);
+	if (!start || !leaf) {
+		kvfree(start);
+		kvfree(leaf);
+		return -ENOMEM;
+	}
+
+	if (b->nr) {
+		memcpy(start, b->start, b->nr * sizeof(*start));
+		memcpy(leaf, b->leaf, b->nr * sizeof(*leaf));
+	}
+
+	kvfree(b->start);
+	kvfree(b->leaf);
+	b->start = start;
+	b->leaf = leaf;
+	b->size = size;
+
+	return 0;
+}
+
+/* Append a range to the chunk starting at @first.  A range starting at
+ * the same offset as the previous one replaces it, and neighbours
+ * resolving to the same leaf are merged.
+ */
+static int dxr_build_emit(struct dxr_build *b, u32 first, u32 off,
+			  struct key_vector *l)
+{
+	if (b->nr > first && b->start[b->nr - 1] == off) {
+		b->leaf[b->nr - 1] = l;
+		if (b->nr - 1 > first && b->leaf[b->nr - 2] == l)
+			b->nr--;
+		return 0;
+	}
+
+	if (b->nr > first && b->leaf[b->nr - 1] == l)
+		return 0;
+
+	if (b->nr == b->size && dxr_build_grow(b))
+		return -ENOMEM;
+
+	b->start[b->nr] = off;
+	b->leaf[b->nr] = l;
+	b->nr++;
+
+	return 0;
+}
+
+static bool leaf_has_slen(struct key_vector *l, u8 slen)
+{
+	struct fib_alias *fa;
+
+	hlist_for_each_entry(fa, &l->leaf, fa_list)
+		if (fa->fa_slen == slen)
+			return true;
+
+	return false;
+}
+
+/* Build the ranges of chunk @c at the end of @b */
+static int fib_dxr_build_chunk(struct trie *t, u32 c, struct dxr_build *b)
+{
+	struct {
+		u32 end;
+		struct key_vector *l;
+	} stack[DXR_RANGE_BITS + 1];
+	t_key lo = c << DXR_RANGE_BITS, key = lo;
+	struct key_vector *l, *tp, *cover = NULL;
+	u32 first = b->nr;
+	int plen, top = 0;
+
+	/* longest prefix covering the whole chunk */
+	for (plen = DXR_CHUNK_BITS; plen >= 0; plen--) {
+		t_key mask = plen ? KEY_MAX << (KEYLENGTH - plen) : 0;
+
+		l = fib_find_node(t, &tp, lo & mask);
+		if (l && leaf_has_slen(l, KEYLENGTH - plen)) {
+			cover = l;
+			break;
+		}
+	}
+
+	stack[0].end = DXR_RANGE_SIZE;
+	stack[0].l = cover;
+	if (dxr_build_emit(b, first, 0, cover))
+		return -ENOMEM;
+
+	/* The longer prefixes inside the chunk form properly nested
+	 * intervals.  Leaves come in key order, and each leaf pushes its
+	 * shortest prefix first, so a stack sweep resolves the nesting.
+	 */
+	tp = t->kv;
+	while ((l = leaf_walk_rcu(&tp, key)) != NULL) {
+		u8 slens[DXR_RANGE_BITS], prev = KEYLENGTH;
+		struct fib_alias *fa;
+		u32 off;
+		int n = 0;
+
+		if ((l->key ^ lo) >> DXR_RANGE_BITS)
+			break;
+
+		off = l->key & (DXR_RANGE_SIZE - 1);
+
+		hlist_for_each_entry(fa, &l->leaf, fa_list) {
+			if (fa->fa_slen >= DXR_RANGE_BITS)
+				break;
+			if (fa->fa_slen != prev)
+				slens[n++] = fa->fa_slen;
+			prev = fa->fa_slen;
+		}
+
+		while (n--) {
+			u32 end = off + (1U << slens[n]);
+
+			while (stack[top].end <= off) {
+				top--;
+				if (dxr_build_emit(b, first, stack[top + 1].end,
+						   stack[top].l))
+					return -ENOMEM;
+			}
+
+			top++;
+			stack[top].end = end;
+			stack[top].l = l;
+			if (dxr_build_emit(b, first, off, l))
+				return -ENOMEM;
+		}
+
+		key = l->key + 1;
+		if (key < l->key)
+			break;
+	}
+
+	for (; top > 0; top--) {
+		if (stack[top].end < DXR_RANGE_SIZE &&
+		    dxr_build_emit(b, first, stack[top].end, stack[top - 1].l))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Caller must hold RTNL */
+static int fib_dxr_rebuild(struct trie *t)
+{
+	struct fib_dxr *old = rtnl_dereference(t->dxr), *new;
+	struct dxr_build b = {};
+	u32 c, base, total = 0;
+	int err = -ENOMEM;
+
+	if (old && bitmap_empty(old->dirty, DXR_CHUNKS))
+		return 0;
+
+	new = kvzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	/* first pass: rebuild the dirty chunks into the scratch space */
+	for (c = 0; c < DXR_CHUNKS; c++) {
+		struct dxr_chunk *chunk = &new->chunk[c];
+
+		if (old && !test_bit(c, old->dirty)) {
+			chunk->nr = old->chunk[c].nr;
+		} else {
+			chunk->base = b.nr;
+			err = fib_dxr_build_chunk(t, c, &b);
+			if (err)
+				goto out;
+			chunk->nr = b.nr - chunk->base;
+		}
+
+		total += chunk->nr;
+
+		if (!(c & 255))
+			cond_resched();
+	}
+
+	err = -ENOMEM;
+	new->start = kvmalloc_array(total, sizeof(*new->start), GFP_KERNEL);
+	new->leaf = kvmalloc_array(total, sizeof(*new->leaf), GFP_KERNEL);
+	if (!new->start || !new->leaf)
+		goto out;
+
+	/* second pass: lay out old and new chunks back to back */
+	for (c = 0, base = 0; c < DXR_CHUNKS; c++) {
+		struct dxr_chunk *chunk = &new->chunk[c];
+		struct key_vector **leaf;
+		u16 *start;
+
+		if (old && !test_bit(c, old->dirty)) {
+			start = old->start + old->chunk[c].base;
+			leaf = old->leaf + old->chunk[c].base;
+		} else {
+			start = b.start + chunk->base;
+			leaf = b.leaf + chunk->base;
+		}
+
+		memcpy(new->start + base, start, chunk->nr * sizeof(*start));
+		memcpy(new->leaf + base, leaf, chunk->nr * sizeof(*leaf));
+		chunk->base = base;
+		base += chunk->nr;
+	}
+
+	new->nr_ranges = total;
+	rcu_assign_pointer(t->dxr, new);
+	if (old)
+		call_rcu(&old->rcu, fib_dxr_free_rcu);
+	else
+		list_add(&t->dxr_list, &fib_dxr_tables);
+	new = NULL;
+	err = 0;
+out:
+	if (new)
+		fib_dxr_free(new);
+	kvfree(b.start);
+	kvfree(b.leaf);
+
+	return err;
+}
+
+static void fib_dxr_work_fn(struct work_struct *work)
+{
+	struct trie *t;
+
+	rtnl_lock();
+	for (;;) {
+		spin_lock_bh(&fib_dxr_lock);
+		t = list_first_entry_or_null(&fib_dxr_pending, struct trie,
+					     dxr_pending);
+		if (t) {
+			list_del_init(&t->dxr_pending);
+			clear_bit(DXR_QUEUED, &t->dxr_flags);
+		}
+		spin_unlock_bh(&fib_dxr_lock);
+
+		if (!t)
+			break;
+
+		if (static_branch_unlikely(&fib_dxr_key))
+			fib_dxr_rebuild(t);
+	}
+	rtnl_unlock();
+}
+
+void fib_dxr_set_enabled(bool enable)
+{
+	struct trie *t, *tmp;
+
+	if (enable) {
+		static_branch_enable(&fib_dxr_key);
+		return;
+	}
+
+	static_branch_disable(&fib_dxr_key);
+
+	/* Give the memory back, the tables are built again on demand */
+	rtnl_lock();
+	list_for_each_entry_safe(t, tmp, &fib_dxr_tables, dxr_list)
+		fib_dxr_drop(t);
+	rtnl_unlock();
+}
+EXPORT_SYMBOL_GPL(fib_dxr_set_enabled);
+
+/* Run pending rebuilds now and wait for them, must not hold RTNL */
+void fib_dxr_flush(void)
+{
+	flush_delayed_work(&fib_dxr_work);
+}
+EXPORT_SYMBOL_GPL(fib_dxr_flush);
+#else
+static inline void fib_dxr_dirty(struct trie *t, t_key key, u8 slen)
+{
+}
+#endif /* CONFIG_IP_FIB_DXR */
+
 static int fib_insert_node(struct trie *t, struct key_vector *tp,
 			   struct fib_alias *new, t_key key)
 {
@@ -1161,6 +1629,8 @@ static int fib_insert_alias(struct trie *t, struct key_vector *tp,
 			    struct key_vector *l, struct fib_alias *new,
 			    struct fib_alias *fa, t_key key)
 {
+	fib_dxr_dirty(t, key, new->fa_slen);
+
 	if (!l)
 		return fib_insert_node(t, tp, new, key);
 
@@ -1454,6 +1924,9 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	struct fib_alias *fa;
 	unsigned long index;
 	t_key cindex;
+#ifdef CONFIG_IP_FIB_DXR
+	bool dxr = false;
+#endif
 
 	pn = t->kv;
 	cindex = 0;
@@ -1468,6 +1941,18 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	this_cpu_inc(stats->gets);
 #endif
 
+#ifdef CONFIG_IP_FIB_DXR
+	if (static_branch_unlikely(&fib_dxr_key) &&
+	    fib_dxr_lookup(t, key, &n)) {
+		if (!n) {
+			trace_fib_table_lookup(tb->tb_id, flp, NULL, -EAGAIN);
+			return -EAGAIN;
+		}
+		dxr = true;
+		goto found;
+	}
+walk:
+#endif
 	/* Step 1: Travel to the longest prefix match in the trie */
 	for (;;) {
 		index = get_cindex(key, n);
@@ -1643,6 +2128,20 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 miss:
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	this_cpu_inc(stats->semantic_match_miss);
+#endif
+#ifdef CONFIG_IP_FIB_DXR
+	/* The DXR only knows the longest prefix, let the trie find the
+	 * next best one.
+	 */
+	if (unlikely(dxr)) {
+		dxr = false;
+		n = get_child_rcu(pn, cindex);
+		if (!n) {
+			trace_fib_table_lookup(tb->tb_id, flp, NULL, -EAGAIN);
+			return -EAGAIN;
+		}
+		goto walk;
+	}
 #endif
 	goto backtrace;
 }
@@ -1655,6 +2154,8 @@ static void fib_remove_alias(struct trie *t, struct key_vector *tp,
 	struct hlist_node **pprev = old->fa_list.pprev;
 	struct fib_alias *fa = hlist_entry(pprev, typeof(*fa), fa_list.next);
 
+	fib_dxr_dirty(t, l->key, old->fa_slen);
+
 	/* remove the fib_alias from the list */
 	hlist_del_rcu(&old->fa_list);
 
@@ -2005,6 +2506,7 @@ void fib_table_flush_external(struct fib_table *tb)
 			 * need to remove the local copy from main
 			 */
 			if (tb->tb_id != fa->tb_id) {
+				fib_dxr_dirty(t, n->key, fa->fa_slen);
 				hlist_del_rcu(&fa->fa_list);
 				alias_free_mem_rcu(fa);
 				continue;
@@ -2094,6 +2596,7 @@ int fib_table_flush(struct net *net, struct fib_table *tb, bool flush_all)
 			if (fi->pfsrc_removed)
 				rtmsg_fib(RTM_DELROUTE, htonl(n->key), fa,
 					  KEYLENGTH - fa->fa_slen, tb->tb_id, &info, 0);
+			fib_dxr_dirty(t, n->key, fa->fa_slen);
 			hlist_del_rcu(&fa->fa_list);
 			fib_release_info(fa->fa_info);
 			alias_free_mem_rcu(fa);
@@ -2263,6 +2766,10 @@ static void __trie_free_rcu(struct rcu_head *head)
 
 void fib_free_table(struct fib_table *tb)
 {
+#ifdef CONFIG_IP_FIB_DXR
+	if (tb->tb_data == tb->__data)
+		fib_dxr_release((struct trie *)tb->tb_data);
+#endif
 	call_rcu(&tb->rcu, __trie_free_rcu);
 }
 
@@ -2406,6 +2913,10 @@ void __init fib_trie_init(void)
 	trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
 					   LEAF_SIZE,
 					   0, SLAB_PANIC | SLAB_ACCOUNT, NULL);
+#ifdef CONFIG_IP_FIB_DXR
+	if (fib_dxr_boot)
+		static_branch_enable(&fib_dxr_key);
+#endif
 }
 
 struct fib_table *fib_trie_table(u32 id, struct fib_table *alias)
@@ -2431,6 +2942,10 @@ struct fib_table *fib_trie_table(u32 id, struct fib_table *alias)
 	t = (struct trie *) tb->tb_data;
 	t->kv[0].pos = KEYLENGTH;
 	t->kv[0].slen = KEYLENGTH;
+#ifdef CONFIG_IP_FIB_DXR
+	INIT_LIST_HEAD(&t->dxr_pending);
+	INIT_LIST_HEAD(&t->dxr_list);
+#endif
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	t->stats = alloc_percpu(struct trie_use_stats);
 	if (!t->stats) {
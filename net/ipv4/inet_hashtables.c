@@ -77,19 +77,27 @@ struct inet_bind_bucket *inet_bind_bucket_create(struct kmem_cache *cachep,
 		tb->fastreuse = 0;
 		tb->fastreuseport = 0;
 		INIT_HLIST_HEAD(&tb->bhash2);
-		hlist_add_head(&tb->node, &head->chain);
+		hlist_add_head_rcu(&tb->node, &head->chain);
 	}
 	return tb;
 }
 
+static void inet_bind_bucket_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct inet_bind_bucket, rcu));
+}
+
 /*
  * Caller must hold hashbucket lock for this tb with local BH disabled
+ *
+ * __inet_hash_connect() walks the chain under RCU, so the bucket is
+ * freed after a grace period.
  */
 void inet_bind_bucket_destroy(struct kmem_cache *cachep, struct inet_bind_bucket *tb)
 {
 	if (hlist_empty(&tb->bhash2)) {
-		__hlist_del(&tb->node);
-		kmem_cache_free(cachep, tb);
+		hlist_del_rcu(&tb->node);
+		call_rcu(&tb->rcu, inet_bind_bucket_free_rcu);
 	}
 }
 
@@ -535,10 +543,11 @@ struct sock *__inet_lookup_established(struct net *net,
 }
 EXPORT_SYMBOL_GPL(__inet_lookup_established);
 
-/* called with local bh disabled */
+/* called with local bh disabled, or under rcu_read_lock() if @rcu_lookup */
 static int __inet_check_established(struct inet_timewait_death_row *death_row,
 				    struct sock *sk, __u16 lport,
-				    struct inet_timewait_sock **twp)
+				    struct inet_timewait_sock **twp,
+				    bool rcu_lookup)
 {
 	struct inet_hashinfo *hinfo = death_row->hashinfo;
 	struct inet_sock *inet = inet_sk(sk);
@@ -557,6 +566,22 @@ static int __inet_check_established(struct inet_timewait_death_row *death_row,
 	const struct hlist_nulls_node *node;
 	struct inet_timewait_sock *tw = NULL;
 
+	/* Lockless hint: only tell whether @lport is certainly in use.  A
+	 * TIME_WAIT match may still be recycled, so let the locked pass
+	 * decide.
+	 */
+	if (rcu_lookup) {
+		sk_nulls_for_each_rcu(sk2, node, &head->chain) {
+			if (sk2->sk_hash != hash ||
+			    !inet_match(net, sk2, acookie, ports, dif, sdif))
+				continue;
+			if (sk2->sk_state == TCP_TIME_WAIT)
+				break;
+			return -EADDRNOTAVAIL;
+		}
+		return 0;
+	}
+
 	spin_lock(lock);
 
 	sk_nulls_for_each(sk2, node, &head->chain) {
@@ -991,10 +1016,17 @@ EXPORT_SYMBOL_GPL(inet_bhash2_reset_saddr);
 #define INET_TABLE_PERTURB_SIZE (1 << CONFIG_INET_TABLE_PERTURB_ORDER)
 static u32 *table_perturb;
 
+static void inet_hash_connect_stats(struct net *net, u32 scanned, u32 locked)
+{
+	NET_ADD_STATS(net, LINUX_MIB_EPHEMPORTSCANNED, scanned);
+	NET_ADD_STATS(net, LINUX_MIB_EPHEMPORTLOCKED, locked);
+}
+
 int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 		struct sock *sk, u64 port_offset,
 		int (*check_established)(struct inet_timewait_death_row *,
-			struct sock *, __u16, struct inet_timewait_sock **))
+			struct sock *, __u16, struct inet_timewait_sock **,
+			bool rcu_lookup))
 {
 	struct inet_hashinfo *hinfo = death_row->hashinfo;
 	struct inet_bind_hashbucket *head, *head2;
@@ -1003,6 +1035,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 	struct net *net = sock_net(sk);
 	struct inet_bind2_bucket *tb2;
 	struct inet_bind_bucket *tb;
+	u32 scanned = 0, locked = 0;
 	bool tb_created = false;
 	u32 remaining, offset;
 	int ret, i, low, high;
@@ -1012,7 +1045,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 
 	if (port) {
 		local_bh_disable();
-		ret = check_established(death_row, sk, port, NULL);
+		ret = check_established(death_row, sk, port, NULL, false);
 		local_bh_enable();
 		return ret;
 	}
@@ -1046,8 +1079,31 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 			port -= remaining;
 		if (inet_is_local_reserved_port(net, port))
 			continue;
+		scanned++;
 		head = &hinfo->bhash[inet_bhashfn(net, port,
 						  hinfo->bhash_size)];
+
+		/* Once the range fills up, most candidates are busy.  Skip
+		 * them without touching the bucket lock, which is what
+		 * concurrent connect() and bind() callers contend on.
+		 */
+		rcu_read_lock();
+		hlist_for_each_entry_rcu(tb, &head->chain, node) {
+			if (!inet_bind_bucket_match(tb, net, port, l3mdev))
+				continue;
+			if (READ_ONCE(tb->fastreuse) >= 0 ||
+			    READ_ONCE(tb->fastreuseport) >= 0) {
+				rcu_read_unlock();
+				goto skip_port;
+			}
+			if (!check_established(death_row, sk, port, NULL, true))
+				break;
+			rcu_read_unlock();
+			goto skip_port;
+		}
+		rcu_read_unlock();
+
+		locked++;
 		spin_lock_bh(&head->lock);
 
 		/* Does not bother with rcv_saddr checks, because
@@ -1060,7 +1116,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 					goto next_port;
 				WARN_ON(hlist_empty(&tb->bhash2));
 				if (!check_established(death_row, sk,
-						       port, &tw))
+						       port, &tw, false))
 					goto ok;
 				goto next_port;
 			}
@@ -1070,6 +1126,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 					     net, head, port, l3mdev);
 		if (!tb) {
 			spin_unlock_bh(&head->lock);
+			inet_hash_connect_stats(net, scanned, locked);
 			return -ENOMEM;
 		}
 		tb_created = true;
@@ -1078,6 +1135,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 		goto ok;
 next_port:
 		spin_unlock_bh(&head->lock);
+skip_port:
 		cond_resched();
 	}
 
@@ -1086,9 +1144,12 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 		if ((offset & 1) && remaining > 1)
 			goto other_parity_scan;
 	}
+	inet_hash_connect_stats(net, scanned, locked);
 	return -EADDRNOTAVAIL;
 
 ok:
+	inet_hash_connect_stats(net, scanned, locked);
+
 	/* Find the corresponding tb2 bucket since we need to
 	 * add the socket to the bhash2 table as well
 	 */
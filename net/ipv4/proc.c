@@ -304,6 +304,8 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TCPAOKeyNotFound", LINUX_MIB_TCPAOKEYNOTFOUND),
 	SNMP_MIB_ITEM("TCPAOGood", LINUX_MIB_TCPAOGOOD),
 	SNMP_MIB_ITEM("TCPAODroppedIcmps", LINUX_MIB_TCPAODROPPEDICMPS),
+	SNMP_MIB_ITEM("EphemPortScanned", LINUX_MIB_EPHEMPORTSCANNED),
+	SNMP_MIB_ITEM("EphemPortLocked", LINUX_MIB_EPHEMPORTLOCKED),
 	SNMP_MIB_SENTINEL
 };
 
@@ -208,6 +208,28 @@ static int ipv4_fwd_update_priority(struct ctl_table *table, int write,
 	return ret;
 }
 
+#ifdef CONFIG_IP_FIB_DXR
+static int proc_fib_dxr(struct ctl_table *table, int write,
+			void *buffer, size_t *lenp, loff_t *ppos)
+{
+	int val = static_key_enabled(&fib_dxr_key);
+	struct ctl_table tmp = {
+		.data		= &val,
+		.maxlen		= sizeof(val),
+		.mode		= table->mode,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	};
+	int ret;
+
+	ret = proc_dointvec_minmax(&tmp, write, buffer, lenp, ppos);
+	if (write && ret == 0)
+		fib_dxr_set_enabled(val);
+
+	return ret;
+}
+#endif
+
 static int proc_tcp_congestion_control(struct ctl_table *ctl, int write,
 				       void *buffer, size_t *lenp, loff_t *ppos)
 {
@@ -575,6 +597,14 @@ static struct ctl_table ipv4_table[] = {
 		.extra1		= &sysctl_fib_sync_mem_min,
 		.extra2		= &sysctl_fib_sync_mem_max,
 	},
+#ifdef CONFIG_IP_FIB_DXR
+	{
+		.procname	= "fib_dxr",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_fib_dxr,
+	},
+#endif
 	{ }
 };
 
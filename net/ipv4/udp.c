@@ -419,6 +419,46 @@ u32 udp_ehashfn(const struct net *net, const __be32 laddr, const __u16 lport,
 			      udp_ehash_secret + net_hash_mix(net));
 }
 
+/* Connected sockets stay on their hash2 chain, so hash4 is only a
+ * shortcut.  Short chains are cheaper to walk than the 4-tuple is to
+ * hash, so only consult hash4 for long ones.
+ */
+#define UDP_HASH4_MIN_CHAIN	10
+
+static bool udp_use_hash4(const struct udp_hslot *hslot2)
+{
+	return READ_ONCE(hslot2->count) > UDP_HASH4_MIN_CHAIN;
+}
+
+/* called with rcu_read_lock() */
+static struct sock *udp4_lib_lookup4(struct net *net,
+				     __be32 saddr, __be16 sport,
+				     __be32 daddr, unsigned int hnum,
+				     int dif, int sdif,
+				     struct udp_table *udptable)
+{
+	const __portpair ports = INET_COMBINED_PORTS(sport, hnum);
+	INET_ADDR_COOKIE(acookie, saddr, daddr);
+	struct udp_hslot *hslot4;
+	unsigned int hash4;
+	struct udp_sock *up;
+
+	hash4 = udp_ehashfn(net, daddr, hnum, saddr, sport);
+	hslot4 = udp_hashslot4(udptable, hash4);
+
+	udp_lrpa_for_each_entry_rcu(up, &hslot4->head) {
+		struct sock *sk = &up->inet.sk;
+
+		if (inet_match(net, sk, acookie, ports, dif, sdif))
+			return sk;
+	}
+
+	/* A socket rehashed concurrently may have moved us to another
+	 * chain; the hash2 walk will still find it.
+	 */
+	return NULL;
+}
+
 /* called with rcu_read_lock() */
 static struct sock *udp4_lib_lookup2(struct net *net,
 				     __be32 saddr, __be16 sport,
@@ -482,6 +522,14 @@ struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	slot2 = hash2 & udptable->mask;
 	hslot2 = &udptable->hash2[slot2];
 
+	/* Lookup connected socket by its 4-tuple */
+	if (udp_use_hash4(hslot2)) {
+		result = udp4_lib_lookup4(net, saddr, sport, daddr, hnum,
+					  dif, sdif, udptable);
+		if (result)
+			return result;
+	}
+
 	/* Lookup connected or non-wildcard socket */
 	result = udp4_lib_lookup2(net, saddr, sport,
 				  daddr, hnum, dif, sdif,
@@ -1908,6 +1956,82 @@ int udp_pre_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 }
 EXPORT_SYMBOL(udp_pre_connect);
 
+/* Caller holds the primary hash slot lock */
+static void __udp_unhash4(struct udp_table *udptable, struct sock *sk)
+{
+	struct udp_hslot *hslot4;
+
+	hslot4 = udp_hashslot4(udptable, udp_sk(sk)->udp_lrpa_hash);
+
+	spin_lock(&hslot4->lock);
+	hlist_del_init_rcu(&udp_sk(sk)->udp_lrpa_node);
+	hslot4->count--;
+	spin_unlock(&hslot4->lock);
+}
+
+static void udp_unhash4(struct sock *sk)
+{
+	struct udp_table *udptable;
+	struct udp_hslot *hslot;
+
+	if (!udp_hashed4(sk))
+		return;
+
+	udptable = udp_get_table_prot(sk);
+	hslot = udp_hashslot(udptable, sock_net(sk), udp_sk(sk)->udp_port_hash);
+
+	spin_lock_bh(&hslot->lock);
+	if (udp_hashed4(sk))
+		__udp_unhash4(udptable, sk);
+	spin_unlock_bh(&hslot->lock);
+}
+
+/* Hash a connected socket on its 4-tuple, moving it if it was connected
+ * before.  Called under the socket lock.
+ */
+static void udp4_hash4(struct sock *sk)
+{
+	struct udp_table *udptable = udp_get_table_prot(sk);
+	struct udp_hslot *hslot, *hslot4;
+	unsigned int hash4;
+
+	if (sk->sk_rcv_saddr == htonl(INADDR_ANY))
+		return;
+
+	hash4 = udp_ehashfn(sock_net(sk), sk->sk_rcv_saddr, sk->sk_num,
+			    sk->sk_daddr, sk->sk_dport);
+	hslot = udp_hashslot(udptable, sock_net(sk), udp_sk(sk)->udp_port_hash);
+	hslot4 = udp_hashslot4(udptable, hash4);
+
+	spin_lock_bh(&hslot->lock);
+	if (sk_unhashed(sk))
+		goto unlock;
+
+	if (udp_hashed4(sk))
+		__udp_unhash4(udptable, sk);
+
+	udp_sk(sk)->udp_lrpa_hash = hash4;
+
+	spin_lock(&hslot4->lock);
+	hlist_add_head_rcu(&udp_sk(sk)->udp_lrpa_node, &hslot4->head);
+	hslot4->count++;
+	spin_unlock(&hslot4->lock);
+unlock:
+	spin_unlock_bh(&hslot->lock);
+}
+
+static int udp_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
+{
+	int res;
+
+	lock_sock(sk);
+	res = __ip4_datagram_connect(sk, uaddr, addr_len);
+	if (!res)
+		udp4_hash4(sk);
+	release_sock(sk);
+	return res;
+}
+
 int __udp_disconnect(struct sock *sk, int flags)
 {
 	struct inet_sock *inet = inet_sk(sk);
@@ -1915,6 +2039,8 @@ int __udp_disconnect(struct sock *sk, int flags)
 	 *	1003.1g - break association.
 	 */
 
+	udp_unhash4(sk);
+
 	sk->sk_state = TCP_CLOSE;
 	inet->inet_daddr = 0;
 	inet->inet_dport = 0;
@@ -1967,6 +2093,9 @@ void udp_lib_unhash(struct sock *sk)
 			hlist_del_init_rcu(&udp_sk(sk)->udp_portaddr_node);
 			hslot2->count--;
 			spin_unlock(&hslot2->lock);
+
+			if (udp_hashed4(sk))
+				__udp_unhash4(udptable, sk);
 		}
 		spin_unlock_bh(&hslot->lock);
 	}
@@ -2520,6 +2649,17 @@ static struct sock *__udp4_lib_demux_lookup(struct net *net,
 	hash2 = ipv4_portaddr_hash(net, loc_addr, hnum);
 	slot2 = hash2 & udptable->mask;
 	hslot2 = &udptable->hash2[slot2];
+
+	/* Lookup connected socket by its 4-tuple, and like
+	 * __udp4_lib_lookup() fall back to hash2 on a miss.
+	 */
+	if (udp_use_hash4(hslot2)) {
+		sk = udp4_lib_lookup4(net, rmt_addr, rmt_port, loc_addr, hnum,
+				      dif, sdif, udptable);
+		if (sk)
+			return sk;
+	}
+
 	ports = INET_COMBINED_PORTS(rmt_port, hnum);
 
 	udp_portaddr_for_each_entry_rcu(sk, &hslot2->head) {
@@ -2914,7 +3054,7 @@ struct proto udp_prot = {
 	.owner			= THIS_MODULE,
 	.close			= udp_lib_close,
 	.pre_connect		= udp_pre_connect,
-	.connect		= ip4_datagram_connect,
+	.connect		= udp_connect,
 	.disconnect		= udp_disconnect,
 	.ioctl			= udp_ioctl,
 	.init			= udp_init_sock,
@@ -3405,7 +3545,7 @@ void __init udp_table_init(struct udp_table *table, const char *name)
 	unsigned int i;
 
 	table->hash = alloc_large_system_hash(name,
-					      2 * sizeof(struct udp_hslot),
+					      3 * sizeof(struct udp_hslot),
 					      uhash_entries,
 					      21, /* one slot per 2 MB */
 					      0,
@@ -3415,6 +3555,7 @@ void __init udp_table_init(struct udp_table *table, const char *name)
 					      UDP_HTABLE_SIZE_MAX);
 
 	table->hash2 = table->hash + (table->mask + 1);
+	table->hash4 = table->hash2 + (table->mask + 1);
 	for (i = 0; i <= table->mask; i++) {
 		INIT_HLIST_HEAD(&table->hash[i].head);
 		table->hash[i].count = 0;
@@ -3425,6 +3566,11 @@ void __init udp_table_init(struct udp_table *table, const char *name)
 		table->hash2[i].count = 0;
 		spin_lock_init(&table->hash2[i].lock);
 	}
+	for (i = 0; i <= table->mask; i++) {
+		INIT_HLIST_HEAD(&table->hash4[i].head);
+		table->hash4[i].count = 0;
+		spin_lock_init(&table->hash4[i].lock);
+	}
 }
 
 u32 udp_flow_hashrnd(void)
@@ -3456,12 +3602,13 @@ static struct udp_table __net_init *udp_pernet_table_alloc(unsigned int hash_ent
 	if (!udptable)
 		goto out;
 
-	udptable->hash = vmalloc_huge(hash_entries * 2 * sizeof(struct udp_hslot),
+	udptable->hash = vmalloc_huge(hash_entries * 3 * sizeof(struct udp_hslot),
 				      GFP_KERNEL_ACCOUNT);
 	if (!udptable->hash)
 		goto free_table;
 
 	udptable->hash2 = udptable->hash + hash_entries;
+	udptable->hash4 = udptable->hash2 + hash_entries;
 	udptable->mask = hash_entries - 1;
 	udptable->log = ilog2(hash_entries);
 
@@ -3473,6 +3620,10 @@ static struct udp_table __net_init *udp_pernet_table_alloc(unsigned int hash_ent
 		INIT_HLIST_HEAD(&udptable->hash2[i].head);
 		udptable->hash2[i].count = 0;
 		spin_lock_init(&udptable->hash2[i].lock);
+
+		INIT_HLIST_HEAD(&udptable->hash4[i].head);
+		udptable->hash4[i].count = 0;
+		spin_lock_init(&udptable->hash4[i].lock);
 	}
 
 	return udptable;
@@ -4220,6 +4220,9 @@ static const struct nft_set_type *nft_set_types[] = {
 	&nft_set_rbtree_type,
 #if defined(CONFIG_X86_64) && !defined(CONFIG_UML)
 	&nft_set_pipapo_avx2_type,
+#endif
+#if defined(CONFIG_RISCV_ISA_V) && defined(CONFIG_64BIT)
+	&nft_set_pipapo_rvv_type,
 #endif
 	&nft_set_pipapo_type,
 };
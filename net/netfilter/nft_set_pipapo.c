@@ -340,6 +340,7 @@
 #include <linux/bitops.h>
 
 #include "nft_set_pipapo_avx2.h"
+#include "nft_set_pipapo_rvv.h"
 #include "nft_set_pipapo.h"
 
 /**
@@ -2330,3 +2331,28 @@ const struct nft_set_type nft_set_pipapo_avx2_type = {
 	},
 };
 #endif
+
+#if defined(CONFIG_RISCV_ISA_V) && defined(CONFIG_64BIT)
+const struct nft_set_type nft_set_pipapo_rvv_type = {
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP | NFT_SET_OBJECT |
+			  NFT_SET_TIMEOUT,
+	.ops		= {
+		.lookup		= nft_pipapo_rvv_lookup,
+		.insert		= nft_pipapo_insert,
+		.activate	= nft_pipapo_activate,
+		.deactivate	= nft_pipapo_deactivate,
+		.flush		= nft_pipapo_flush,
+		.remove		= nft_pipapo_remove,
+		.walk		= nft_pipapo_walk,
+		.get		= nft_pipapo_get,
+		.privsize	= nft_pipapo_privsize,
+		.estimate	= nft_pipapo_rvv_estimate,
+		.init		= nft_pipapo_init,
+		.destroy	= nft_pipapo_destroy,
+		.gc_init	= nft_pipapo_gc_init,
+		.commit		= nft_pipapo_commit,
+		.abort		= nft_pipapo_abort,
+		.elemsize	= offsetof(struct nft_pipapo_elem, ext),
+	},
+};
+#endif
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* PIPAPO: PIle PAcket POlicies: RISC-V Vector packet lookup routines
+ *
+ * The lookup tables are used exactly as by the generic implementation, but
+ * the result bitmap of a field is processed in strips of as many longs as
+ * the vector unit holds: each strip is loaded once, intersected with the
+ * selected bucket of every group of the field, and stored once, instead of
+ * being read and written back for every group.
+ *
+ * Only vsetvl, unit-stride 64-bit loads and stores, and vand.vv are used.
+ * With 64-bit elements, these encode the same way in RVV 1.0 and in the
+ * XTheadVector (RVV 0.7.1) flavour, so the two only differ in the vtype
+ * value passed to vsetvl.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables_core.h>
+#include <uapi/linux/netfilter/nf_tables.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+
+#include <linux/compiler.h>
+#include <asm/cpufeature.h>
+#include <asm/simd.h>
+#include <asm/vector.h>
+
+#include "nft_set_pipapo_rvv.h"
+#include "nft_set_pipapo.h"
+
+/* vtype for SEW=64, LMUL=8: RVV 1.0 (tail and mask agnostic), XTheadVector */
+#define NFT_PIPAPO_RVV_VTYPE		0xdb
+#define NFT_PIPAPO_RVV_VTYPE_THEAD	0x0f
+
+/* Set vector length for @avl longs, return it in @vl */
+#define NFT_PIPAPO_RVV_SETVL(vl, avl, vtype)				\
+	asm volatile(".option push\n\t"					\
+		     ".option arch, +v\n\t"				\
+		     "vsetvl	%0, %1, %2\n\t"				\
+		     ".option pop\n\t"					\
+		     : "=r" (vl) : "r" (avl), "r" (vtype))
+
+/* Load longs from memory into register group starting at v@reg */
+#define NFT_PIPAPO_RVV_LOAD(reg, loc)					\
+	asm volatile(".option push\n\t"					\
+		     ".option arch, +v\n\t"				\
+		     "vle64.v	v" #reg ", (%0)\n\t"			\
+		     ".option pop\n\t"					\
+		     : : "r" (loc) : "memory")
+
+/* Store register group starting at v@reg to memory */
+#define NFT_PIPAPO_RVV_STORE(reg, loc)					\
+	asm volatile(".option push\n\t"					\
+		     ".option arch, +v\n\t"				\
+		     "vse64.v	v" #reg ", (%0)\n\t"			\
+		     ".option pop\n\t"					\
+		     : : "r" (loc) : "memory")
+
+/* Bitwise AND: the staple operation of this algorithm */
+#define NFT_PIPAPO_RVV_AND(dst, a, b)					\
+	asm volatile(".option push\n\t"					\
+		     ".option arch, +v\n\t"				\
+		     "vand.vv	v" #dst ", v" #a ", v" #b "\n\t"	\
+		     ".option pop\n\t")
+
+/**
+ * nft_pipapo_rvv_and_field() - Intersect buckets selected by packet data
+ * @f:		Field including lookup table
+ * @dst:	Result bitmap, @f->bsize longs
+ * @data:	Packet data for this field
+ * @first:	First field: @dst holds no previous result, use all ones
+ * @vtype:	vtype value for 64-bit elements, LMUL=8
+ *
+ * Register groups v0 and v8 are used as accumulator and bucket operand.
+ */
+static void nft_pipapo_rvv_and_field(const struct nft_pipapo_field *f,
+				     unsigned long *dst, const u8 *data,
+				     bool first, unsigned long vtype)
+{
+	const unsigned long *bucket[NFT_PIPAPO_MAX_BITS /
+				    NFT_PIPAPO_GROUP_BITS_LARGE_SET];
+	const unsigned long *lt = NFT_PIPAPO_LT_ALIGN(f->lt);
+	size_t off, vl;
+	int group;
+
+	for (group = 0; group < f->groups; group++) {
+		u8 v;
+
+		if (f->bb == 8)
+			v = data[group];
+		else if (group % 2)
+			v = data[group / 2] & 0x0f;
+		else
+			v = data[group / 2] >> 4;
+
+		bucket[group] = lt + v * f->bsize;
+		lt += f->bsize * NFT_PIPAPO_BUCKETS(f->bb);
+	}
+
+	for (off = 0; off < f->bsize; off += vl) {
+		NFT_PIPAPO_RVV_SETVL(vl, f->bsize - off, vtype);
+
+		NFT_PIPAPO_RVV_LOAD(0, bucket[0] + off);
+		if (!first) {
+			NFT_PIPAPO_RVV_LOAD(8, dst + off);
+			NFT_PIPAPO_RVV_AND(0, 0, 8);
+		}
+
+		for (group = 1; group < f->groups; group++) {
+			NFT_PIPAPO_RVV_LOAD(8, bucket[group] + off);
+			NFT_PIPAPO_RVV_AND(0, 0, 8);
+		}
+
+		NFT_PIPAPO_RVV_STORE(0, dst + off);
+	}
+}
+
+/**
+ * nft_pipapo_rvv_estimate() - Set size, space and lookup complexity
+ * @desc:	Set description, element count and field description used
+ * @features:	Flags: NFT_SET_INTERVAL needs to be there
+ * @est:	Storage for estimation data
+ *
+ * Return: true if set is compatible and vector unit available, false otherwise.
+ */
+bool nft_pipapo_rvv_estimate(const struct nft_set_desc *desc, u32 features,
+			     struct nft_set_estimate *est)
+{
+	if (!(features & NFT_SET_INTERVAL) ||
+	    desc->field_count < NFT_PIPAPO_MIN_FIELDS)
+		return false;
+
+	if (!has_vector())
+		return false;
+
+	est->size = pipapo_estimate_size(desc);
+	if (!est->size)
+		return false;
+
+	est->lookup = NFT_SET_CLASS_O_LOG_N;
+
+	est->space = NFT_SET_CLASS_O_N;
+
+	return true;
+}
+
+/**
+ * nft_pipapo_rvv_lookup() - Lookup function for RISC-V Vector implementation
+ * @net:	Network namespace
+ * @set:	nftables API set representation
+ * @key:	nftables API element representation containing key data
+ * @ext:	nftables API extension pointer, filled with matching reference
+ *
+ * For more details, see DOC: Theory of Operation in nft_set_pipapo.c.
+ *
+ * Falls back to the generic implementation if the vector unit can't be used
+ * in this context.
+ *
+ * Return: true on match, false otherwise.
+ */
+bool nft_pipapo_rvv_lookup(const struct net *net, const struct nft_set *set,
+			   const u32 *key, const struct nft_set_ext **ext)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	unsigned long vtype = NFT_PIPAPO_RVV_VTYPE;
+	struct nft_pipapo_scratch *scratch;
+	unsigned long *res_map, *fill_map;
+	u8 genmask = nft_genmask_cur(net);
+	const u8 *rp = (const u8 *)key;
+	struct nft_pipapo_match *m;
+	struct nft_pipapo_field *f;
+	bool map_index;
+	int i;
+
+	if (unlikely(!may_use_simd()))
+		return nft_pipapo_lookup(net, set, key, ext);
+
+	if (riscv_has_extension_unlikely(RISCV_ISA_EXT_XTHEADVECTOR))
+		vtype = NFT_PIPAPO_RVV_VTYPE_THEAD;
+
+	m = rcu_dereference(priv->match);
+
+	/*
+	 * This also protects access to all data related to scratch maps:
+	 * with bottom halves disabled, kernel_vector_begin() does not start
+	 * a preemptible section, so we stay on this CPU.
+	 */
+	local_bh_disable();
+	kernel_vector_begin();
+
+	if (unlikely(!m || !*raw_cpu_ptr(m->scratch)))
+		goto out;
+
+	scratch = *raw_cpu_ptr(m->scratch);
+
+	map_index = scratch->map_index;
+
+	res_map  = scratch->map + (map_index ? m->bsize_max : 0);
+	fill_map = scratch->map + (map_index ? 0 : m->bsize_max);
+
+	/* Starting map doesn't need to be set for this implementation */
+
+	nft_pipapo_for_each_field(f, i, m) {
+		bool last = i == m->field_count - 1;
+		int b;
+
+		nft_pipapo_rvv_and_field(f, res_map, rp, !i, vtype);
+		NFT_PIPAPO_GROUP_BITS_ARE_8_OR_4;
+
+		rp += f->groups / NFT_PIPAPO_GROUPS_PER_BYTE(f);
+
+next_match:
+		b = pipapo_refill(res_map, f->bsize, f->rules, fill_map, f->mt,
+				  last);
+		if (b < 0) {
+			scratch->map_index = map_index;
+			kernel_vector_end();
+			local_bh_enable();
+
+			return false;
+		}
+
+		if (last) {
+			*ext = &f->mt[b].e->ext;
+			if (unlikely(nft_set_elem_expired(*ext) ||
+				     !nft_set_elem_active(*ext, genmask)))
+				goto next_match;
+
+			scratch->map_index = map_index;
+			kernel_vector_end();
+			local_bh_enable();
+
+			return true;
+		}
+
+		map_index = !map_index;
+		swap(res_map, fill_map);
+
+		rp += NFT_PIPAPO_GROUPS_PADDING(f);
+	}
+
+out:
+	kernel_vector_end();
+	local_bh_enable();
+	return false;
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef _NFT_SET_PIPAPO_RVV_H
+#define _NFT_SET_PIPAPO_RVV_H
+
+#if defined(CONFIG_RISCV_ISA_V) && defined(CONFIG_64BIT)
+bool nft_pipapo_rvv_estimate(const struct nft_set_desc *desc, u32 features,
+			     struct nft_set_estimate *est);
+#endif /* defined(CONFIG_RISCV_ISA_V) && defined(CONFIG_64BIT) */
+
+#endif /* _NFT_SET_PIPAPO_RVV_H */
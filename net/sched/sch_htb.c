@@ -33,6 +33,9 @@
 #include <linux/rbtree.h>
 #include <linux/workqueue.h>
 #include <linux/slab.h>
+#include <linux/bitmap.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
 #include <net/netlink.h>
 #include <net/sch_generic.h>
 #include <net/pkt_sched.h>
@@ -97,6 +100,7 @@ struct htb_class {
 	struct psched_ratecfg	ceil;
 	s64			buffer, cbuffer;/* token bucket depth/rate */
 	s64			mbuffer;	/* max wait time */
+	seqcount_t		cfg_seq;	/* rate, ceil and buffers, mq mode */
 	u32			prio;		/* these two are used only by leaves... */
 	int			quantum;	/* but stored for parent-to-leaf return */
 
@@ -120,6 +124,10 @@ struct htb_class {
 	s64			tokens, ctokens;/* current number of tokens */
 	s64			t_c;		/* checkpoint time */
 
+	/* mq mode: inner buckets are shared, leaves draw credit per CPU */
+	spinlock_t		mq_lock;
+	struct htb_mq_credit __percpu *mq_credit;
+
 	union {
 		struct htb_class_leaf {
 			int		deficit[TC_HTB_MAXDEPTH];
@@ -179,7 +187,12 @@ struct htb_sched {
 	struct Qdisc		**direct_qdiscs;
 	unsigned int            num_direct_qdiscs;
 
+	/* mq mode, see htb_mq_setup_tc() */
+	struct Qdisc		**mq_shapers;
+	unsigned long		*mq_queues;
+
 	bool			offload;
+	bool			mq;	/* software offload, implies offload */
 };
 
 /* find class in global hash table using given handle */
@@ -1018,6 +1031,399 @@ static void htb_reset(struct Qdisc *sch)
 	memset(q->row_mask, 0, sizeof(q->row_mask));
 }
 
+/* Software multi-queue mode (TCA_HTB_MQ).
+ *
+ * The root lock of the classic HTB is taken by every CPU for every packet.
+ * In mq mode the class tree is managed exactly like in the offload mode,
+ * except that htb_mq_setup_tc() plays the part of the driver: every leaf
+ * owns one tx queue, and traffic is steered to the queues from outside,
+ * e.g. with skbedit queue_mapping in clsact. The root of each leaf queue is
+ * an internal htb_txq qdisc which shapes the leaf under that queue's lock
+ * only, so the leaf's own buckets need no further locking.
+ *
+ * Inner classes are shared by all their descendants' queues. Their buckets
+ * are guarded by mq_lock, but CPUs don't take it for every packet: credit
+ * is taken from the shared bucket in batches worth HTB_MQ_BATCH bytes and
+ * spent from a per-CPU cache, which also collects the debt of packets that
+ * didn't borrow. Both are settled with the shared bucket when the cache
+ * runs dry, so the error is bounded by a batch per CPU and class.
+ */
+#define HTB_MQ_BATCH		(16 * 1024)
+#define HTB_MQ_RETRY_NS		(100 * NSEC_PER_USEC)
+
+struct htb_mq_credit {
+	s64	tokens;
+	s64	ctokens;
+};
+
+struct htb_mq_cfg {
+	struct psched_ratecfg	rate;
+	struct psched_ratecfg	ceil;
+	s64			buffer, cbuffer;
+};
+
+struct htb_txq_sched {
+	struct Qdisc		*child;
+	struct htb_class	*cl;	/* leaf shaped on this queue */
+	struct qdisc_watchdog	watchdog;
+};
+
+/* The parameters may be changed under the root lock, which the data path
+ * of mq mode doesn't take.
+ */
+static void htb_mq_read_cfg(struct htb_class *cl, struct htb_mq_cfg *cfg)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&cl->cfg_seq);
+		cfg->rate = cl->rate;
+		cfg->ceil = cl->ceil;
+		cfg->buffer = cl->buffer;
+		cfg->cbuffer = cl->cbuffer;
+	} while (read_seqcount_retry(&cl->cfg_seq, seq));
+}
+
+/* Return the local credit or debt of this CPU to the shared buckets of an
+ * inner class, and take a new batch from each of them that isn't empty.
+ */
+static void htb_mq_settle(struct htb_class *cl, const struct htb_mq_cfg *cfg,
+			  struct htb_mq_credit *credit, int bytes, s64 now)
+{
+	int batch = max(bytes, HTB_MQ_BATCH);
+	s64 diff = 0;
+
+	spin_lock(&cl->mq_lock);
+	if (now > cl->t_c) {
+		diff = min_t(s64, now - cl->t_c, cl->mbuffer);
+		cl->t_c = now;
+	}
+
+	cl->tokens = clamp_t(s64, cl->tokens + diff + credit->tokens,
+			     1 - cl->mbuffer, cfg->buffer);
+	credit->tokens = 0;
+	if (cl->tokens >= 0) {
+		credit->tokens = psched_l2t_ns(&cfg->rate, batch);
+		cl->tokens -= credit->tokens;
+	}
+
+	cl->ctokens = clamp_t(s64, cl->ctokens + diff + credit->ctokens,
+			      1 - cl->mbuffer, cfg->cbuffer);
+	credit->ctokens = 0;
+	if (cl->ctokens >= 0) {
+		credit->ctokens = psched_l2t_ns(&cfg->ceil, batch);
+		cl->ctokens -= credit->ctokens;
+	}
+	spin_unlock(&cl->mq_lock);
+}
+
+static enum htb_cmode htb_mq_class_mode(struct htb_class *cl, int bytes,
+					s64 now)
+{
+	struct htb_mq_credit *credit = this_cpu_ptr(cl->mq_credit);
+	struct htb_mq_cfg cfg;
+	s64 cost, ccost;
+
+	htb_mq_read_cfg(cl, &cfg);
+	cost = psched_l2t_ns(&cfg.rate, bytes);
+	ccost = psched_l2t_ns(&cfg.ceil, bytes);
+
+	if (credit->tokens < cost || credit->ctokens < ccost)
+		htb_mq_settle(cl, &cfg, credit, bytes, now);
+
+	if (credit->ctokens < ccost)
+		return HTB_CANT_SEND;
+	return credit->tokens < cost ? HTB_MAY_BORROW : HTB_CAN_SEND;
+}
+
+/* Like the classic mode, a leaf out of tokens may borrow from the nearest
+ * ancestor that is within its rate, if nothing in between is over its ceil.
+ */
+static bool htb_mq_borrow(struct htb_class *leaf, int bytes, s64 now)
+{
+	struct htb_class *cl;
+
+	for (cl = leaf->parent; cl; cl = cl->parent) {
+		switch (htb_mq_class_mode(cl, bytes, now)) {
+		case HTB_CAN_SEND:
+			return true;
+		case HTB_CANT_SEND:
+			return false;
+		case HTB_MAY_BORROW:
+			break;
+		}
+	}
+
+	return false;
+}
+
+static void htb_mq_charge_ancestors(struct htb_class *cl, int bytes, s64 now)
+{
+	struct htb_mq_credit *credit;
+	struct htb_mq_cfg cfg;
+
+	for (; cl; cl = cl->parent) {
+		credit = this_cpu_ptr(cl->mq_credit);
+		htb_mq_read_cfg(cl, &cfg);
+
+		credit->tokens -= psched_l2t_ns(&cfg.rate, bytes);
+		credit->ctokens -= psched_l2t_ns(&cfg.ceil, bytes);
+
+		/* Don't let the shared buckets lag behind too much. */
+		if (credit->tokens < -(s64)psched_l2t_ns(&cfg.rate, HTB_MQ_BATCH) ||
+		    credit->ctokens < -(s64)psched_l2t_ns(&cfg.ceil, HTB_MQ_BATCH))
+			htb_mq_settle(cl, &cfg, credit, bytes, now);
+	}
+}
+
+/**
+ * htb_mq_charge - charges a packet to a leaf and its ancestors in mq mode
+ * @leaf: the leaf class, only ever used from the queue it owns
+ * @bytes: the packet length
+ * @now: current time
+ *
+ * Returns 0 if the packet may be sent, and has been charged, or the time
+ * to wait before trying again otherwise.
+ */
+static s64 htb_mq_charge(struct htb_class *leaf, int bytes, s64 now)
+{
+	struct htb_mq_cfg cfg;
+	s64 toks, ctoks, diff;
+
+	htb_mq_read_cfg(leaf, &cfg);
+	diff = min_t(s64, now - leaf->t_c, leaf->mbuffer);
+	toks = min_t(s64, leaf->tokens + diff, cfg.buffer);
+	ctoks = min_t(s64, leaf->ctokens + diff, cfg.cbuffer);
+
+	if (ctoks < 0)
+		return -ctoks;
+
+	if (toks < 0) {
+		/* The ancestors' state is only known on this CPU, so there
+		 * is no exact time to wait for them.
+		 */
+		if (!htb_mq_borrow(leaf, bytes, now))
+			return min_t(s64, -toks, HTB_MQ_RETRY_NS);
+		leaf->xstats.borrows++;
+	}
+
+	toks -= (s64)psched_l2t_ns(&cfg.rate, bytes);
+	ctoks -= (s64)psched_l2t_ns(&cfg.ceil, bytes);
+	leaf->tokens = max_t(s64, toks, 1 - leaf->mbuffer);
+	leaf->ctokens = max_t(s64, ctoks, 1 - leaf->mbuffer);
+	leaf->t_c = now;
+
+	htb_mq_charge_ancestors(leaf->parent, bytes, now);
+
+	return 0;
+}
+
+static void htb_mq_reset_credit(struct htb_class *cl)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(cl->mq_credit, cpu), 0,
+		       sizeof(struct htb_mq_credit));
+}
+
+static void htb_txq_sync(struct Qdisc *sch)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+
+	sch->q.qlen = txq->child->q.qlen;
+	sch->qstats.backlog = txq->child->qstats.backlog;
+}
+
+static int htb_txq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+			   struct sk_buff **to_free)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+	int ret;
+
+	ret = qdisc_enqueue(skb, txq->child, to_free);
+	if (ret != NET_XMIT_SUCCESS) {
+		if (net_xmit_drop_count(ret))
+			qdisc_qstats_drop(sch);
+		return ret;
+	}
+
+	htb_txq_sync(sch);
+	return NET_XMIT_SUCCESS;
+}
+
+static struct sk_buff *htb_txq_dequeue(struct Qdisc *sch)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+	struct htb_class *cl = txq->cl;
+	struct sk_buff *skb;
+	s64 now, wait;
+
+	skb = txq->child->ops->peek(txq->child);
+	if (!skb)
+		return NULL;
+
+	if (cl) {
+		now = ktime_get_ns();
+		wait = htb_mq_charge(cl, qdisc_pkt_len(skb), now);
+		if (wait) {
+			cl->overlimits++;
+			qdisc_qstats_overlimit(sch);
+			qdisc_watchdog_schedule_ns(&txq->watchdog, now + wait);
+			return NULL;
+		}
+	}
+
+	skb = qdisc_dequeue_peeked(txq->child);
+	if (skb)
+		qdisc_bstats_update(sch, skb);
+	htb_txq_sync(sch);
+
+	return skb;
+}
+
+static int htb_txq_init(struct Qdisc *sch, struct nlattr *opt,
+			struct netlink_ext_ack *extack)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+
+	txq->child = &noop_qdisc;
+	qdisc_watchdog_init(&txq->watchdog, sch);
+
+	return 0;
+}
+
+static void htb_txq_reset(struct Qdisc *sch)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+
+	qdisc_reset(txq->child);
+	htb_txq_sync(sch);
+	qdisc_watchdog_cancel(&txq->watchdog);
+}
+
+static void htb_txq_destroy(struct Qdisc *sch)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+
+	qdisc_watchdog_cancel(&txq->watchdog);
+	qdisc_put(txq->child);
+}
+
+/* Root of a leaf queue in mq mode, never visible to the user. */
+static struct Qdisc_ops htb_txq_qdisc_ops __read_mostly = {
+	.id		=	"htb_txq",
+	.priv_size	=	sizeof(struct htb_txq_sched),
+	.enqueue	=	htb_txq_enqueue,
+	.dequeue	=	htb_txq_dequeue,
+	.peek		=	qdisc_peek_dequeued,
+	.init		=	htb_txq_init,
+	.reset		=	htb_txq_reset,
+	.destroy	=	htb_txq_destroy,
+	.owner		=	THIS_MODULE,
+};
+
+static struct Qdisc *htb_txq_graft(struct Qdisc *sch, struct Qdisc *new_q)
+{
+	struct htb_txq_sched *txq = qdisc_priv(sch);
+	struct Qdisc *old_q;
+
+	if (new_q)
+		new_q->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+
+	sch_tree_lock(sch);
+	old_q = txq->child;
+	txq->child = new_q ? new_q : &noop_qdisc;
+	htb_txq_sync(sch);
+	sch_tree_unlock(sch);
+
+	return old_q;
+}
+
+static struct Qdisc *htb_txq_of(struct netdev_queue *dev_queue)
+{
+	struct Qdisc *sch = rtnl_dereference(dev_queue->qdisc_sleeping);
+
+	/* The shapers are gone already when HTB is being replaced. */
+	return sch->ops == &htb_txq_qdisc_ops ? sch : NULL;
+}
+
+/* Make the shaper of @dev_queue account @cl instead of @old. */
+static void htb_txq_set_class(struct netdev_queue *dev_queue,
+			      struct htb_class *old, struct htb_class *cl)
+{
+	struct Qdisc *sch = htb_txq_of(dev_queue);
+	struct htb_txq_sched *txq;
+
+	if (!sch)
+		return;
+
+	txq = qdisc_priv(sch);
+	sch_tree_lock(sch);
+	if (txq->cl == old)
+		txq->cl = cl;
+	sch_tree_unlock(sch);
+
+	if (!cl)
+		qdisc_watchdog_cancel(&txq->watchdog);
+}
+
+static unsigned int htb_mq_qid(struct net_device *dev, struct htb_class *cl)
+{
+	return cl->leaf.offload_queue - netdev_get_tx_queue(dev, 0);
+}
+
+/* Queue 0 carries the unshaped traffic, the others are given to leaves. */
+static int htb_mq_setup_tc(struct Qdisc *sch, struct tc_htb_qopt_offload *opt)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+	struct htb_class *cl;
+	unsigned int qid;
+
+	switch (opt->command) {
+	case TC_HTB_CREATE:
+	case TC_HTB_DESTROY:
+	case TC_HTB_NODE_MODIFY:
+		return 0;
+	case TC_HTB_LEAF_ALLOC_QUEUE:
+		qid = find_next_zero_bit(q->mq_queues, dev->real_num_tx_queues,
+					 q->num_direct_qdiscs);
+		if (qid >= dev->real_num_tx_queues) {
+			NL_SET_ERR_MSG(opt->extack, "No tx queue left for the HTB leaf");
+			return -ENOSPC;
+		}
+		__set_bit(qid, q->mq_queues);
+		opt->qid = qid;
+		return 0;
+	case TC_HTB_LEAF_TO_INNER:
+		cl = htb_find(TC_H_MAJ(sch->handle) | opt->parent_classid, sch);
+		htb_txq_set_class(cl->leaf.offload_queue, cl, NULL);
+		return 0;
+	case TC_HTB_LEAF_DEL:
+		cl = htb_find(opt->classid, sch);
+		htb_txq_set_class(cl->leaf.offload_queue, cl, NULL);
+		__clear_bit(htb_mq_qid(dev, cl), q->mq_queues);
+		/* No other leaf is moved to the freed queue. */
+		opt->classid = TC_H_MIN(opt->classid);
+		return 0;
+	case TC_HTB_LEAF_DEL_LAST:
+	case TC_HTB_LEAF_DEL_LAST_FORCE:
+		/* The queue is handed over to the parent. */
+		cl = htb_find(opt->classid, sch);
+		htb_txq_set_class(cl->leaf.offload_queue, cl, NULL);
+		return 0;
+	case TC_HTB_LEAF_QUERY_QUEUE:
+		cl = htb_find(TC_H_MAJ(sch->handle) | opt->classid, sch);
+		if (!cl || cl->level)
+			return -ENOENT;
+		opt->qid = htb_mq_qid(dev, cl);
+		return 0;
+	}
+
+	return -EOPNOTSUPP;
+}
+
 static const struct nla_policy htb_policy[TCA_HTB_MAX + 1] = {
 	[TCA_HTB_PARMS]	= { .len = sizeof(struct tc_htb_opt) },
 	[TCA_HTB_INIT]	= { .len = sizeof(struct tc_htb_glob) },
@@ -1027,6 +1433,7 @@ static const struct nla_policy htb_policy[TCA_HTB_MAX + 1] = {
 	[TCA_HTB_RATE64] = { .type = NLA_U64 },
 	[TCA_HTB_CEIL64] = { .type = NLA_U64 },
 	[TCA_HTB_OFFLOAD] = { .type = NLA_FLAG },
+	[TCA_HTB_MQ] = { .type = NLA_FLAG },
 };
 
 static void htb_work_func(struct work_struct *work)
@@ -1046,8 +1453,13 @@ static void htb_set_lockdep_class_child(struct Qdisc *q)
 	lockdep_set_class(qdisc_lock(q), &child_key);
 }
 
-static int htb_offload(struct net_device *dev, struct tc_htb_qopt_offload *opt)
+static int htb_offload(struct Qdisc *sch, struct tc_htb_qopt_offload *opt)
 {
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+
+	if (q->mq)
+		return htb_mq_setup_tc(sch, opt);
 	return dev->netdev_ops->ndo_setup_tc(dev, TC_SETUP_QDISC_HTB, opt);
 }
 
@@ -1060,7 +1472,7 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 	struct nlattr *tb[TCA_HTB_MAX + 1];
 	struct tc_htb_glob *gopt;
 	unsigned int ntx;
-	bool offload;
+	bool offload, mq;
 	int err;
 
 	qdisc_watchdog_init(&q->watchdog, sch);
@@ -1086,6 +1498,12 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		return -EINVAL;
 
 	offload = nla_get_flag(tb[TCA_HTB_OFFLOAD]);
+	mq = nla_get_flag(tb[TCA_HTB_MQ]);
+
+	if (offload && mq) {
+		NL_SET_ERR_MSG(extack, "HTB offload and mq mode are mutually exclusive");
+		return -EINVAL;
+	}
 
 	if (offload) {
 		if (sch->parent != TC_H_ROOT) {
@@ -1106,6 +1524,34 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 			return -ENOMEM;
 	}
 
+	if (mq) {
+		if (sch->parent != TC_H_ROOT) {
+			NL_SET_ERR_MSG(extack, "HTB must be the root qdisc to use mq mode");
+			return -EOPNOTSUPP;
+		}
+
+		if (dev->real_num_tx_queues < 2) {
+			NL_SET_ERR_MSG(extack, "HTB mq mode needs a device with several tx queues");
+			return -EOPNOTSUPP;
+		}
+
+		if (gopt->defcls) {
+			NL_SET_ERR_MSG(extack, "HTB mq mode doesn't support a default class");
+			return -EINVAL;
+		}
+
+		q->mq = true;
+		q->num_direct_qdiscs = 1;
+		q->direct_qdiscs = kcalloc(q->num_direct_qdiscs,
+					   sizeof(*q->direct_qdiscs),
+					   GFP_KERNEL);
+		q->mq_shapers = kcalloc(dev->num_tx_queues,
+					sizeof(*q->mq_shapers), GFP_KERNEL);
+		q->mq_queues = bitmap_zalloc(dev->num_tx_queues, GFP_KERNEL);
+		if (!q->direct_qdiscs || !q->mq_shapers || !q->mq_queues)
+			return -ENOMEM;
+	}
+
 	err = qdisc_class_hash_init(&q->clhash);
 	if (err < 0)
 		return err;
@@ -1119,7 +1565,7 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		q->rate2quantum = 1;
 	q->defcls = gopt->defcls;
 
-	if (!offload)
+	if (!offload && !mq)
 		return 0;
 
 	for (ntx = 0; ntx < q->num_direct_qdiscs; ntx++) {
@@ -1137,6 +1583,21 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		qdisc->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
 	}
 
+	for (ntx = q->num_direct_qdiscs; mq && ntx < dev->real_num_tx_queues;
+	     ntx++) {
+		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, ntx);
+		struct Qdisc *qdisc;
+
+		qdisc = qdisc_create_dflt(dev_queue, &htb_txq_qdisc_ops,
+					  TC_H_MAKE(sch->handle, 0), extack);
+		if (!qdisc)
+			return -ENOMEM;
+
+		htb_set_lockdep_class_child(qdisc);
+		q->mq_shapers[ntx] = qdisc;
+		qdisc->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+	}
+
 	sch->flags |= TCQ_F_MQROOT;
 
 	offload_opt = (struct tc_htb_qopt_offload) {
@@ -1145,7 +1606,7 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		.classid = TC_H_MIN(q->defcls),
 		.extack = extack,
 	};
-	err = htb_offload(dev, &offload_opt);
+	err = htb_offload(sch, &offload_opt);
 	if (err)
 		return err;
 
@@ -1172,13 +1633,18 @@ static void htb_attach_offload(struct Qdisc *sch)
 	}
 	for (ntx = q->num_direct_qdiscs; ntx < dev->num_tx_queues; ntx++) {
 		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, ntx);
-		struct Qdisc *old = dev_graft_qdisc(dev_queue, NULL);
+		struct Qdisc *old, *qdisc = NULL;
 
+		if (q->mq_shapers)
+			qdisc = q->mq_shapers[ntx];
+		old = dev_graft_qdisc(dev_queue, qdisc);
 		qdisc_put(old);
 	}
 
 	kfree(q->direct_qdiscs);
 	q->direct_qdiscs = NULL;
+	kfree(q->mq_shapers);
+	q->mq_shapers = NULL;
 }
 
 static void htb_attach_software(struct Qdisc *sch)
@@ -1213,7 +1679,7 @@ static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 	struct nlattr *nest;
 	struct tc_htb_glob gopt;
 
-	if (q->offload)
+	if (q->offload && !q->mq)
 		sch->flags |= TCQ_F_OFFLOADED;
 	else
 		sch->flags &= ~TCQ_F_OFFLOADED;
@@ -1235,7 +1701,9 @@ static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 	if (nla_put(skb, TCA_HTB_INIT, sizeof(gopt), &gopt) ||
 	    nla_put_u32(skb, TCA_HTB_DIRECT_QLEN, q->direct_qlen))
 		goto nla_put_failure;
-	if (q->offload && nla_put_flag(skb, TCA_HTB_OFFLOAD))
+	if (q->offload && !q->mq && nla_put_flag(skb, TCA_HTB_OFFLOAD))
+		goto nla_put_failure;
+	if (q->mq && nla_put_flag(skb, TCA_HTB_MQ))
 		goto nla_put_failure;
 
 	return nla_nest_end(skb, nest);
@@ -1276,7 +1744,9 @@ static int htb_dump_class(struct Qdisc *sch, unsigned long arg,
 	opt.level = cl->level;
 	if (nla_put(skb, TCA_HTB_PARMS, sizeof(opt), &opt))
 		goto nla_put_failure;
-	if (q->offload && nla_put_flag(skb, TCA_HTB_OFFLOAD))
+	if (q->offload && !q->mq && nla_put_flag(skb, TCA_HTB_OFFLOAD))
+		goto nla_put_failure;
+	if (q->mq && nla_put_flag(skb, TCA_HTB_MQ))
 		goto nla_put_failure;
 	if ((cl->rate.rate_bytes_ps >= (1ULL << 32)) &&
 	    nla_put_u64_64bit(skb, TCA_HTB_RATE64, cl->rate.rate_bytes_ps,
@@ -1380,7 +1850,7 @@ htb_select_queue(struct Qdisc *sch, struct tcmsg *tcm)
 		.command = TC_HTB_LEAF_QUERY_QUEUE,
 		.classid = TC_H_MIN(tcm->tcm_parent),
 	};
-	err = htb_offload(dev, &offload_opt);
+	err = htb_offload(sch, &offload_opt);
 	if (err || offload_opt.qid >= dev->num_tx_queues)
 		return NULL;
 	return netdev_get_tx_queue(dev, offload_opt.qid);
@@ -1390,7 +1860,12 @@ static struct Qdisc *
 htb_graft_helper(struct netdev_queue *dev_queue, struct Qdisc *new_q)
 {
 	struct net_device *dev = dev_queue->dev;
-	struct Qdisc *old_q;
+	struct Qdisc *old_q, *shaper;
+
+	/* In mq mode the leaf qdisc sits below the shaper of the queue. */
+	shaper = htb_txq_of(dev_queue);
+	if (shaper)
+		return htb_txq_graft(shaper, new_q);
 
 	if (dev->flags & IFF_UP)
 		dev_deactivate(dev);
@@ -1529,6 +2004,8 @@ static void htb_parent_to_leaf(struct Qdisc *sch, struct htb_class *cl,
 	parent->cmode = HTB_CAN_SEND;
 	if (q->offload)
 		parent->leaf.offload_queue = cl->leaf.offload_queue;
+	if (q->mq)
+		htb_mq_reset_credit(parent);
 }
 
 static void htb_parent_to_leaf_offload(struct Qdisc *sch,
@@ -1584,7 +2061,7 @@ static int htb_destroy_class_offload(struct Qdisc *sch, struct htb_class *cl,
 		.classid = cl->common.classid,
 		.extack = extack,
 	};
-	err = htb_offload(qdisc_dev(sch), &offload_opt);
+	err = htb_offload(sch, &offload_opt);
 
 	if (!destroying) {
 		if (!err)
@@ -1615,6 +2092,7 @@ static void htb_destroy_class(struct Qdisc *sch, struct htb_class *cl)
 	}
 	gen_kill_estimator(&cl->rate_est);
 	tcf_block_put(cl->block);
+	free_percpu(cl->mq_credit);
 	kfree(cl);
 }
 
@@ -1686,7 +2164,15 @@ static void htb_destroy(struct Qdisc *sch)
 		offload_opt = (struct tc_htb_qopt_offload) {
 			.command = TC_HTB_DESTROY,
 		};
-		htb_offload(dev, &offload_opt);
+		htb_offload(sch, &offload_opt);
+	}
+
+	bitmap_free(q->mq_queues);
+	if (q->mq_shapers) {
+		for (i = 0; i < dev->num_tx_queues; i++)
+			if (q->mq_shapers[i])
+				qdisc_put(q->mq_shapers[i]);
+		kfree(q->mq_shapers);
 	}
 
 	if (!q->direct_qdiscs)
@@ -1762,6 +2248,10 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg,
 
 	sch_tree_unlock(sch);
 
+	if (q->mq && last_child)
+		htb_txq_set_class(cl->parent->leaf.offload_queue, NULL,
+				  cl->parent);
+
 	htb_destroy_class(sch, cl);
 	return 0;
 }
@@ -1779,6 +2269,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	struct Qdisc *parent_qdisc = NULL;
 	struct netdev_queue *dev_queue;
 	struct tc_htb_opt *hopt;
+	bool created = false;
 	u64 rate64, ceil64;
 	int warn = 0;
 
@@ -1801,7 +2292,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	if (!hopt->rate.rate || !hopt->ceil.rate)
 		goto failure;
 
-	if (q->offload) {
+	if (q->offload && !q->mq) {
 		/* Options not supported by the offload. */
 		if (hopt->rate.overhead || hopt->ceil.overhead) {
 			NL_SET_ERR_MSG(extack, "HTB offload doesn't support the overhead parameter");
@@ -1859,11 +2350,22 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		if (!cl)
 			goto failure;
 
+		if (q->mq) {
+			cl->mq_credit = alloc_percpu(struct htb_mq_credit);
+			if (!cl->mq_credit) {
+				kfree(cl);
+				goto failure;
+			}
+		}
+		spin_lock_init(&cl->mq_lock);
+		seqcount_init(&cl->cfg_seq);
+
 		gnet_stats_basic_sync_init(&cl->bstats);
 		gnet_stats_basic_sync_init(&cl->bstats_bias);
 
 		err = tcf_block_get(&cl->block, &cl->filter_list, sch, extack);
 		if (err) {
+			free_percpu(cl->mq_credit);
 			kfree(cl);
 			goto failure;
 		}
@@ -1910,7 +2412,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 				.quantum = hopt->quantum,
 				.extack = extack,
 			};
-			err = htb_offload(dev, &offload_opt);
+			err = htb_offload(sch, &offload_opt);
 			if (err) {
 				NL_SET_ERR_MSG_WEAK(extack,
 						    "Failed to offload TC_HTB_LEAF_ALLOC_QUEUE");
@@ -1932,7 +2434,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 				.quantum = hopt->quantum,
 				.extack = extack,
 			};
-			err = htb_offload(dev, &offload_opt);
+			err = htb_offload(sch, &offload_opt);
 			if (err) {
 				NL_SET_ERR_MSG_WEAK(extack,
 						    "Failed to offload TC_HTB_LEAF_TO_INNER");
@@ -1996,6 +2498,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 			parent->children++;
 		if (cl->leaf.q != &noop_qdisc)
 			qdisc_hash_add(cl->leaf.q, true);
+		created = true;
 	} else {
 		if (tca[TCA_RATE]) {
 			err = gen_replace_estimator(&cl->bstats, NULL,
@@ -2008,8 +2511,6 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		}
 
 		if (q->offload) {
-			struct net_device *dev = qdisc_dev(sch);
-
 			offload_opt = (struct tc_htb_qopt_offload) {
 				.command = TC_HTB_NODE_MODIFY,
 				.classid = cl->common.classid,
@@ -2019,7 +2520,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 				.quantum = hopt->quantum,
 				.extack = extack,
 			};
-			err = htb_offload(dev, &offload_opt);
+			err = htb_offload(sch, &offload_opt);
 			if (err)
 				/* Estimator was replaced, and rollback may fail
 				 * as well, so we don't try to recover it, and
@@ -2033,6 +2534,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		sch_tree_lock(sch);
 	}
 
+	write_seqcount_begin(&cl->cfg_seq);
 	psched_ratecfg_precompute(&cl->rate, &hopt->rate, rate64);
 	psched_ratecfg_precompute(&cl->ceil, &hopt->ceil, ceil64);
 
@@ -2061,10 +2563,14 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 
 	cl->buffer = PSCHED_TICKS2NS(hopt->buffer);
 	cl->cbuffer = PSCHED_TICKS2NS(hopt->cbuffer);
+	write_seqcount_end(&cl->cfg_seq);
 
 	sch_tree_unlock(sch);
 	qdisc_put(parent_qdisc);
 
+	if (q->mq && created)
+		htb_txq_set_class(cl->leaf.offload_queue, NULL, cl);
+
 	if (warn)
 		NL_SET_ERR_MSG_FMT_MOD(extack,
 				       "quantum of class %X is %s. Consider r2q change.",
@@ -2079,6 +2585,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	gen_kill_estimator(&cl->rate_est);
 err_block_put:
 	tcf_block_put(cl->block);
+	free_percpu(cl->mq_credit);
 	kfree(cl);
 failure:
 	return err;
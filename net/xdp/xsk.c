@@ -33,6 +33,7 @@
 #include "xsk.h"
 
 #define TX_BATCH_SIZE 32
+#define GENERIC_XMIT_BATCH 16
 #define MAX_PER_SOCKET_BUDGET (TX_BATCH_SIZE)
 
 static DEFINE_PER_CPU(struct list_head, xskmap_flush_list);
@@ -538,16 +539,17 @@ static int xsk_wakeup(struct xdp_sock *xs, u8 flags)
 	return dev->netdev_ops->ndo_xsk_wakeup(dev, xs->queue_id, flags);
 }
 
-static int xsk_cq_reserve_addr_locked(struct xdp_sock *xs, u64 addr)
+static u32 xsk_cq_reserve_addrs_locked(struct xdp_sock *xs,
+				       struct xdp_desc *descs, u32 nb)
 {
 	unsigned long flags;
-	int ret;
 
 	spin_lock_irqsave(&xs->pool->cq_lock, flags);
-	ret = xskq_prod_reserve_addr(xs->pool->cq, addr);
+	nb = xskq_prod_nb_free(xs->pool->cq, nb);
+	xskq_prod_write_addr_batch(xs->pool->cq, descs, nb);
 	spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
 
-	return ret;
+	return nb;
 }
 
 static void xsk_cq_submit_locked(struct xdp_sock *xs, u32 n)
@@ -611,7 +613,8 @@ static void xsk_drop_skb(struct sk_buff *skb)
 }
 
 static struct sk_buff *xsk_build_skb_zerocopy(struct xdp_sock *xs,
-					      struct xdp_desc *desc)
+					      struct xdp_desc *desc,
+					      struct sk_buff *head)
 {
 	struct xsk_buff_pool *pool = xs->pool;
 	u32 hr, len, ts, offset, copy, copied;
@@ -624,7 +627,7 @@ static struct sk_buff *xsk_build_skb_zerocopy(struct xdp_sock *xs,
 	if (!skb) {
 		hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(xs->dev->needed_headroom));
 
-		skb = sock_alloc_send_skb(&xs->sk, hr, 1, &err);
+		skb = head ?: sock_alloc_send_skb(&xs->sk, hr, 1, &err);
 		if (unlikely(!skb))
 			return ERR_PTR(err);
 
@@ -664,7 +667,8 @@ static struct sk_buff *xsk_build_skb_zerocopy(struct xdp_sock *xs,
 }
 
 static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
-				     struct xdp_desc *desc)
+				     struct xdp_desc *desc,
+				     struct sk_buff *head)
 {
 	struct xsk_tx_metadata *meta = NULL;
 	struct net_device *dev = xs->dev;
@@ -673,7 +677,7 @@ static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
 	int err;
 
 	if (dev->priv_flags & IFF_TX_SKB_NO_LINEAR) {
-		skb = xsk_build_skb_zerocopy(xs, desc);
+		skb = xsk_build_skb_zerocopy(xs, desc, head);
 		if (IS_ERR(skb)) {
 			err = PTR_ERR(skb);
 			goto free_err;
@@ -688,7 +692,8 @@ static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
 		if (!skb) {
 			hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(dev->needed_headroom));
 			tr = dev->needed_tailroom;
-			skb = sock_alloc_send_skb(&xs->sk, hr + len + tr, 1, &err);
+			skb = head ?: sock_alloc_send_skb(&xs->sk, hr + len + tr,
+							  1, &err);
 			if (unlikely(!skb))
 				goto free_err;
 
@@ -769,26 +774,142 @@ static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
 	return skb;
 
 free_err:
-	if (err == -EOVERFLOW) {
-		/* Drop the packet */
-		xsk_set_destructor_arg(xs->skb);
-		xsk_drop_skb(xs->skb);
-		xskq_cons_release(xs->tx);
-	} else {
-		/* Let application retry */
-		xsk_cq_cancel_locked(xs, 1);
+	return ERR_PTR(err);
+}
+
+/* Read up to @max valid descriptors off the Tx ring, stopping at the first
+ * invalid one. They are only released locally, so the ones that end up not
+ * being sent can still be handed back with xskq_cons_cancel_n().
+ */
+static u32 xsk_tx_peek_descs(struct xdp_sock *xs, struct xdp_desc *descs,
+			     u32 max)
+{
+	struct xsk_queue *q = xs->tx;
+	u32 nb = 0;
+
+	if (!xskq_has_descs(q))
+		xskq_cons_get_entries(q);
+	else if (q->cached_prod - q->cached_cons < max)
+		__xskq_cons_peek(q);
+
+	while (nb < max && xskq_cons_read_desc(q, &descs[nb], xs->pool)) {
+		xskq_cons_release(q);
+		nb++;
 	}
 
-	return ERR_PTR(err);
+	return nb;
+}
+
+static void xsk_tx_cancel_descs(struct xdp_sock *xs, u32 n)
+{
+	if (!n)
+		return;
+
+	xskq_cons_cancel_n(xs->tx, n);
+	xsk_cq_cancel_locked(xs, n);
+}
+
+/* Allocate the skbs for all packets starting in @descs with one bulk
+ * request, charged to the socket the way sock_alloc_send_skb() does it.
+ * Packets left without one fall back to sock_alloc_send_skb().
+ */
+static u32 xsk_alloc_skbs(struct xdp_sock *xs, struct xdp_desc *descs,
+			  u32 nb, struct sk_buff **skbs)
+{
+	u32 sizes[GENERIC_XMIT_BATCH], hr, tr, i, n = 0;
+	struct net_device *dev = xs->dev;
+	struct sock *sk = &xs->sk;
+
+	if (READ_ONCE(sk->sk_err) ||
+	    (READ_ONCE(sk->sk_shutdown) & SEND_SHUTDOWN))
+		return 0;
+
+	hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(dev->needed_headroom));
+	tr = dev->needed_tailroom;
+
+	for (i = 0; i < nb; i++) {
+		if (i ? xp_mb_desc(&descs[i - 1]) : !!xs->skb)
+			continue;
+
+		if (dev->priv_flags & IFF_TX_SKB_NO_LINEAR)
+			sizes[n++] = hr;
+		else
+			sizes[n++] = hr + descs[i].len + tr;
+	}
+	if (n < 2)
+		return 0;
+
+	n = alloc_skb_bulk(skbs, sizes, n, sk->sk_allocation);
+	for (i = 0; i < n; i++) {
+		if (sk_wmem_alloc_get(sk) >= READ_ONCE(sk->sk_sndbuf))
+			break;
+		skb_set_owner_w(skbs[i], sk);
+	}
+	nb = i;
+	while (i < n)
+		consume_skb(skbs[i++]);
+
+	return nb;
+}
+
+/* Hand the complete packets in @skbs to the driver in one go. If it runs out
+ * of room, the packets it did not take and the partial one behind them, if
+ * any, are given back to user space to be retried.
+ */
+static int xsk_generic_xmit_skbs(struct xdp_sock *xs, struct sk_buff **skbs,
+				 u32 nb, bool *sent_frame)
+{
+	u32 i, sent, cancel = 0, retry;
+	struct sk_buff *partial;
+	int ret;
+
+	ret = __dev_direct_xmit_batch(skbs, nb, xs->queue_id, &sent);
+
+	for (i = 0; i < sent; i++) {
+		if (skbs[i]) {
+			*sent_frame = true;
+			break;
+		}
+	}
+
+	if (ret != NETDEV_TX_BUSY)
+		/* Ignore NET_XMIT_CN as packet might have been sent */
+		return ret == NET_XMIT_DROP ? -EBUSY : 0;
+
+	/* Descriptors can only be given back from the tail of the ring, so
+	 * packets ahead of one that was dropped complete as dropped too.
+	 */
+	retry = sent;
+	for (i = sent; i < nb; i++)
+		if (!skbs[i])
+			retry = i + 1;
+
+	for (i = sent; i < retry; i++)
+		if (skbs[i])
+			kfree_skb(skbs[i]);
+
+	/* Tell user-space to retry the send */
+	partial = xs->skb;
+	for (i = retry; i < nb; i++) {
+		cancel += xsk_get_num_desc(skbs[i]);
+		xsk_consume_skb(skbs[i]);
+	}
+	if (partial) {
+		cancel += xsk_get_num_desc(partial);
+		xsk_consume_skb(partial);
+	}
+	xskq_cons_cancel_n(xs->tx, cancel);
+
+	return -EAGAIN;
 }
 
 static int __xsk_generic_xmit(struct sock *sk)
 {
+	struct sk_buff *heads[GENERIC_XMIT_BATCH], *skbs[GENERIC_XMIT_BATCH];
+	struct xdp_desc descs[GENERIC_XMIT_BATCH];
 	struct xdp_sock *xs = xdp_sk(sk);
-	u32 max_batch = TX_BATCH_SIZE;
+	u32 budget = TX_BATCH_SIZE;
 	bool sent_frame = false;
-	struct xdp_desc desc;
-	struct sk_buff *skb;
 	int err = 0;
 
 	mutex_lock(&xs->mutex);
@@ -802,55 +923,92 @@ static int __xsk_generic_xmit(struct sock *sk)
 	if (xs->queue_id >= xs->dev->real_num_tx_queues)
 		goto out;
 
-	while (xskq_cons_peek_desc(xs->tx, &desc, xs->pool)) {
-		if (max_batch-- == 0) {
-			err = -EAGAIN;
-			goto out;
+	for (;;) {
+		u32 max = min_t(u32, budget, GENERIC_XMIT_BATCH);
+		u32 nb, nb_cq, nb_heads, head = 0, nb_skbs = 0, i;
+		struct sk_buff *skb = NULL;
+		int xmit_err = 0;
+
+		if (!budget) {
+			if (xskq_cons_peek_desc(xs->tx, &descs[0], xs->pool)) {
+				err = -EAGAIN;
+				goto out;
+			}
+			break;
 		}
 
+		nb = xsk_tx_peek_descs(xs, descs, max);
+		if (!nb)
+			break;
+		budget -= nb;
+
 		/* This is the backpressure mechanism for the Tx path.
 		 * Reserve space in the completion queue and only proceed
 		 * if there is space in it. This avoids having to implement
 		 * any buffering in the Tx path.
 		 */
-		if (xsk_cq_reserve_addr_locked(xs, desc.addr))
-			goto out;
-
-		skb = xsk_build_skb(xs, &desc);
-		if (IS_ERR(skb)) {
-			err = PTR_ERR(skb);
-			if (err != -EOVERFLOW)
+		nb_cq = xsk_cq_reserve_addrs_locked(xs, descs, nb);
+		if (nb_cq < nb) {
+			xskq_cons_cancel_n(xs->tx, nb - nb_cq);
+			budget = 0;
+			max = 0;
+			nb = nb_cq;
+			if (!nb)
 				goto out;
-			err = 0;
-			continue;
 		}
 
-		xskq_cons_release(xs->tx);
+		nb_heads = xsk_alloc_skbs(xs, descs, nb, heads);
 
-		if (xp_mb_desc(&desc)) {
-			xs->skb = skb;
-			continue;
+		for (i = 0; i < nb; i++) {
+			skb = xsk_build_skb(xs, &descs[i],
+					    !xs->skb && head < nb_heads ?
+					    heads[head++] : NULL);
+			if (IS_ERR(skb))
+				break;
+
+			if (xp_mb_desc(&descs[i])) {
+				xs->skb = skb;
+				continue;
+			}
+
+			skbs[nb_skbs++] = skb;
+			xs->skb = NULL;
 		}
 
-		err = __dev_direct_xmit(skb, xs->queue_id);
-		if  (err == NETDEV_TX_BUSY) {
-			/* Tell user-space to retry the send */
-			xskq_cons_cancel_n(xs->tx, xsk_get_num_desc(skb));
-			xsk_consume_skb(skb);
-			err = -EAGAIN;
-			goto out;
+		while (head < nb_heads)
+			consume_skb(heads[head++]);
+
+		/* Give back what was read past a failed descriptor first, so
+		 * that anything cancelled below sits at the tail of the rings.
+		 */
+		if (i < nb) {
+			err = PTR_ERR(skb);
+			if (err == -EOVERFLOW) {
+				xsk_tx_cancel_descs(xs, nb - i - 1);
+				xsk_set_destructor_arg(xs->skb);
+			} else {
+				/* Let application retry */
+				xsk_tx_cancel_descs(xs, nb - i);
+			}
 		}
 
-		/* Ignore NET_XMIT_CN as packet might have been sent */
-		if (err == NET_XMIT_DROP) {
-			/* SKB completed but not sent */
-			err = -EBUSY;
-			xs->skb = NULL;
-			goto out;
+		if (nb_skbs)
+			xmit_err = xsk_generic_xmit_skbs(xs, skbs, nb_skbs,
+							 &sent_frame);
+
+		if (err == -EOVERFLOW) {
+			/* Drop the packet, unless it was just handed back */
+			if (xs->skb)
+				xsk_drop_skb(xs->skb);
+			err = 0;
 		}
+		if (xmit_err)
+			err = xmit_err;
+		if (err || !max)
+			goto out;
 
-		sent_frame = true;
-		xs->skb = NULL;
+		if (nb < max)
+			break;
 	}
 
 	if (xskq_has_descs(xs->tx)) {
@@ -17,6 +17,7 @@
 #include <netdb.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <time.h>
 
 #include "../kselftest.h"
 #include "cgroup_util.h"
@@ -781,6 +782,160 @@ static int test_memcg_reclaim(const char *root)
 	return ret;
 }
 
+static int reclaim_hot_set_bench(const char *cgroup, void *arg)
+{
+	size_t hot_size = MB(20), cold_size = MB(100), chunk = MB(10);
+	long refaults, reclaimed, elapsed_ms;
+	struct timespec start, end;
+	int fd_hot, fd_cold, round;
+	char buf[PAGE_SIZE];
+	int ret = -1;
+	volatile char *hot;
+	size_t i;
+	off_t off;
+
+	fd_hot = get_temp_fd();
+	fd_cold = get_temp_fd();
+	if (fd_hot < 0 || fd_cold < 0)
+		goto close;
+
+	if (alloc_pagecache(fd_hot, hot_size) ||
+	    ftruncate(fd_cold, cold_size))
+		goto close;
+
+	hot = mmap(NULL, hot_size, PROT_READ, MAP_SHARED, fd_hot, 0);
+	if (hot == MAP_FAILED)
+		goto close;
+
+	refaults = cg_read_key_long(cgroup, "memory.stat",
+				    "workingset_refault_file ");
+	reclaimed = cg_read_key_long(cgroup, "memory.stat", "pgsteal ");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/*
+	 * Keep touching the mapped hot set while streaming cold data through
+	 * the rest of the limit, so reclaim has to age the hot set's page
+	 * tables over and over to tell the two apart.
+	 */
+	for (round = 0; round < 5; round++) {
+		for (off = 0; off < cold_size; off += chunk) {
+			for (i = 0; i < hot_size; i += PAGE_SIZE)
+				buf[0] += hot[i];
+			for (i = 0; i < chunk; i += sizeof(buf))
+				if (pread(fd_cold, buf, sizeof(buf), off + i) < 0)
+					goto unmap;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 +
+		     (end.tv_nsec - start.tv_nsec) / 1000000;
+	refaults = cg_read_key_long(cgroup, "memory.stat",
+				    "workingset_refault_file ") - refaults;
+	reclaimed = cg_read_key_long(cgroup, "memory.stat", "pgsteal ") -
+		    reclaimed;
+
+	ksft_print_msg("%s: hot set %zuM, streamed %zuM: %ld ms, %ld pages reclaimed, %ld refaults\n",
+		       (const char *)arg, hot_size >> 20, 5 * (cold_size >> 20),
+		       elapsed_ms, reclaimed, refaults);
+
+	if (cg_read_long(cgroup, "memory.current") <= MB(50))
+		ret = 0;
+unmap:
+	munmap((void *)hot, hot_size);
+close:
+	if (fd_hot >= 0)
+		close(fd_hot);
+	if (fd_cold >= 0)
+		close(fd_cold);
+	return ret;
+}
+
+#define LRU_GEN_ENABLED		"/sys/kernel/mm/lru_gen/enabled"
+#define LRU_GEN_CORE		0x0001
+#define LRU_GEN_MM_WALK		0x0002
+
+static long lru_gen_read_caps(void)
+{
+	FILE *f = fopen(LRU_GEN_ENABLED, "r");
+	long caps = -1;
+
+	if (!f)
+		return -1;
+	if (fscanf(f, "%li", &caps) != 1)
+		caps = -1;
+	fclose(f);
+
+	return caps;
+}
+
+static int lru_gen_write_caps(long caps)
+{
+	FILE *f = fopen(LRU_GEN_ENABLED, "w");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fprintf(f, "0x%lx", caps) < 0;
+	ret |= fclose(f) != 0;
+
+	return ret ? -1 : 0;
+}
+
+/*
+ * This test times a small hot set of mapped page cache competing with
+ * streamed reads in a cgroup limited to less than both, and reports how much
+ * of the hot set reclaim had to bring back in. It only fails on errors or if
+ * the limit is not kept; the numbers are for comparing reclaim changes.
+ *
+ * With the multi-gen LRU, the run is repeated with the page table walk of
+ * the aging disabled and enabled, to compare rmap-only aging with batched
+ * accessed-bit clearing. The kernel ignores the walk on CPUs which don't
+ * set the accessed bit in hardware, in which case both runs age the same.
+ */
+static int test_memcg_reclaim_hot_set(const char *root)
+{
+	int ret = KSFT_FAIL;
+	char *memcg;
+	long caps;
+
+	memcg = cg_name(root, "memcg_test");
+	if (!memcg)
+		goto cleanup;
+
+	if (cg_create(memcg))
+		goto cleanup;
+
+	if (cg_write(memcg, "memory.max", "50M"))
+		goto cleanup;
+
+	caps = lru_gen_read_caps();
+	if (caps < 0 || !(caps & LRU_GEN_CORE)) {
+		if (cg_run(memcg, reclaim_hot_set_bench, "active/inactive LRU"))
+			goto cleanup;
+		ret = KSFT_PASS;
+		goto cleanup;
+	}
+
+	if (lru_gen_write_caps(caps & ~LRU_GEN_MM_WALK) ||
+	    cg_run(memcg, reclaim_hot_set_bench, "MGLRU, rmap aging"))
+		goto restore;
+
+	if (lru_gen_write_caps(caps | LRU_GEN_MM_WALK) ||
+	    cg_run(memcg, reclaim_hot_set_bench, "MGLRU, page table walk"))
+		goto restore;
+
+	ret = KSFT_PASS;
+restore:
+	if (lru_gen_write_caps(caps))
+		ret = KSFT_FAIL;
+cleanup:
+	cg_destroy(memcg);
+	free(memcg);
+
+	return ret;
+}
+
 static int alloc_anon_50M_check_swap(const char *cgroup, void *arg)
 {
 	long mem_max = (long)arg;
@@ -1300,6 +1455,7 @@ struct memcg_test {
 	T(test_memcg_high_sync),
 	T(test_memcg_max),
 	T(test_memcg_reclaim),
+	T(test_memcg_reclaim_hot_set),
 	T(test_memcg_oom_events),
 	T(test_memcg_swap_max),
 	T(test_memcg_sock),
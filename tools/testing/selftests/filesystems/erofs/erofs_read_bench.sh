@@ -0,0 +1,58 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Sequential read throughput of a compressed erofs image on a tmpfs-backed
+# loop device, with and without parallel pcluster decompression.
+
+# return code to signal skipped test
+ksft_skip=4
+
+SIZE_MB=${SIZE_MB:-512}
+COMPR=${COMPR:-lz4hc}
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: Test needs root"
+	exit $ksft_skip
+fi
+if ! mkfs.erofs -V >/dev/null 2>&1; then
+	echo "SKIP: Test needs mkfs.erofs"
+	exit $ksft_skip
+fi
+
+tmp=$(mktemp -d)
+cleanup() {
+	umount "$tmp/mnt" 2>/dev/null
+	umount "$tmp" 2>/dev/null
+	rmdir "$tmp"
+}
+trap cleanup EXIT
+
+mount -t tmpfs -o size=$((SIZE_MB * 3))m tmpfs "$tmp" || exit 1
+mkdir "$tmp/src" "$tmp/mnt"
+
+# half random, half zeroes so that the image is moderately compressible
+head -c $((SIZE_MB / 2))M /dev/urandom > "$tmp/src/data"
+head -c $((SIZE_MB / 2))M /dev/zero >> "$tmp/src/data"
+mkfs.erofs -z"$COMPR" -C65536 "$tmp/img" "$tmp/src" >/dev/null || exit 1
+rm -f "$tmp/src/data"
+
+mount -t erofs -o loop "$tmp/img" "$tmp/mnt" || exit 1
+dev=$(basename "$(findmnt -no SOURCE "$tmp/mnt")")
+knob=/sys/fs/erofs/$dev/parallel_decompress
+if [ ! -w "$knob" ]; then
+	echo "SKIP: $knob not available"
+	exit $ksft_skip
+fi
+
+run() { # (parallel)
+	echo "$1" > "$knob"
+	echo 3 > /proc/sys/vm/drop_caches
+	start=$(date +%s%N)
+	dd if="$tmp/mnt/data" of=/dev/null bs=1M status=none || exit 1
+	end=$(date +%s%N)
+	echo "parallel_decompress=$1: $((SIZE_MB * 1000000000 / (end - start))) MB/s"
+}
+
+run 0
+run 1
+exit 0
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Multi-threaded zswap stress test.
+ *
+ * Every thread repeatedly fills a private anonymous buffer, pushes it out
+ * to swap with MADV_PAGEOUT, and faults it back in while checking the
+ * contents.  With zswap enabled this hammers concurrent zswap stores,
+ * loads and invalidations on the same swap device.  The achieved page
+ * throughput is reported at the end.
+ *
+ * Usage: zswap_stress [nr_threads] [mb_per_thread] [iterations]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+static size_t pagesize;
+static size_t buf_size;
+static int iterations;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long pages;
+	bool failed;
+};
+
+static void fill(char *buf, int id, int iter)
+{
+	size_t i;
+
+	for (i = 0; i < buf_size; i += pagesize) {
+		unsigned long *p = (unsigned long *)(buf + i);
+		size_t nr = i / pagesize;
+
+		/* mix of same-filled and compressible pages */
+		if (nr % 4 == 0)
+			memset(p, 0, pagesize);
+		else
+			memset(p, (id + iter + nr) & 0xff, pagesize / 2);
+		p[0] = nr ^ ((unsigned long)id << 32) ^ iter;
+	}
+}
+
+static bool check(char *buf, int id, int iter)
+{
+	size_t i;
+
+	for (i = 0; i < buf_size; i += pagesize) {
+		unsigned long *p = (unsigned long *)(buf + i);
+		size_t nr = i / pagesize;
+
+		if (p[0] != (nr ^ ((unsigned long)id << 32) ^ iter))
+			return false;
+	}
+	return true;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char *buf;
+	int iter;
+
+	buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		w->failed = true;
+		return NULL;
+	}
+
+	for (iter = 0; iter < iterations; iter++) {
+		fill(buf, w->id, iter);
+		if (madvise(buf, buf_size, MADV_PAGEOUT)) {
+			w->failed = true;
+			break;
+		}
+		if (!check(buf, w->id, iter)) {
+			w->failed = true;
+			break;
+		}
+		w->pages += 2 * (buf_size / pagesize);
+	}
+
+	munmap(buf, buf_size);
+	return NULL;
+}
+
+static bool zswap_enabled(void)
+{
+	char c = 'N';
+	FILE *f = fopen("/sys/module/zswap/parameters/enabled", "r");
+
+	if (!f)
+		return false;
+	if (fscanf(f, "%c", &c) != 1)
+		c = 'N';
+	fclose(f);
+	return c == 'Y';
+}
+
+static bool swap_enabled(void)
+{
+	char line[256];
+	int lines = 0;
+	FILE *f = fopen("/proc/swaps", "r");
+
+	if (!f)
+		return false;
+	while (fgets(line, sizeof(line), f))
+		lines++;
+	fclose(f);
+	/* the first line is the header */
+	return lines > 1;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	size_t mb = argc > 2 ? atoi(argv[2]) : 64;
+	struct timespec start, end;
+	unsigned long pages = 0;
+	struct worker *workers;
+	bool failed = false;
+	double secs;
+	int i;
+
+	iterations = argc > 3 ? atoi(argv[3]) : 10;
+	pagesize = getpagesize();
+	buf_size = mb << 20;
+
+	ksft_print_header();
+	ksft_set_plan(1);
+
+	if (!swap_enabled())
+		ksft_exit_skip("no swap device configured\n");
+	if (!zswap_enabled())
+		ksft_exit_skip("zswap is not enabled\n");
+	if (nr_threads <= 0 || !buf_size || iterations <= 0)
+		ksft_exit_fail_msg("invalid arguments\n");
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		ksft_exit_fail_msg("calloc: %s\n", strerror(errno));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			ksft_exit_fail_msg("pthread_create failed\n");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		failed |= workers[i].failed;
+		pages += workers[i].pages;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	ksft_print_msg("%d threads: %lu pages swapped out and in, %.0f pages/s\n",
+		       nr_threads, pages, pages / secs);
+
+	free(workers);
+	ksft_test_result(!failed, "zswap stress with %d threads\n", nr_threads);
+	ksft_finished();
+}
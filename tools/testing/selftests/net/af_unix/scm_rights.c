@@ -0,0 +1,456 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "../../kselftest_harness.h"
+
+#define NR_PAIRS	8
+#define NR_WORKERS	4
+#define NR_ROUNDS	500
+#define NR_CHAIN	4096
+
+FIXTURE(scm_rights)
+{
+	int fd[NR_PAIRS * 2];
+};
+
+FIXTURE_VARIANT(scm_rights)
+{
+	char name[16];
+	int type;
+};
+
+FIXTURE_VARIANT_ADD(scm_rights, dgram)
+{
+	.name = "UNIX",
+	.type = SOCK_DGRAM,
+};
+
+FIXTURE_VARIANT_ADD(scm_rights, stream)
+{
+	.name = "UNIX-STREAM",
+	.type = SOCK_STREAM,
+};
+
+FIXTURE_VARIANT_ADD(scm_rights, seqpacket)
+{
+	.name = "UNIX",
+	.type = SOCK_SEQPACKET,
+};
+
+static int count_sockets(const char *name)
+{
+	int sockets = -1, size, nr;
+	char proto[32];
+	char *line = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen("/proc/net/protocols", "r");
+	if (!f)
+		return -1;
+
+	while (getline(&line, &len, f) != -1) {
+		if (sscanf(line, "%31s %d %d", proto, &size, &nr) != 3)
+			continue;
+
+		if (!strcmp(proto, name)) {
+			sockets = nr;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return sockets;
+}
+
+/* The collector runs asynchronously from a workqueue, so give it a while.
+ * It is only kicked when an AF_UNIX socket is released, and freeing one
+ * garbage cycle can leave another one behind, so keep kicking it.
+ */
+static int wait_for_sockets(const char *name, int expected)
+{
+	int i, sockets = -1;
+
+	for (i = 0; i < 500; i++) {
+		close(socket(AF_UNIX, SOCK_DGRAM, 0));
+
+		sockets = count_sockets(name);
+		if (sockets == expected)
+			break;
+
+		usleep(10 * 1000);
+	}
+
+	return sockets;
+}
+
+FIXTURE_SETUP(scm_rights)
+{
+	int ret;
+
+	ret = unshare(CLONE_NEWNET);
+	ASSERT_EQ(0, ret);
+
+	ret = count_sockets(variant->name);
+	ASSERT_EQ(0, ret);
+
+	memset(self->fd, -1, sizeof(self->fd));
+}
+
+FIXTURE_TEARDOWN(scm_rights)
+{
+	int i;
+
+	for (i = 0; i < NR_PAIRS * 2; i++)
+		if (self->fd[i] >= 0)
+			close(self->fd[i]);
+
+	ASSERT_EQ(0, wait_for_sockets(variant->name, 0));
+}
+
+static int __send_fd(int sk, int fd)
+{
+	char cmsg_buf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {
+		.iov_base = "x",
+		.iov_len = 1,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buf,
+		.msg_controllen = sizeof(cmsg_buf),
+	};
+	struct cmsghdr *cmsg;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	return sendmsg(sk, &msg, 0) == 1 ? 0 : -1;
+}
+
+static void create_pairs(struct __test_metadata *_metadata,
+			 FIXTURE_DATA(scm_rights) *self,
+			 const FIXTURE_VARIANT(scm_rights) *variant,
+			 int n)
+{
+	int i, ret;
+
+	for (i = 0; i < n; i++) {
+		ret = socketpair(AF_UNIX, variant->type, 0, self->fd + i * 2);
+		ASSERT_EQ(0, ret);
+	}
+
+	ASSERT_EQ(n * 2, count_sockets(variant->name));
+}
+
+/* Put the receiving end of pair @inflight in flight in the queue of the
+ * receiving end of pair @receiver.
+ */
+static void send_fd_pair(struct __test_metadata *_metadata,
+			 const FIXTURE_DATA(scm_rights) *self,
+			 int inflight, int receiver)
+{
+	int ret;
+
+	ret = __send_fd(self->fd[receiver * 2], self->fd[inflight * 2 + 1]);
+	ASSERT_EQ(0, ret);
+}
+
+static void close_pairs(FIXTURE_DATA(scm_rights) *self, int n)
+{
+	int i;
+
+	for (i = 0; i < n * 2; i++) {
+		close(self->fd[i]);
+		self->fd[i] = -1;
+	}
+}
+
+#define create_pairs(n)						\
+	create_pairs(_metadata, self, variant, n)
+
+#define send_fd(inflight, receiver)					\
+	send_fd_pair(_metadata, self, inflight, receiver)
+
+TEST_F(scm_rights, self_ref)
+{
+	create_pairs(2);
+
+	send_fd(0, 0);
+
+	send_fd(1, 1);
+	send_fd(1, 1);
+
+	close_pairs(self, 2);
+}
+
+TEST_F(scm_rights, triangle)
+{
+	create_pairs(3);
+
+	send_fd(0, 1);
+	send_fd(1, 2);
+	send_fd(2, 0);
+
+	close_pairs(self, 3);
+}
+
+TEST_F(scm_rights, cross_edge)
+{
+	create_pairs(4);
+
+	/* Two cycles sharing pair 0, plus a dangling in-flight socket. */
+	send_fd(0, 1);
+	send_fd(1, 0);
+	send_fd(0, 2);
+	send_fd(2, 0);
+	send_fd(3, 1);
+
+	close_pairs(self, 4);
+}
+
+TEST_F(scm_rights, cross_edge_lowlink)
+{
+	create_pairs(4);
+
+	/* 0 -> 1 -> 2 -> 0 and 2 -> 3 -> 1 form one SCC, but the walk reaches
+	 * 3 from 2 and sees 1 on the stack before 1 has learned that it is
+	 * grouped with 0, so 3 ends up with a different lowlink.
+	 */
+	send_fd(0, 1);
+	send_fd(1, 2);
+	send_fd(2, 0);
+	send_fd(2, 3);
+	send_fd(3, 1);
+
+	close_pairs(self, 4);
+}
+
+TEST_F(scm_rights, not_cycle)
+{
+	create_pairs(2);
+
+	send_fd(0, 1);
+
+	/* The receiver of pair 0 is only in flight in a queue that is still
+	 * reachable, so nothing must be collected; the closed senders stay
+	 * pinned by their peers.
+	 */
+	close(self->fd[0]);
+	close(self->fd[1]);
+	close(self->fd[2]);
+	self->fd[0] = self->fd[1] = self->fd[2] = -1;
+
+	ASSERT_EQ(4, wait_for_sockets(variant->name, 0));
+}
+
+TEST_F(scm_rights, embryo)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	socklen_t addrlen = sizeof(sa_family_t);
+	int listener, client, ret;
+
+	if (variant->type == SOCK_DGRAM)
+		SKIP(return, "embryos only exist for connection-oriented sockets");
+
+	listener = socket(AF_UNIX, variant->type, 0);
+	ASSERT_LE(0, listener);
+
+	/* autobind */
+	ret = bind(listener, (struct sockaddr *)&addr, addrlen);
+	ASSERT_EQ(0, ret);
+
+	ret = listen(listener, 1);
+	ASSERT_EQ(0, ret);
+
+	addrlen = sizeof(addr);
+	ret = getsockname(listener, (struct sockaddr *)&addr, &addrlen);
+	ASSERT_EQ(0, ret);
+
+	client = socket(AF_UNIX, variant->type, 0);
+	ASSERT_LE(0, client);
+
+	ret = connect(client, (struct sockaddr *)&addr, addrlen);
+	ASSERT_EQ(0, ret);
+
+	/* The listener ends up in flight in its own, not yet accepted, embryo. */
+	ret = __send_fd(client, listener);
+	ASSERT_EQ(0, ret);
+
+	close(client);
+	close(listener);
+}
+
+/* Several processes keep building and abandoning cycles of random shape
+ * while sending fds, and everything has to be reclaimed in the end.
+ */
+TEST_F(scm_rights, stress)
+{
+	int i, status;
+
+	for (i = 0; i < NR_WORKERS; i++) {
+		pid_t pid = fork();
+
+		ASSERT_LE(0, pid);
+		if (pid)
+			continue;
+
+		srand(getpid());
+
+		for (int round = 0; round < NR_ROUNDS; round++) {
+			int n = 1 + rand() % NR_PAIRS;
+			int j;
+
+			for (j = 0; j < n; j++)
+				if (socketpair(AF_UNIX, variant->type, 0, self->fd + j * 2))
+					_exit(1);
+
+			for (j = 0; j < n; j++) {
+				int receiver = rand() % n;
+
+				if (__send_fd(self->fd[receiver * 2],
+					      self->fd[j * 2 + 1]))
+					_exit(1);
+			}
+
+			/* Close the cycle through the first pair. */
+			if (__send_fd(self->fd[0], self->fd[(n - 1) * 2 + 1]))
+				_exit(1);
+
+			for (j = 0; j < n * 2; j++)
+				close(self->fd[j]);
+		}
+
+		_exit(0);
+	}
+
+	for (i = 0; i < NR_WORKERS; i++) {
+		ASSERT_LT(0, wait(&status));
+		ASSERT_TRUE(WIFEXITED(status));
+		ASSERT_EQ(0, WEXITSTATUS(status));
+	}
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Keep a long chain of in-flight sockets alive while cycles elsewhere are
+ * built and collected, and time an unrelated sender in the meantime.  The
+ * collector only regroups the components that changed, so the chain must
+ * survive every run and the sender must not stall behind walks of it.
+ */
+TEST_F(scm_rights, stress_large_graph)
+{
+	long long start, max_ns = 0;
+	int head[2], pair[2], i, ret, status;
+	char buf[1];
+
+	ret = socketpair(AF_UNIX, variant->type, 0, head);
+	ASSERT_EQ(0, ret);
+
+	/* Each new pair's receiver holds the previous pair's receiver. */
+	for (i = 0; i < NR_CHAIN; i++) {
+		ret = socketpair(AF_UNIX, variant->type, 0, pair);
+		ASSERT_EQ(0, ret);
+
+		ret = __send_fd(pair[0], head[1]);
+		ASSERT_EQ(0, ret);
+
+		close(head[0]);
+		close(head[1]);
+		head[0] = pair[0];
+		head[1] = pair[1];
+	}
+
+	/* An in-flight receiver still pins its closed peer. */
+	ASSERT_EQ(NR_CHAIN * 2 + 2, count_sockets(variant->name));
+
+	for (i = 0; i < NR_WORKERS; i++) {
+		pid_t pid = fork();
+
+		ASSERT_LE(0, pid);
+		if (pid)
+			continue;
+
+		srand(getpid());
+
+		for (int round = 0; round < NR_ROUNDS; round++) {
+			int n = 1 + rand() % NR_PAIRS;
+			int j;
+
+			for (j = 0; j < n; j++)
+				if (socketpair(AF_UNIX, variant->type, 0, self->fd + j * 2))
+					_exit(1);
+
+			for (j = 0; j < n; j++)
+				if (__send_fd(self->fd[((j + 1) % n) * 2],
+					      self->fd[j * 2 + 1]))
+					_exit(1);
+
+			for (j = 0; j < n * 2; j++)
+				close(self->fd[j]);
+		}
+
+		_exit(0);
+	}
+
+	/* Pass one fd back and forth on a pair that is not in the graph. */
+	ret = socketpair(AF_UNIX, variant->type, 0, pair);
+	ASSERT_EQ(0, ret);
+
+	for (i = 0; i < NR_ROUNDS * 4; i++) {
+		start = now_ns();
+		ret = __send_fd(pair[0], pair[0]);
+		ASSERT_EQ(0, ret);
+
+		if (now_ns() - start > max_ns)
+			max_ns = now_ns() - start;
+
+		ret = recv(pair[1], buf, sizeof(buf), 0);
+		ASSERT_EQ(1, ret);
+	}
+
+	close(pair[0]);
+	close(pair[1]);
+
+	for (i = 0; i < NR_WORKERS; i++) {
+		ASSERT_LT(0, wait(&status));
+		ASSERT_TRUE(WIFEXITED(status));
+		ASSERT_EQ(0, WEXITSTATUS(status));
+	}
+
+	TH_LOG("max sendmsg() latency with %d sockets in flight: %lld us",
+	       NR_CHAIN, max_ns / 1000);
+
+	ASSERT_EQ(NR_CHAIN * 2 + 2, wait_for_sockets(variant->name, NR_CHAIN * 2 + 2));
+
+	close(head[0]);
+	close(head[1]);
+}
+
+TEST_HARNESS_MAIN
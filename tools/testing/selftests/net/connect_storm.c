@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Exhaust a small ephemeral port range over loopback and check that
+ * further connect() calls skip the busy ports without taking the bind
+ * bucket locks, using the EphemPortScanned and EphemPortLocked counters.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include <errno.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest_harness.h"
+
+#ifndef IP_LOCAL_PORT_RANGE
+#define IP_LOCAL_PORT_RANGE 51
+#endif
+
+#define PORT_LO		40000
+#define NR_PORTS	1024
+#define NR_RETRIES	100
+
+FIXTURE(connect_storm)
+{
+	struct sockaddr_in addr;
+	int listener;
+	int fd[NR_PORTS];
+};
+
+static unsigned long read_netstat(const char *name)
+{
+	char *names = NULL, *values = NULL;
+	unsigned long val = -1UL;
+	size_t nlen = 0, vlen = 0;
+	char *n, *v, *sn, *sv;
+	FILE *f;
+
+	f = fopen("/proc/net/netstat", "r");
+	if (!f)
+		return -1UL;
+
+	while (getline(&names, &nlen, f) != -1 &&
+	       getline(&values, &vlen, f) != -1) {
+		if (strncmp(names, "TcpExt:", 7))
+			continue;
+
+		n = strtok_r(names, " \n", &sn);
+		v = strtok_r(values, " \n", &sv);
+		while (n && v) {
+			if (!strcmp(n, name)) {
+				val = strtoul(v, NULL, 10);
+				break;
+			}
+			n = strtok_r(NULL, " \n", &sn);
+			v = strtok_r(NULL, " \n", &sv);
+		}
+		break;
+	}
+
+	free(names);
+	free(values);
+	fclose(f);
+
+	return val;
+}
+
+static int setup_loopback(void)
+{
+	struct ifreq ifr = {
+		.ifr_name = "lo",
+	};
+	int fd, ret;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	ret = ioctl(fd, SIOCGIFFLAGS, &ifr);
+	if (!ret) {
+		ifr.ifr_flags |= IFF_UP;
+		ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
+	}
+
+	close(fd);
+	return ret;
+}
+
+static int connect_one(FIXTURE_DATA(connect_storm) *self)
+{
+	__u32 range = (__u32)(PORT_LO + NR_PORTS - 1) << 16 | PORT_LO;
+	int fd, err;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (setsockopt(fd, IPPROTO_IP, IP_LOCAL_PORT_RANGE,
+		       &range, sizeof(range))) {
+		err = -errno;
+		goto err;
+	}
+
+	if (connect(fd, (struct sockaddr *)&self->addr, sizeof(self->addr))) {
+		err = -errno;
+		goto err;
+	}
+
+	return fd;
+err:
+	close(fd);
+	return err;
+}
+
+FIXTURE_SETUP(connect_storm)
+{
+	socklen_t len = sizeof(self->addr);
+	int i, ret;
+
+	self->listener = -1;
+	memset(self->fd, -1, sizeof(self->fd));
+
+	ASSERT_EQ(0, unshare(CLONE_NEWNET));
+	ASSERT_EQ(0, setup_loopback());
+
+	if (read_netstat("EphemPortScanned") == -1UL)
+		SKIP(return, "kernel lacks EphemPortScanned");
+
+	/* Keep the listener out of the clients' port range. */
+	self->addr.sin_family = AF_INET;
+	self->addr.sin_port = htons(PORT_LO - 1);
+	self->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	self->listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_LE(0, self->listener);
+
+	ret = bind(self->listener, (struct sockaddr *)&self->addr, len);
+	ASSERT_EQ(0, ret);
+
+	ret = listen(self->listener, NR_PORTS);
+	ASSERT_EQ(0, ret);
+
+	for (i = 0; i < NR_PORTS; i++) {
+		self->fd[i] = connect_one(self);
+		ASSERT_LE(0, self->fd[i]);
+	}
+}
+
+FIXTURE_TEARDOWN(connect_storm)
+{
+	int i;
+
+	for (i = 0; i < NR_PORTS; i++)
+		if (self->fd[i] >= 0)
+			close(self->fd[i]);
+	if (self->listener >= 0)
+		close(self->listener);
+}
+
+TEST_F(connect_storm, exhausted)
+{
+	unsigned long scanned, locked;
+	struct timespec start, end;
+	int i, fd;
+
+	scanned = read_netstat("EphemPortScanned");
+	locked = read_netstat("EphemPortLocked");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NR_RETRIES; i++) {
+		fd = connect_one(self);
+		ASSERT_EQ(-EADDRNOTAVAIL, fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	scanned = read_netstat("EphemPortScanned") - scanned;
+	locked = read_netstat("EphemPortLocked") - locked;
+
+	TH_LOG("%d failed connect(): %lu ports scanned, %lu locked, %ld us",
+	       NR_RETRIES, scanned, locked,
+	       (end.tv_sec - start.tv_sec) * 1000000 +
+	       (end.tv_nsec - start.tv_nsec) / 1000);
+
+	ASSERT_EQ(NR_RETRIES * NR_PORTS, scanned);
+	ASSERT_EQ(0, locked);
+}
+
+TEST_F(connect_storm, one_free)
+{
+	struct linger linger = {
+		.l_onoff = 1,
+		.l_linger = 0,
+	};
+	unsigned long scanned, locked;
+	int victim = NR_PORTS / 2;
+	int ret;
+
+	/* Reset instead of FIN, so that no TIME_WAIT socket keeps the
+	 * port busy.
+	 */
+	ret = setsockopt(self->fd[victim], SOL_SOCKET, SO_LINGER,
+			 &linger, sizeof(linger));
+	ASSERT_EQ(0, ret);
+	close(self->fd[victim]);
+
+	scanned = read_netstat("EphemPortScanned");
+	locked = read_netstat("EphemPortLocked");
+
+	self->fd[victim] = connect_one(self);
+	ASSERT_LE(0, self->fd[victim]);
+
+	scanned = read_netstat("EphemPortScanned") - scanned;
+	locked = read_netstat("EphemPortLocked") - locked;
+
+	TH_LOG("connect(): %lu ports scanned, %lu locked", scanned, locked);
+
+	ASSERT_LE(1, scanned);
+	ASSERT_EQ(1, locked);
+}
+
+TEST_HARNESS_MAIN
@@ -0,0 +1,386 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Helper for napi_config.sh: read and change per-NAPI settings through the
+ * netdev generic netlink family, and move UDP traffic over a NAPI that an
+ * epoll busy poller keeps its IRQs suspended on.
+ *
+ *   napi_config list IFNAME
+ *   napi_config get NAPI_ID
+ *   napi_config set NAPI_ID [defer N] [gro NS] [suspend NS]
+ *   napi_config recv [-b] ADDR PORT COUNT
+ *   napi_config send ADDR PORT COUNT
+ *
+ * "get" prints "defer GRO SUSPEND" on one line.  "recv -b" waits with
+ * epoll on a socket that prefers busy polling; without -b it blocks in
+ * recv() and only works if the NAPI is driven by its IRQ.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <linux/genetlink.h>
+#include <linux/netdev.h>
+#include <linux/netlink.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL	69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET	70
+#endif
+
+#define NLA_DATA(nla)	((void *)(nla) + NLA_HDRLEN)
+#define RECV_TIMEOUT_MS	5000
+
+struct nl_req {
+	struct nlmsghdr nlh;
+	struct genlmsghdr genl;
+	char buf[256];
+};
+
+static int nl_fd;
+static uint16_t netdev_family;
+
+static void nla_put(struct nlmsghdr *nlh, int type, const void *data, int len)
+{
+	struct nlattr *nla = (void *)nlh + NLMSG_ALIGN(nlh->nlmsg_len);
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy(NLA_DATA(nla), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+static void nla_put_u32(struct nlmsghdr *nlh, int type, uint32_t val)
+{
+	nla_put(nlh, type, &val, sizeof(val));
+}
+
+static void nla_put_u64(struct nlmsghdr *nlh, int type, uint64_t val)
+{
+	nla_put(nlh, type, &val, sizeof(val));
+}
+
+/* NLA_UINT attributes are 4 or 8 bytes long */
+static uint64_t nla_get_uint(const struct nlattr *nla)
+{
+	if (nla->nla_len - NLA_HDRLEN == sizeof(uint32_t))
+		return *(uint32_t *)NLA_DATA(nla);
+	return *(uint64_t *)NLA_DATA(nla);
+}
+
+static void nl_req_init(struct nl_req *req, uint16_t family, int cmd, int flags)
+{
+	memset(req, 0, sizeof(*req));
+	req->nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	req->nlh.nlmsg_type = family;
+	req->nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	req->genl.cmd = cmd;
+	req->genl.version = 1;
+}
+
+typedef void (*nl_cb)(struct genlmsghdr *genl, int len, void *arg);
+
+/* Send @req and feed every reply to @cb until the ack or end of dump */
+static int nl_talk(struct nl_req *req, nl_cb cb, void *arg)
+{
+	static char buf[32768];
+	struct nlmsghdr *nlh;
+	int len;
+
+	if (send(nl_fd, req, req->nlh.nlmsg_len, 0) < 0)
+		error(1, errno, "send netlink");
+
+	for (;;) {
+		len = recv(nl_fd, buf, sizeof(buf), 0);
+		if (len < 0)
+			error(1, errno, "recv netlink");
+
+		for (nlh = (void *)buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+				/* the ack of a dump comes after NLMSG_DONE */
+				return err->error;
+			}
+			if (cb)
+				cb(NLMSG_DATA(nlh),
+				   nlh->nlmsg_len - NLMSG_HDRLEN, arg);
+		}
+	}
+}
+
+#define genl_for_each_attr(nla, genl, len)				\
+	for (nla = (void *)(genl) + GENL_HDRLEN,			\
+	     len -= GENL_HDRLEN;					\
+	     len >= (int)sizeof(*nla) && nla->nla_len >= sizeof(*nla) && \
+	     nla->nla_len <= len;					\
+	     len -= NLA_ALIGN(nla->nla_len),				\
+	     nla = (void *)nla + NLA_ALIGN(nla->nla_len))
+
+static void family_cb(struct genlmsghdr *genl, int len, void *arg)
+{
+	struct nlattr *nla;
+
+	genl_for_each_attr(nla, genl, len)
+		if (nla->nla_type == CTRL_ATTR_FAMILY_ID)
+			netdev_family = *(uint16_t *)NLA_DATA(nla);
+}
+
+static void nl_open(void)
+{
+	struct nl_req req;
+	int err;
+
+	nl_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (nl_fd < 0)
+		error(1, errno, "socket netlink");
+
+	nl_req_init(&req, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0);
+	nla_put(&req.nlh, CTRL_ATTR_FAMILY_NAME, NETDEV_FAMILY_NAME,
+		sizeof(NETDEV_FAMILY_NAME));
+	err = nl_talk(&req, family_cb, NULL);
+	if (err || !netdev_family)
+		error(4, -err, "netdev genl family not available");
+}
+
+static void list_cb(struct genlmsghdr *genl, int len, void *arg)
+{
+	struct nlattr *nla;
+
+	genl_for_each_attr(nla, genl, len)
+		if (nla->nla_type == NETDEV_A_NAPI_ID)
+			printf("%u\n", *(uint32_t *)NLA_DATA(nla));
+}
+
+static int do_list(const char *ifname)
+{
+	uint32_t ifindex = if_nametoindex(ifname);
+	struct nl_req req;
+
+	if (!ifindex)
+		error(1, errno, "if_nametoindex %s", ifname);
+
+	nl_req_init(&req, netdev_family, NETDEV_CMD_NAPI_GET, NLM_F_DUMP);
+	nla_put_u32(&req.nlh, NETDEV_A_NAPI_IFINDEX, ifindex);
+
+	return nl_talk(&req, list_cb, NULL);
+}
+
+static void get_cb(struct genlmsghdr *genl, int len, void *arg)
+{
+	uint64_t *cfg = arg;
+	struct nlattr *nla;
+
+	genl_for_each_attr(nla, genl, len) {
+		switch (nla->nla_type) {
+		case NETDEV_A_NAPI_DEFER_HARD_IRQS:
+			cfg[0] = *(uint32_t *)NLA_DATA(nla);
+			break;
+		case NETDEV_A_NAPI_GRO_FLUSH_TIMEOUT:
+			cfg[1] = nla_get_uint(nla);
+			break;
+		case NETDEV_A_NAPI_IRQ_SUSPEND_TIMEOUT:
+			cfg[2] = nla_get_uint(nla);
+			break;
+		}
+	}
+}
+
+static int do_get(uint32_t napi_id)
+{
+	uint64_t cfg[3] = { -1ULL, -1ULL, -1ULL };
+	struct nl_req req;
+	int err;
+
+	nl_req_init(&req, netdev_family, NETDEV_CMD_NAPI_GET, 0);
+	nla_put_u32(&req.nlh, NETDEV_A_NAPI_ID, napi_id);
+
+	err = nl_talk(&req, get_cb, cfg);
+	if (!err)
+		printf("%llu %llu %llu\n", (unsigned long long)cfg[0],
+		       (unsigned long long)cfg[1], (unsigned long long)cfg[2]);
+	return err;
+}
+
+static int do_set(uint32_t napi_id, int argc, char **argv)
+{
+	struct nl_req req;
+	int i;
+
+	nl_req_init(&req, netdev_family, NETDEV_CMD_NAPI_SET, 0);
+	nla_put_u32(&req.nlh, NETDEV_A_NAPI_ID, napi_id);
+
+	for (i = 0; i + 1 < argc; i += 2) {
+		unsigned long long val = strtoull(argv[i + 1], NULL, 0);
+
+		if (!strcmp(argv[i], "defer"))
+			nla_put_u32(&req.nlh, NETDEV_A_NAPI_DEFER_HARD_IRQS, val);
+		else if (!strcmp(argv[i], "gro"))
+			nla_put_u64(&req.nlh, NETDEV_A_NAPI_GRO_FLUSH_TIMEOUT, val);
+		else if (!strcmp(argv[i], "suspend"))
+			nla_put_u64(&req.nlh, NETDEV_A_NAPI_IRQ_SUSPEND_TIMEOUT, val);
+		else
+			error(1, 0, "unknown setting %s", argv[i]);
+	}
+	if (i != argc)
+		error(1, 0, "missing value for %s", argv[i]);
+
+	return nl_talk(&req, NULL, NULL);
+}
+
+static void udp_addr(struct sockaddr_in *sin, const char *addr, const char *port)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(atoi(port));
+	if (inet_pton(AF_INET, addr, &sin->sin_addr) != 1)
+		error(1, 0, "bad address %s", addr);
+}
+
+static int do_send(const char *addr, const char *port, int count)
+{
+	struct sockaddr_in sin;
+	int fd, i;
+
+	udp_addr(&sin, addr, port);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		error(1, errno, "socket");
+
+	for (i = 0; i < count; i++) {
+		if (sendto(fd, &i, sizeof(i), 0, (void *)&sin, sizeof(sin)) < 0)
+			error(1, errno, "sendto");
+		/* stay below the veth ring size */
+		if (!(i % 64))
+			usleep(1000);
+	}
+
+	close(fd);
+	return 0;
+}
+
+static int do_recv(bool busy_poll, const char *addr, const char *port, int count)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct sockaddr_in sin;
+	int fd, epfd, n = 0;
+	int one = 1, budget = 64;
+	char buf[64];
+
+	udp_addr(&sin, addr, port);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		error(1, errno, "socket");
+
+	if (bind(fd, (void *)&sin, sizeof(sin)))
+		error(1, errno, "bind");
+
+	if (!busy_poll) {
+		struct timeval tv = { .tv_sec = RECV_TIMEOUT_MS / 1000 };
+
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+			error(1, errno, "setsockopt SO_RCVTIMEO");
+
+		/* tell the sender we are ready */
+		printf("ready\n");
+		fflush(stdout);
+
+		while (n < count) {
+			if (recv(fd, buf, sizeof(buf), 0) < 0)
+				error(1, errno, "recv after %d datagrams", n);
+			n++;
+		}
+		return 0;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) ||
+	    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)))
+		error(1, errno, "setsockopt busy poll");
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		error(1, errno, "epoll_create1");
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+		error(1, errno, "epoll_ctl");
+
+	printf("ready\n");
+	fflush(stdout);
+
+	while (n < count) {
+		int ret = epoll_wait(epfd, &ev, 1, RECV_TIMEOUT_MS);
+
+		if (ret < 0)
+			error(1, errno, "epoll_wait");
+		if (!ret)
+			error(1, 0, "timed out after %d datagrams", n);
+
+		while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+			n++;
+	}
+
+	close(epfd);
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool busy_poll = false;
+	int err;
+
+	if (argc < 3)
+		goto usage;
+
+	if (!strcmp(argv[1], "send") && argc == 5)
+		return do_send(argv[2], argv[3], atoi(argv[4]));
+
+	if (!strcmp(argv[1], "recv")) {
+		if (argc == 6 && !strcmp(argv[2], "-b")) {
+			busy_poll = true;
+			argv++;
+			argc--;
+		}
+		if (argc == 5)
+			return do_recv(busy_poll, argv[2], argv[3], atoi(argv[4]));
+		goto usage;
+	}
+
+	nl_open();
+
+	if (!strcmp(argv[1], "list") && argc == 3)
+		err = do_list(argv[2]);
+	else if (!strcmp(argv[1], "get") && argc == 3)
+		err = do_get(strtoul(argv[2], NULL, 0));
+	else if (!strcmp(argv[1], "set"))
+		err = do_set(strtoul(argv[2], NULL, 0), argc - 3, argv + 3);
+	else
+		goto usage;
+
+	if (err)
+		error(1, -err, "%s", argv[1]);
+	return 0;
+
+usage:
+	error(1, 0, "Usage: %s list IFNAME | get ID | set ID [defer N] [gro NS] [suspend NS] | recv [-b] ADDR PORT COUNT | send ADDR PORT COUNT",
+	      argv[0]);
+	return 1;
+}
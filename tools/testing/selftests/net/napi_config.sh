@@ -0,0 +1,112 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Per-NAPI settings through the netdev netlink family on veth: napi-set and
+# napi-get round-trip, settings survive the NAPI being re-created, the
+# device-wide sysfs knob still applies, and an epoll busy poller with IRQ
+# suspension receives everything and leaves the NAPI IRQ driven again.
+
+# return code to signal skipped test
+ksft_skip=4
+
+NR_DGRAMS=10000
+PORT=9000
+
+ns_tx=napi-tx-$$
+ns_rx=napi-rx-$$
+ret=0
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: Test needs root"
+	exit $ksft_skip
+fi
+
+if ! ethtool -h > /dev/null 2>&1; then
+	echo "SKIP: Could not run test without ethtool"
+	exit $ksft_skip
+fi
+
+busy_poll=$(cat /proc/sys/net/core/busy_poll)
+
+cleanup() {
+	echo "$busy_poll" > /proc/sys/net/core/busy_poll
+	ip netns del "$ns_tx" 2>/dev/null
+	ip netns del "$ns_rx" 2>/dev/null
+}
+trap cleanup EXIT
+
+check() {
+	local desc=$1 expected=$2 got=$3
+
+	if [ "$expected" = "$got" ]; then
+		echo "PASS: $desc"
+	else
+		echo "FAIL: $desc: expected '$expected', got '$got'"
+		ret=1
+	fi
+}
+
+rx() {
+	ip netns exec "$ns_rx" ./napi_config "$@"
+}
+
+ip netns add "$ns_tx" || exit $ksft_skip
+ip netns add "$ns_rx" || exit $ksft_skip
+ip -netns "$ns_tx" link add veth0 type veth peer name veth1 netns "$ns_rx"
+ip -netns "$ns_tx" addr add 192.0.2.1/24 dev veth0
+ip -netns "$ns_rx" addr add 192.0.2.2/24 dev veth1
+ip -netns "$ns_tx" link set veth0 up
+ip -netns "$ns_rx" link set veth1 up
+
+# veth only runs NAPI on the receive side with GRO or XDP
+ip netns exec "$ns_rx" ethtool -K veth1 gro on
+
+id=$(rx list veth1 | head -n 1)
+if [ -z "$id" ]; then
+	echo "SKIP: veth1 has no NAPI"
+	exit $ksft_skip
+fi
+
+if ! rx set "$id" defer 7 gro 20000 suspend 40000000; then
+	echo "SKIP: napi-set not supported"
+	exit $ksft_skip
+fi
+check "napi-set round-trip" "7 20000 40000000" "$(rx get "$id")"
+
+rx set "$id" defer 3
+check "napi-set changes only the attributes given" "3 20000 40000000" \
+	"$(rx get "$id")"
+
+ip netns exec "$ns_rx" ethtool -K veth1 gro off
+ip netns exec "$ns_rx" ethtool -K veth1 gro on
+check "NAPI ID kept across re-creation" "$id" "$(rx list veth1 | head -n 1)"
+check "settings kept across re-creation" "3 20000 40000000" "$(rx get "$id")"
+
+echo 50000 | ip netns exec "$ns_rx" \
+	tee /sys/class/net/veth1/gro_flush_timeout > /dev/null
+check "sysfs gro_flush_timeout applies to the NAPI" "3 50000 40000000" \
+	"$(rx get "$id")"
+
+# IRQ suspension: busy poll with preference while the NAPI defers its
+# IRQs, then make sure it is driven by its IRQ again once nobody polls.
+echo 50 > /proc/sys/net/core/busy_poll
+rx set "$id" defer 100 gro 50000 suspend 20000000
+
+coproc rx recv -b 192.0.2.2 "$PORT" "$NR_DGRAMS"
+read -r -u "${COPROC[0]}" ready
+pid=$COPROC_PID
+ip netns exec "$ns_tx" ./napi_config send 192.0.2.2 "$PORT" "$NR_DGRAMS"
+wait "$pid"
+check "busy poller with IRQ suspension receives every datagram" 0 $?
+
+echo 0 > /proc/sys/net/core/busy_poll
+rx set "$id" defer 0 gro 0 suspend 0
+
+coproc rx recv 192.0.2.2 "$PORT" "$NR_DGRAMS"
+read -r -u "${COPROC[0]}" ready
+pid=$COPROC_PID
+ip netns exec "$ns_tx" ./napi_config send 192.0.2.2 "$PORT" "$NR_DGRAMS"
+wait "$pid"
+check "NAPI IRQ driven again after busy polling stopped" 0 $?
+
+exit $ret
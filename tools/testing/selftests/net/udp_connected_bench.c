@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Measure UDP receive lookup cost with many connected sockets sharing
+ * one local address and port, as QUIC servers do with one connected
+ * socket per client.
+ *
+ * Every peer sends to the shared port in turn, and each datagram must be
+ * delivered to the server socket connected to that peer rather than to
+ * the unconnected listener.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static int cfg_num_socks = 10000;
+static int cfg_rounds = 10;
+static int cfg_port = 8000;
+
+static int *peer_fds;
+static int *conn_fds;
+static int listen_fd;
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-n num_sockets] [-r rounds] [-p port]",
+	      filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:p:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			cfg_num_socks = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg_rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || cfg_num_socks <= 0 || cfg_rounds <= 0)
+		usage(argv[0]);
+}
+
+static void raise_nofile(void)
+{
+	struct rlimit rlim;
+
+	rlim.rlim_cur = rlim.rlim_max = 2 * cfg_num_socks + 64;
+	if (setrlimit(RLIMIT_NOFILE, &rlim))
+		error(1, errno, "setrlimit %lu", (unsigned long)rlim.rlim_cur);
+}
+
+static int server_socket(const struct sockaddr_in *addr)
+{
+	struct timeval tv = { .tv_sec = 1 };
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		error(1, errno, "socket");
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		error(1, errno, "setsockopt SO_REUSEADDR");
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		error(1, errno, "setsockopt SO_RCVTIMEO");
+
+	if (bind(fd, (void *)addr, sizeof(*addr)))
+		error(1, errno, "bind server");
+
+	return fd;
+}
+
+static void setup(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(cfg_port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct sockaddr_in peer;
+	socklen_t len;
+	int i;
+
+	peer_fds = calloc(cfg_num_socks, sizeof(*peer_fds));
+	conn_fds = calloc(cfg_num_socks, sizeof(*conn_fds));
+	if (!peer_fds || !conn_fds)
+		error(1, ENOMEM, "calloc");
+
+	listen_fd = server_socket(&addr);
+
+	for (i = 0; i < cfg_num_socks; i++) {
+		peer_fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (peer_fds[i] < 0)
+			error(1, errno, "socket peer");
+
+		if (connect(peer_fds[i], (void *)&addr, sizeof(addr)))
+			error(1, errno, "connect peer");
+
+		len = sizeof(peer);
+		if (getsockname(peer_fds[i], (void *)&peer, &len))
+			error(1, errno, "getsockname");
+
+		conn_fds[i] = server_socket(&addr);
+		if (connect(conn_fds[i], (void *)&peer, sizeof(peer)))
+			error(1, errno, "connect server");
+	}
+}
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void run(void)
+{
+	unsigned long start, elapsed, total;
+	int i, r;
+	char buf;
+
+	total = (unsigned long)cfg_num_socks * cfg_rounds;
+	start = now_ns();
+
+	for (r = 0; r < cfg_rounds; r++) {
+		for (i = 0; i < cfg_num_socks; i++) {
+			buf = i;
+			if (send(peer_fds[i], &buf, 1, 0) != 1)
+				error(1, errno, "send %d", i);
+
+			if (recv(conn_fds[i], &buf, 1, 0) != 1)
+				error(1, errno, "recv %d: not delivered to the connected socket",
+				      i);
+
+			if (buf != (char)i)
+				error(1, 0, "recv %d: wrong payload", i);
+		}
+	}
+
+	elapsed = now_ns() - start;
+
+	if (recv(listen_fd, &buf, 1, MSG_DONTWAIT) != -1 || errno != EAGAIN)
+		error(1, 0, "datagram leaked to the unconnected socket");
+
+	fprintf(stderr, "%d connected sockets: %lu datagrams in %lu ms, %lu ns/datagram\n",
+		cfg_num_socks, total, elapsed / 1000000, elapsed / total);
+}
+
+int main(int argc, char **argv)
+{
+	parse_opts(argc, argv);
+	raise_nofile();
+	setup();
+	run();
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Measure the transmit rate of a copy-mode AF_XDP socket.
+ *
+ * Frames are queued on the Tx ring in batches and the kernel is kicked
+ * with sendto() after every batch, as xdpsock -t -S does.  The rate is
+ * counted from the completion ring, so only frames the driver accepted
+ * are reported.  Run it on one end of a veth pair to compare the generic
+ * xmit path of different kernels.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define NUM_FRAMES	4096
+#define FRAME_SIZE	2048
+#define RING_SIZE	2048
+
+static const char *cfg_ifname;
+static int cfg_queue;
+static int cfg_pkt_size = 64;
+static int cfg_batch = 64;
+static int cfg_seconds = 5;
+
+struct ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	void *desc;
+	uint32_t cached_prod;
+	uint32_t cached_cons;
+};
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s -i ifname [-q queue] [-s pkt_size] [-b batch] [-t seconds]",
+	      filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "b:i:q:s:t:")) != -1) {
+		switch (c) {
+		case 'b':
+			cfg_batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			cfg_ifname = optarg;
+			break;
+		case 'q':
+			cfg_queue = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg_pkt_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || !cfg_ifname || cfg_batch <= 0 ||
+	    cfg_batch > RING_SIZE || cfg_seconds <= 0 ||
+	    cfg_pkt_size < ETH_ZLEN || cfg_pkt_size > FRAME_SIZE)
+		usage(argv[0]);
+}
+
+static void map_ring(int fd, struct ring *ring, const struct xdp_ring_offset *off,
+		     size_t desc_size, off_t pgoff)
+{
+	void *map;
+
+	map = mmap(NULL, off->desc + RING_SIZE * desc_size,
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (map == MAP_FAILED)
+		error(1, errno, "mmap ring");
+
+	ring->producer = map + off->producer;
+	ring->consumer = map + off->consumer;
+	ring->desc = map + off->desc;
+}
+
+static int xsk_socket(void **umem_area, struct ring *tx, struct ring *cq)
+{
+	struct xdp_umem_reg reg = {};
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp = {};
+	int size = RING_SIZE;
+	struct ring fq;
+	socklen_t len;
+	int fd;
+
+	fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (fd < 0)
+		error(1, errno, "socket AF_XDP");
+
+	*umem_area = mmap(NULL, NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (*umem_area == MAP_FAILED)
+		error(1, errno, "mmap umem");
+
+	reg.addr = (uintptr_t)*umem_area;
+	reg.len = NUM_FRAMES * FRAME_SIZE;
+	reg.chunk_size = FRAME_SIZE;
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+		error(1, errno, "setsockopt XDP_UMEM_REG");
+
+	/* bind() wants a fill ring even if nothing is received */
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+	    setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) ||
+	    setsockopt(fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)))
+		error(1, errno, "setsockopt ring size");
+
+	len = sizeof(off);
+	if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len))
+		error(1, errno, "getsockopt XDP_MMAP_OFFSETS");
+
+	map_ring(fd, &fq, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+	map_ring(fd, cq, &off.cr, sizeof(uint64_t),
+		 XDP_UMEM_PGOFF_COMPLETION_RING);
+	map_ring(fd, tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = if_nametoindex(cfg_ifname);
+	sxdp.sxdp_queue_id = cfg_queue;
+	sxdp.sxdp_flags = XDP_COPY;
+	if (!sxdp.sxdp_ifindex)
+		error(1, errno, "if_nametoindex %s", cfg_ifname);
+	if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)))
+		error(1, errno, "bind %s queue %d", cfg_ifname, cfg_queue);
+
+	return fd;
+}
+
+/* Broadcast frames of a local experimental ethertype, dropped by the peer */
+static void fill_frames(void *umem_area)
+{
+	static const uint8_t hdr[ETH_HLEN] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0x02, 0x00, 0x00, 0x00, 0x00, 0x01,
+		0x88, 0xb5,
+	};
+	int i;
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		uint8_t *frame = umem_area + (size_t)i * FRAME_SIZE;
+
+		memcpy(frame, hdr, sizeof(hdr));
+		memset(frame + ETH_HLEN, i, cfg_pkt_size - ETH_HLEN);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t free_frames[NUM_FRAMES];
+	unsigned long long completed = 0;
+	unsigned int nr_free = NUM_FRAMES;
+	struct ring tx = {}, cq = {};
+	double start, elapsed;
+	void *umem_area;
+	int fd, i;
+
+	parse_opts(argc, argv);
+
+	fd = xsk_socket(&umem_area, &tx, &cq);
+	fill_frames(umem_area);
+	for (i = 0; i < NUM_FRAMES; i++)
+		free_frames[i] = (uint64_t)i * FRAME_SIZE;
+
+	start = now();
+	do {
+		struct xdp_desc *descs = tx.desc;
+		uint64_t *addrs = cq.desc;
+		uint32_t prod, cons, n;
+
+		/* Queue a batch, if there is room in the ring and frames */
+		cons = __atomic_load_n(tx.consumer, __ATOMIC_ACQUIRE);
+		n = RING_SIZE - (tx.cached_prod - cons);
+		if (n > nr_free)
+			n = nr_free;
+		if (n >= (uint32_t)cfg_batch) {
+			for (i = 0; i < cfg_batch; i++) {
+				struct xdp_desc *desc;
+
+				desc = &descs[tx.cached_prod++ & (RING_SIZE - 1)];
+				desc->addr = free_frames[--nr_free];
+				desc->len = cfg_pkt_size;
+				desc->options = 0;
+			}
+			__atomic_store_n(tx.producer, tx.cached_prod,
+					 __ATOMIC_RELEASE);
+		}
+
+		if (sendto(fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+			error(1, errno, "sendto");
+
+		/* Take back the frames the driver is done with */
+		prod = __atomic_load_n(cq.producer, __ATOMIC_ACQUIRE);
+		for (; cq.cached_cons != prod; cq.cached_cons++, completed++)
+			free_frames[nr_free++] =
+				addrs[cq.cached_cons & (RING_SIZE - 1)];
+		__atomic_store_n(cq.consumer, cq.cached_cons, __ATOMIC_RELEASE);
+	} while (now() - start < cfg_seconds);
+	elapsed = now() - start;
+
+	printf("%s: %d byte frames, batch %d: %.0f pps\n", cfg_ifname,
+	       cfg_pkt_size, cfg_batch, completed / elapsed);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Transmit rate of a copy-mode AF_XDP socket on a veth device, for
+# comparing the generic xmit path of different kernels.
+
+# return code to signal skipped test
+ksft_skip=4
+
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-5}
+ns=xsk-bench-$$
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: Test needs root"
+	exit $ksft_skip
+fi
+
+cleanup() {
+	ip netns del "$ns" 2>/dev/null
+}
+trap cleanup EXIT
+
+ip netns add "$ns" || exit $ksft_skip
+ip -netns "$ns" link add veth0 type veth peer name veth1 || exit $ksft_skip
+ip -netns "$ns" link set veth0 up
+ip -netns "$ns" link set veth1 up
+
+for size in 64 1500; do
+	for batch in 1 16 64; do
+		ip netns exec "$ns" ./xsk_tx_bench -i veth0 -s $size \
+			-b $batch -t "$SECONDS_PER_RUN" || exit 1
+		# the previous socket releases the queue asynchronously
+		sleep 1
+	done
+done
+exit 0